@@ -0,0 +1,12 @@
+mkdir -p build
+
+# Runs headless (EGL), so no window or display is needed, e.g. on Mesa llvmpipe:
+#   LIBGL_ALWAYS_SOFTWARE=1 ./build/bench -b baseline.json
+gcc \
+-O2 \
+-DLU_HEADLESS \
+core/main.c \
+../luGL/luGL.c \
+-o build/bench \
+-lGLEW -lGL -lEGL -lglfw -lm -lpthread \
+-I../luGL
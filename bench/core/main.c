@@ -0,0 +1,436 @@
+#include <GL/glew.h>
+#include <math.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "luGL.h"
+
+// Benchmarks for luGL's hot paths, run on a headless context so they work without a display (and on Mesa llvmpipe in CI).
+// Every benchmark runs once to warm up, then a number of repetitions, and the median is what gets compared against the baseline.
+// A benchmark that can't run (e.g. the virtual texture won't open) fails the whole run.
+//   ./build/bench                               Print results as JSON
+//   ./build/bench -o results.json               Write them to a file instead
+//   ./build/bench -b baseline.json -t 15        Fail if any median is over 15% slower than the baseline's (20% by default)
+//   ./build/bench -r 11                         Use 11 repetitions instead of 7
+//   ./build/bench -v 65536                      Pan over a 65536 x 65536 virtual texture instead of 16384 x 16384
+// The virtual texture is generated into build/ the first time a size is used (a 65536 one takes about 22 GB) and reused after that.
+
+struct Vertex {
+  float pos[2];
+  float tex_coord[2];
+};
+
+// Vertex information for opengl, the same format as the window_image example
+size_t vertex_num_components = 2;
+size_t vertex_component_counts[] = {2, 2};
+size_t vertex_component_sizes[] = {sizeof(float), sizeof(float)};
+GLenum vertex_component_types[] = {GL_FLOAT, GL_FLOAT};
+
+#define BUILD_VERTICES 500000 // Vertices added one at a time by mesh_add_bytes
+#define SEND_VERTICES 500000  // Vertices in the mesh uploaded by mesh_send
+#define DRAW_MESHES 2000      // Small meshes drawn by the draw benchmarks
+#define SHADER_PROGRAMS 10    // Programs compiled and linked per repetition
+#define TEXTURE_LOADS 5       // Times the texture is decoded and uploaded per repetition
+
+#define VT_TILE_SIZE 256       // Tile size of the generated virtual texture
+#define VT_CACHE_TILES 16      // Cache tiles per side, a 4096 x 4096 cache texture
+#define VT_VIEW_WIDTH 1920     // Pixels of level 0 the panning view covers
+#define VT_VIEW_HEIGHT 1080
+#define VT_PAN_FRAMES 120      // Frames per repetition of the pan
+#define VT_PAN_SPEED 48        // Pixels the view moves right and down every frame
+
+#define TEXTURE_PATH "../examples/window_image/textures/hyrax.jpg"
+
+typedef struct {
+  const char *name;
+  const char *unit;
+  double (*run)(void);    // Runs one repetition and returns its time in unit, NaN if it couldn't run. NULL for results of the one before.
+  double (*derive)(void); // Without run, gets a result from the repetition the benchmark before just ran
+} Benchmark;
+
+typedef struct {
+  const char *name;
+  const char *unit;
+  double median, min, max; // NaN if the benchmark failed
+} Result;
+
+static GLuint shader_program;
+static lu_Mesh send_mesh;
+static lu_Mesh draw_meshes[DRAW_MESHES];
+static lu_Mesh shared_meshes[DRAW_MESHES];
+
+static char vt_path[256];
+static uint32_t vt_size = 16384;
+
+// Filled in by every vt_pan run, for the results derived from it
+typedef struct {
+  size_t requests, misses, upload_bytes;
+} PanStats;
+static PanStats pan_stats;
+
+static double now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+// Fills in a quad's vertices at a spot picked from i, so every draw covers a different bit of the framebuffer
+static void make_quad(size_t i, struct Vertex quad[6]) {
+  float x = (float)(i % 50) / 25.f - 1.f, y = (float)(i / 50 % 40) / 20.f - 1.f, s = 0.04f;
+  struct Vertex corners[6] = {
+      {{x, y + s}, {0, 1}}, {{x, y}, {0, 0}}, {{x + s, y}, {1, 0}}, {{x + s, y + s}, {1, 1}}, {{x, y + s}, {0, 1}}, {{x + s, y}, {1, 0}},
+  };
+  memcpy(quad, corners, sizeof(corners));
+}
+
+static double bench_mesh_add_bytes(void) {
+  lu_Mesh mesh = lu_mesh_create(vertex_num_components, vertex_component_sizes, vertex_component_counts, vertex_component_types);
+  struct Vertex vertex = {{0.5f, 0.25f}, {1.f, 0.f}};
+  double start = now_ns();
+  for (size_t i = 0; i < BUILD_VERTICES; i++) {
+    vertex.pos[0] = (float)i;
+    lu_mesh_add_bytes(&mesh, &vertex, sizeof(vertex));
+  }
+  double elapsed = now_ns() - start;
+  lu_mesh_delete(&mesh);
+  return elapsed / BUILD_VERTICES;
+}
+
+static double bench_mesh_send(void) {
+  double start = now_ns();
+  lu_mesh_send(&send_mesh);
+  glFinish();
+  return (now_ns() - start) / 1e6;
+}
+
+static double bench_mesh_render(void) {
+  glUseProgram(shader_program);
+  double start = now_ns();
+  for (size_t i = 0; i < DRAW_MESHES; i++) lu_mesh_render(&draw_meshes[i], GL_TRIANGLES);
+  glFinish();
+  return (now_ns() - start) / 1e3 / DRAW_MESHES;
+}
+
+static double bench_mesh_render_many_shared(void) {
+  glUseProgram(shader_program);
+  double start = now_ns();
+  lu_mesh_render_many(shared_meshes, DRAW_MESHES, GL_TRIANGLES);
+  glFinish();
+  return (now_ns() - start) / 1e3 / DRAW_MESHES;
+}
+
+static double bench_shader_compile(void) {
+  double start = now_ns();
+  for (int i = 0; i < SHADER_PROGRAMS; i++) {
+    GLuint program = lu_create_shader_program(2, "shaders/vert.vert", "shaders/frag.frag");
+    // Linking can be lazy, so make sure the program is actually usable before stopping the clock
+    glUseProgram(program);
+    glDrawArrays(GL_POINTS, 0, 1);
+    glFinish();
+    glUseProgram(0);
+    glDeleteProgram(program);
+  }
+  return (now_ns() - start) / 1e6 / SHADER_PROGRAMS;
+}
+
+static double bench_texture_decode(void) {
+  double start = now_ns();
+  for (int i = 0; i < TEXTURE_LOADS; i++) {
+    lu_Image image;
+    if (lu_image_load(TEXTURE_PATH, 0, &image)) lu_image_free(&image);
+  }
+  return (now_ns() - start) / 1e6 / TEXTURE_LOADS;
+}
+
+static double bench_texture_load(void) {
+  double start = now_ns();
+  for (int i = 0; i < TEXTURE_LOADS; i++) {
+    GLuint texture = lu_load_texture(TEXTURE_PATH, LU_TEXTURE_MIPMAPS);
+    glFinish();
+    glDeleteTextures(1, &texture);
+  }
+  return (now_ns() - start) / 1e6 / TEXTURE_LOADS;
+}
+
+// A cheap pattern that changes across every tile, so the file can't end up as holes
+static bool vt_pattern_rows(void *user, uint32_t y, uint32_t num_rows, uint8_t *rows) {
+  (void)user;
+  for (uint32_t r = 0; r < num_rows; r++) {
+    for (uint32_t x = 0; x < vt_size; x++) {
+      uint8_t *p = rows + ((size_t)r * vt_size + x) * 4;
+      p[0] = (uint8_t)x;
+      p[1] = (uint8_t)(y + r);
+      p[2] = (uint8_t)((x ^ (y + r)) >> 8);
+      p[3] = 255;
+    }
+  }
+  return true;
+}
+
+// Pans a 1080p view diagonally over level 0 with a fresh cache, waiting for every missed tile each frame so the counts don't depend on
+// how fast the loader thread happens to be. Returns the time in ms/frame, and fills in pan_stats.
+static double bench_vt_pan(void) {
+  PanStats *stats = &pan_stats;
+  *stats = (PanStats){0};
+  lu_VirtualTexture *vt = lu_vt_open(vt_path, VT_CACHE_TILES);
+  if (!vt) return NAN;
+  double start = now_ns();
+  for (int frame = 0; frame < VT_PAN_FRAMES; frame++) {
+    float x = (float)frame * VT_PAN_SPEED, y = (float)frame * VT_PAN_SPEED;
+    lu_vt_begin_frame(vt);
+    lu_vt_request_region(vt, x / vt_size, y / vt_size, (x + VT_VIEW_WIDTH - 1) / vt_size, (y + VT_VIEW_HEIGHT - 1) / vt_size, 0);
+    lu_VTStats s = lu_vt_get_stats(vt);
+    double give_up = now_ns() + 1e9;
+    lu_vt_update(vt, 0);
+    while (lu_vt_get_stats(vt).uploads < s.misses && now_ns() < give_up) {
+      sched_yield();
+      lu_vt_update(vt, 0);
+    }
+    glFinish();
+    stats->requests += s.requests;
+    stats->misses += s.misses;
+    stats->upload_bytes += lu_vt_get_stats(vt).upload_bytes;
+  }
+  double elapsed = now_ns() - start;
+  lu_vt_delete(vt);
+  return elapsed / 1e6 / VT_PAN_FRAMES;
+}
+
+// Reported as misses rather than hits so that, like the times, bigger is worse
+static double vt_pan_miss_rate(void) {
+  return pan_stats.requests ? 100.0 * pan_stats.misses / pan_stats.requests : 0;
+}
+
+static double vt_pan_upload(void) {
+  return pan_stats.upload_bytes / 1024.0 / VT_PAN_FRAMES;
+}
+
+static Benchmark benchmarks[] = {
+    {"mesh_add_bytes", "ns/vertex", bench_mesh_add_bytes},
+    {"mesh_send", "ms/send", bench_mesh_send},
+    {"mesh_render", "us/draw", bench_mesh_render},
+    {"mesh_render_many_shared", "us/draw", bench_mesh_render_many_shared},
+    {"shader_compile", "ms/program", bench_shader_compile},
+    {"texture_decode", "ms/image", bench_texture_decode},
+    {"texture_load", "ms/texture", bench_texture_load},
+    {"vt_pan", "ms/frame", bench_vt_pan},
+    {"vt_pan_miss_rate", "%", NULL, vt_pan_miss_rate},
+    {"vt_pan_upload", "KiB/frame", NULL, vt_pan_upload},
+};
+#define NUM_BENCHMARKS (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static bool setup(void) {
+  shader_program = lu_create_shader_program(2, "shaders/vert.vert", "shaders/frag.frag");
+  if (!shader_program) return false;
+
+  send_mesh = lu_mesh_create(vertex_num_components, vertex_component_sizes, vertex_component_counts, vertex_component_types);
+  for (size_t i = 0; i < SEND_VERTICES / 6; i++) {
+    struct Vertex quad[6];
+    make_quad(i, quad);
+    lu_mesh_add_bytes(&send_mesh, quad, sizeof(quad));
+  }
+
+  // Only made once per size, it's far too big to build on every run
+  snprintf(vt_path, sizeof(vt_path), "build/vt_pan_%u.luvt", vt_size);
+  FILE *vt_file = fopen(vt_path, "rb");
+  if (vt_file) {
+    fclose(vt_file);
+  } else {
+    char tmp_path[sizeof(vt_path) + 4];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", vt_path);
+    fprintf(stderr, "Generating %s...\n", vt_path);
+    if (!lu_vt_build_rows(tmp_path, vt_size, vt_size, VT_TILE_SIZE, vt_pattern_rows, NULL) || rename(tmp_path, vt_path) != 0) return false;
+  }
+
+  lu_VertexAttrib attribs[] = {{2, GL_FLOAT, GL_FALSE, false}, {2, GL_FLOAT, GL_FALSE, false}};
+  lu_VertexLayout layout = lu_vertex_layout_create(2, attribs);
+  if (!layout.VAO) return false;
+  for (size_t i = 0; i < DRAW_MESHES; i++) {
+    struct Vertex quad[6];
+    make_quad(i, quad);
+    draw_meshes[i] = lu_mesh_create(vertex_num_components, vertex_component_sizes, vertex_component_counts, vertex_component_types);
+    lu_mesh_add_bytes(&draw_meshes[i], quad, sizeof(quad));
+    lu_mesh_send(&draw_meshes[i]);
+    lu_mesh_free(&draw_meshes[i]);
+    shared_meshes[i] = lu_mesh_create_shared(&layout);
+    lu_mesh_add_bytes(&shared_meshes[i], quad, sizeof(quad));
+    lu_mesh_send(&shared_meshes[i]);
+    lu_mesh_free(&shared_meshes[i]);
+  }
+  return true;
+}
+
+static void cleanup(void) {
+  for (size_t i = 0; i < DRAW_MESHES; i++) {
+    lu_mesh_delete(&draw_meshes[i]);
+    lu_mesh_delete(&shared_meshes[i]);
+  }
+  lu_mesh_delete(&send_mesh);
+  lu_clear_vertex_layouts();
+  glDeleteProgram(shader_program);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Runs a benchmark and the num_results - 1 after it that derive their results from its runs, filling in a result for each
+static void run_benchmark(const Benchmark *benchmark, size_t num_results, int repetitions, Result *results) {
+  double *times = malloc(sizeof(double) * repetitions * num_results);
+  for (size_t j = 0; j < num_results; j++) results[j] = (Result){benchmark[j].name, benchmark[j].unit, NAN, NAN, NAN};
+  if (!times) return;
+  // Warm up first, the first run pays for page faults and lazily created driver state
+  bool failed = isnan(benchmark->run());
+  for (int i = 0; i < repetitions && !failed; i++) {
+    times[i] = benchmark->run();
+    failed = isnan(times[i]);
+    for (size_t j = 1; j < num_results; j++) times[j * repetitions + i] = benchmark[j].derive();
+  }
+  for (size_t j = 0; j < num_results && !failed; j++) {
+    double *t = times + j * repetitions;
+    qsort(t, repetitions, sizeof(double), compare_doubles);
+    results[j].median = repetitions % 2 ? t[repetitions / 2] : (t[repetitions / 2 - 1] + t[repetitions / 2]) / 2;
+    results[j].min = t[0];
+    results[j].max = t[repetitions - 1];
+  }
+  free(times);
+}
+
+// One result per line, so the baseline can be read back without a JSON parser
+static void write_results(FILE *out, const Result *results, size_t num_results, int repetitions) {
+  const char *renderer = (const char *)glGetString(GL_RENDERER);
+  fprintf(out, "{\n  \"renderer\": \"%s\",\n  \"repetitions\": %d,\n  \"results\": [\n", renderer ? renderer : "unknown", repetitions);
+  for (size_t i = 0; i < num_results; i++) {
+    const Result *r = &results[i];
+    if (isnan(r->median)) {
+      fprintf(out, "    {\"name\": \"%s\", \"unit\": \"%s\", \"failed\": true}%s\n", r->name, r->unit, i + 1 < num_results ? "," : "");
+      continue;
+    }
+    fprintf(out, "    {\"name\": \"%s\", \"unit\": \"%s\", \"median\": %.6g, \"min\": %.6g, \"max\": %.6g}%s\n", r->name, r->unit, r->median, r->min, r->max,
+            i + 1 < num_results ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+}
+
+// Finds a benchmark's median in a file written by write_results, returns false if it isn't there
+static bool baseline_median(const char *baseline, const char *name, double *median) {
+  char key[128];
+  snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+  const char *line = strstr(baseline, key);
+  if (!line) return false;
+  const char *value = strstr(line, "\"median\":");
+  if (!value) return false;
+  return sscanf(value, "\"median\": %lf", median) == 1;
+}
+
+static char *read_file(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f) return NULL;
+  fseek(f, 0, SEEK_END);
+  long len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char *text = malloc(len + 1);
+  if (text) {
+    text[fread(text, 1, len, f)] = '\0';
+  }
+  fclose(f);
+  return text;
+}
+
+// Prints each result against the baseline and returns how many got slower by more than threshold percent
+static int compare_baseline(const char *baseline_path, const Result *results, size_t num_results, double threshold) {
+  char *baseline = read_file(baseline_path);
+  if (!baseline) {
+    fprintf(stderr, "Could not read baseline %s.\n", baseline_path);
+    return -1;
+  }
+  int regressions = 0;
+  for (size_t i = 0; i < num_results; i++) {
+    const Result *r = &results[i];
+    double base;
+    if (isnan(r->median)) {
+      fprintf(stderr, "%-24s %10s %-10s FAILED\n", r->name, "-", r->unit);
+      continue;
+    }
+    if (!baseline_median(baseline, r->name, &base) || base <= 0) {
+      fprintf(stderr, "%-24s %10.4g %-10s (not in baseline)\n", r->name, r->median, r->unit);
+      continue;
+    }
+    double change = (r->median / base - 1) * 100;
+    bool regressed = change > threshold;
+    fprintf(stderr, "%-24s %10.4g %-10s baseline %10.4g  %+6.1f%%%s\n", r->name, r->median, r->unit, base, change, regressed ? "  REGRESSION" : "");
+    regressions += regressed;
+  }
+  free(baseline);
+  return regressions;
+}
+
+int main(int argc, char **argv) {
+  const char *out_path = NULL, *baseline_path = NULL;
+  double threshold = 20.0;
+  int repetitions = 7;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      out_path = argv[++i];
+    } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+      baseline_path = argv[++i];
+    } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+      threshold = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+      repetitions = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-v") && i + 1 < argc) {
+      vt_size = (uint32_t)atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: %s [-o results.json] [-b baseline.json] [-t threshold_percent] [-r repetitions] [-v vt_size]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (repetitions < 1) repetitions = 1;
+  if (vt_size < VT_VIEW_WIDTH + VT_PAN_FRAMES * VT_PAN_SPEED) vt_size = VT_VIEW_WIDTH + VT_PAN_FRAMES * VT_PAN_SPEED;
+
+  // Mesa caches compiled shaders on disk, which would make shader_compile measure a cache lookup after the first run
+  setenv("MESA_SHADER_CACHE_DISABLE", "true", 0);
+  setenv("MESA_GLSL_CACHE_DISABLE", "true", 0);
+
+  lu_HeadlessContext *ctx = lu_create_headless_context(256, 256);
+  if (!ctx) return 1;
+  if (!setup()) {
+    fprintf(stderr, "Failed to set up benchmarks.\n");
+    lu_headless_context_delete(ctx);
+    return 1;
+  }
+
+  Result results[NUM_BENCHMARKS];
+  int failures = 0;
+  for (size_t i = 0; i < NUM_BENCHMARKS;) {
+    size_t n = 1;
+    while (i + n < NUM_BENCHMARKS && !benchmarks[i + n].run) n++;
+    run_benchmark(&benchmarks[i], n, repetitions, &results[i]);
+    if (isnan(results[i].median)) {
+      fprintf(stderr, "%s failed to run.\n", benchmarks[i].name);
+      failures++;
+    }
+    i += n;
+  }
+
+  FILE *out = out_path ? fopen(out_path, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "Could not open %s for writing.\n", out_path);
+  } else {
+    write_results(out, results, NUM_BENCHMARKS, repetitions);
+    if (out != stdout) fclose(out);
+  }
+
+  int regressions = 0;
+  if (baseline_path) regressions = compare_baseline(baseline_path, results, NUM_BENCHMARKS, threshold);
+
+  cleanup();
+  lu_headless_context_delete(ctx);
+  return regressions != 0 || failures != 0 ? 1 : 0;
+}
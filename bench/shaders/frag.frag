@@ -0,0 +1,9 @@
+#version 330 core
+
+out vec4 fragColor;
+
+in vec2 texCoord;
+
+void main() {
+	fragColor = vec4(texCoord, 0.5, 1.0);
+}
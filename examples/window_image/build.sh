@@ -4,5 +4,5 @@ gcc \
 core/main.c \
 ../../luGL/luGL.c \
 -o build/main \
--lGLEW -lGL -lglfw -lm \
+-lGLEW -lGL -lglfw -lm -lpthread \
 -I../../luGL
@@ -1,300 +1,5834 @@
+#ifdef LU_TRACE
+// The GL call tracer's wrappers call the real GL 1.1 functions, so luGL.h's redirects get switched on after them
+#define LU_TRACE_NO_REDIRECTS
+#endif
 #include "luGL.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stolen/stb_image.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 
-GLFWwindow *lu_create_window(const char *window_title, int width, int height, bool fullscreen) {
-  // Initialise GLFW
+#ifdef LU_HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// Logging. Everything luGL reports goes through lu_log, then to the callback from lu_set_log_callback or to stderr.
+
+static struct {
+  lu_LogCallback callback;
+  void *user;
+} lu_logger;
+
+void lu_set_log_callback(lu_LogCallback callback, void *user) {
+  lu_logger.callback = callback;
+  lu_logger.user = user;
+}
+
+static void lu_log(lu_LogSeverity severity, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void lu_log(lu_LogSeverity severity, const char *fmt, ...) {
+  char stack[1024];
+  char *message = stack;
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(stack, sizeof(stack), fmt, args);
+  va_end(args);
+  if (len < 0) return;
+  // Shader logs can be longer than the stack buffer, if there's no memory for them they just get cut short
+  if ((size_t)len >= sizeof(stack)) {
+    char *heap = malloc((size_t)len + 1);
+    if (heap) {
+      va_start(args, fmt);
+      vsnprintf(heap, (size_t)len + 1, fmt, args);
+      va_end(args);
+      message = heap;
+    } else {
+      len = sizeof(stack) - 1;
+    }
+  }
+  if (len > 0 && message[len - 1] == '\n') message[len - 1] = '\0';
+
+  if (lu_logger.callback)
+    lu_logger.callback(severity, message, lu_logger.user);
+  else
+    fprintf(stderr, "%s\n", message);
+  if (message != stack) free(message);
+}
+
+// GL call tracing. With LU_TRACE, lu_trace_start points GLEW's function pointers at the wrappers below, luGL.h sends the GL 1.1 functions
+// to the exported ones, and every wrapper calls the real function and then appends a record to its own thread's buffer.
+#ifdef LU_TRACE
+
+#define LU_TRACE_BUFFER_BYTES (4u << 20)
+#define LU_TRACE_MAX_MAPPINGS 8
+
+typedef struct lu_TraceBuffer {
+  _Alignas(64) bool busy; // Set while the owning thread writes a record, lu_trace_stop waits for it before taking the buffer
+  uint8_t *data;
+  size_t used, capacity;
+  uint32_t thread;
+  uint64_t seq; // Number this thread's records are getting, 0 for none yet
+  struct lu_TraceBuffer *next;
+} lu_TraceBuffer;
+
+static struct {
+  pthread_mutex_t lock; // Guards the file and the list of buffers, only taken when a buffer fills up
+  FILE *file;
+  lu_TraceBuffer *buffers;
+  uint32_t num_threads;
+  uint64_t seq; // Last number handed out to a thread
+  bool active;
+} lu_tracer = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static __thread lu_TraceBuffer *lu_trace_thread_buffer;
+
+// Buffers mapped for writing without GL_MAP_PERSISTENT_BIT, so whatever was written can be recorded when they're unmapped
+typedef struct {
+  GLenum target;
+  GLuint buffer;
+  GLintptr offset;
+  GLsizeiptr length;
+  const void *data;
+} lu_TraceMapping;
+
+static __thread lu_TraceMapping lu_trace_mappings[LU_TRACE_MAX_MAPPINGS];
+
+// The real GLEW functions, saved by lu_trace_start
+#define LU_TRACE_REAL(name) static __typeof__(__glew##name) lu_real_gl##name;
+LU_TRACE_GLEW_CALLS(LU_TRACE_REAL)
+#undef LU_TRACE_REAL
+
+static lu_TraceBuffer *lu_trace_register_thread(void) {
+  lu_TraceBuffer *buf = aligned_alloc(64, sizeof(lu_TraceBuffer));
+  if (!buf) return NULL;
+  memset(buf, 0, sizeof(*buf));
+  pthread_mutex_lock(&lu_tracer.lock);
+  buf->thread = lu_tracer.num_threads++;
+  buf->next = lu_tracer.buffers;
+  lu_tracer.buffers = buf;
+  pthread_mutex_unlock(&lu_tracer.lock);
+  lu_trace_thread_buffer = buf;
+  return buf;
+}
+
+// Call with lu_tracer.lock held
+static void lu_trace_flush_locked(lu_TraceBuffer *buf) {
+  if (buf->used == 0) return;
+  if (lu_tracer.file) {
+    lu_TraceChunk chunk = {buf->thread, (uint32_t)buf->used};
+    fwrite(&chunk, sizeof(chunk), 1, lu_tracer.file);
+    fwrite(buf->data, 1, buf->used, lu_tracer.file);
+  }
+  buf->used = 0;
+}
+
+static void lu_trace_record(lu_TraceCall call, size_t num_args, const uint64_t *args, const void *payload, size_t payload_bytes) {
+  if (payload && payload_bytes > UINT32_MAX) {
+    // Records only have 32 bits for the size, writing it anyway would throw off reading everything after it
+    lu_log(LU_LOG_ERROR, "(lu_trace_record): Can't record %s with a %zu byte payload, it's left out of the trace.\n", lu_trace_call_name(call), payload_bytes);
+    return;
+  }
+  lu_TraceBuffer *buf = lu_trace_thread_buffer;
+  if (!buf) buf = lu_trace_register_thread();
+  if (!buf) return;
+  __atomic_store_n(&buf->busy, true, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&lu_tracer.active, __ATOMIC_SEQ_CST)) {
+    if (!payload) payload_bytes = 0;
+    size_t bytes = sizeof(lu_TraceRecord) + num_args * sizeof(uint64_t) + ((payload_bytes + 7) & ~(size_t)7);
+    if (buf->used + bytes > buf->capacity) {
+      pthread_mutex_lock(&lu_tracer.lock);
+      lu_trace_flush_locked(buf);
+      pthread_mutex_unlock(&lu_tracer.lock);
+      // Big uploads get a buffer big enough for them, everything else fits in the usual size
+      size_t capacity = bytes > LU_TRACE_BUFFER_BYTES ? bytes : LU_TRACE_BUFFER_BYTES;
+      if (capacity > buf->capacity) {
+        uint8_t *data = realloc(buf->data, capacity);
+        if (data) {
+          buf->data = data;
+          buf->capacity = capacity;
+        }
+      }
+    }
+    if (buf->used + bytes <= buf->capacity) {
+      // A thread only needs a new number once another thread has taken one since it got its own, so a thread working alone never writes
+      // to the shared counter. Anything that happened after another thread's call sees that thread's number and takes a bigger one.
+      if (buf->seq == 0 || __atomic_load_n(&lu_tracer.seq, __ATOMIC_RELAXED) != buf->seq) buf->seq = __atomic_add_fetch(&lu_tracer.seq, 1, __ATOMIC_RELAXED);
+      uint8_t *dst = buf->data + buf->used;
+      lu_TraceRecord record = {(uint16_t)call, (uint16_t)num_args, (uint32_t)payload_bytes, buf->seq};
+      memcpy(dst, &record, sizeof(record));
+      dst += sizeof(record);
+      // Most calls have a handful of arguments and no payload, and copying those inline beats calling memcpy and memset for a few bytes
+      for (size_t i = 0; i < num_args; i++) memcpy(dst + i * sizeof(uint64_t), &args[i], sizeof(uint64_t));
+      dst += num_args * sizeof(uint64_t);
+      if (payload_bytes) {
+        memcpy(dst, payload, payload_bytes);
+        memset(dst + payload_bytes, 0, buf->data + buf->used + bytes - (dst + payload_bytes));
+      }
+      buf->used += bytes;
+    }
+  }
+  __atomic_store_n(&buf->busy, false, __ATOMIC_RELEASE);
+}
+
+// Records a call if a trace is running. The arguments are stored as 64 bit integers, so floats go through lu_trace_float and pointers
+// through uintptr_t.
+#define LU_TRACE_CALL(call, payload, payload_bytes, ...)                                                                                   \
+  do {                                                                                                                                     \
+    if (__atomic_load_n(&lu_tracer.active, __ATOMIC_RELAXED)) {                                                                            \
+      const uint64_t lu_trace_args_[] = {__VA_ARGS__};                                                                                     \
+      lu_trace_record(call, sizeof(lu_trace_args_) / sizeof(uint64_t), lu_trace_args_, payload, payload_bytes);                            \
+    }                                                                                                                                      \
+  } while (0)
+#define LU_TRACE_ARGS(name, ...) LU_TRACE_CALL(LU_TRACE_##name, NULL, 0, __VA_ARGS__)
+
+static inline uint64_t lu_trace_float(GLfloat f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+static GLuint lu_trace_bound_buffer(GLenum target) {
+  GLenum binding = 0;
+  switch (target) {
+  case GL_ARRAY_BUFFER: binding = GL_ARRAY_BUFFER_BINDING; break;
+  case GL_ELEMENT_ARRAY_BUFFER: binding = GL_ELEMENT_ARRAY_BUFFER_BINDING; break;
+  case GL_UNIFORM_BUFFER: binding = GL_UNIFORM_BUFFER_BINDING; break;
+  case GL_SHADER_STORAGE_BUFFER: binding = GL_SHADER_STORAGE_BUFFER_BINDING; break;
+  case GL_COPY_READ_BUFFER: binding = GL_COPY_READ_BUFFER_BINDING; break;
+  case GL_COPY_WRITE_BUFFER: binding = GL_COPY_WRITE_BUFFER_BINDING; break;
+  case GL_PIXEL_PACK_BUFFER: binding = GL_PIXEL_PACK_BUFFER_BINDING; break;
+  case GL_PIXEL_UNPACK_BUFFER: binding = GL_PIXEL_UNPACK_BUFFER_BINDING; break;
+  case GL_DRAW_INDIRECT_BUFFER: binding = GL_DRAW_INDIRECT_BUFFER_BINDING; break;
+  case GL_DISPATCH_INDIRECT_BUFFER: binding = GL_DISPATCH_INDIRECT_BUFFER_BINDING; break;
+  }
+  GLint buffer = 0;
+  if (binding) glGetIntegerv(binding, &buffer);
+  return (GLuint)buffer;
+}
+
+// Bytes glTexImage2D and friends read from pixels, going by the unpack (or pack) alignment
+static size_t lu_trace_pixel_bytes(GLsizei width, GLsizei height, GLenum format, GLenum type, GLenum alignment_pname) {
+  if (width <= 0 || height <= 0) return 0;
+  size_t components = 4;
+  switch (format) {
+  case GL_RED: case GL_RED_INTEGER: case GL_DEPTH_COMPONENT: case GL_STENCIL_INDEX: components = 1; break;
+  case GL_RG: case GL_RG_INTEGER: case GL_DEPTH_STENCIL: components = 2; break;
+  case GL_RGB: case GL_BGR: case GL_RGB_INTEGER: components = 3; break;
+  }
+  size_t pixel;
+  switch (type) {
+  case GL_UNSIGNED_BYTE: case GL_BYTE: pixel = components; break;
+  case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT: pixel = components * 2; break;
+  case GL_UNSIGNED_SHORT_5_6_5: case GL_UNSIGNED_SHORT_4_4_4_4: case GL_UNSIGNED_SHORT_5_5_5_1: pixel = 2; break;
+  case GL_UNSIGNED_INT_8_8_8_8: case GL_UNSIGNED_INT_8_8_8_8_REV: case GL_UNSIGNED_INT_2_10_10_10_REV: case GL_UNSIGNED_INT_10F_11F_11F_REV:
+  case GL_UNSIGNED_INT_5_9_9_9_REV: case GL_UNSIGNED_INT_24_8: pixel = 4; break;
+  default: pixel = components * 4; break;
+  }
+  GLint alignment = 4;
+  glGetIntegerv(alignment_pname, &alignment);
+  if (alignment < 1) alignment = 1;
+  size_t row = (size_t)width * pixel;
+  size_t stride = (row + alignment - 1) / alignment * alignment;
+  return stride * (height - 1) + row;
+}
+
+static void GLAPIENTRY lu_traced_glActiveTexture(GLenum texture) {
+  lu_real_glActiveTexture(texture);
+  LU_TRACE_ARGS(glActiveTexture, texture);
+}
+
+static void GLAPIENTRY lu_traced_glAttachShader(GLuint program, GLuint shader) {
+  lu_real_glAttachShader(program, shader);
+  LU_TRACE_ARGS(glAttachShader, program, shader);
+}
+
+static void GLAPIENTRY lu_traced_glBeginQuery(GLenum target, GLuint id) {
+  lu_real_glBeginQuery(target, id);
+  LU_TRACE_ARGS(glBeginQuery, target, id);
+}
+
+static void GLAPIENTRY lu_traced_glBindBuffer(GLenum target, GLuint buffer) {
+  lu_real_glBindBuffer(target, buffer);
+  LU_TRACE_ARGS(glBindBuffer, target, buffer);
+}
+
+static void GLAPIENTRY lu_traced_glBindBufferBase(GLenum target, GLuint index, GLuint buffer) {
+  lu_real_glBindBufferBase(target, index, buffer);
+  LU_TRACE_ARGS(glBindBufferBase, target, index, buffer);
+}
+
+static void GLAPIENTRY lu_traced_glBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+  lu_real_glBindBufferRange(target, index, buffer, offset, size);
+  LU_TRACE_ARGS(glBindBufferRange, target, index, buffer, offset, size);
+}
+
+static void GLAPIENTRY lu_traced_glBindFramebuffer(GLenum target, GLuint framebuffer) {
+  lu_real_glBindFramebuffer(target, framebuffer);
+  LU_TRACE_ARGS(glBindFramebuffer, target, framebuffer);
+}
+
+static void GLAPIENTRY lu_traced_glBindProgramPipeline(GLuint pipeline) {
+  lu_real_glBindProgramPipeline(pipeline);
+  LU_TRACE_ARGS(glBindProgramPipeline, pipeline);
+}
+
+static void GLAPIENTRY lu_traced_glBindRenderbuffer(GLenum target, GLuint renderbuffer) {
+  lu_real_glBindRenderbuffer(target, renderbuffer);
+  LU_TRACE_ARGS(glBindRenderbuffer, target, renderbuffer);
+}
+
+static void GLAPIENTRY lu_traced_glBindVertexArray(GLuint array) {
+  lu_real_glBindVertexArray(array);
+  LU_TRACE_ARGS(glBindVertexArray, array);
+}
+
+static void GLAPIENTRY lu_traced_glBindVertexBuffer(GLuint bindingindex, GLuint buffer, GLintptr offset, GLsizei stride) {
+  lu_real_glBindVertexBuffer(bindingindex, buffer, offset, stride);
+  LU_TRACE_ARGS(glBindVertexBuffer, bindingindex, buffer, offset, stride);
+}
+
+static void GLAPIENTRY lu_traced_glBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage) {
+  lu_real_glBufferData(target, size, data, usage);
+  LU_TRACE_CALL(LU_TRACE_glBufferData, data, size, target, size, usage);
+}
+
+static void GLAPIENTRY lu_traced_glBufferStorage(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags) {
+  lu_real_glBufferStorage(target, size, data, flags);
+  LU_TRACE_CALL(LU_TRACE_glBufferStorage, data, size, target, size, flags);
+}
+
+static void GLAPIENTRY lu_traced_glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data) {
+  lu_real_glBufferSubData(target, offset, size, data);
+  LU_TRACE_CALL(LU_TRACE_glBufferSubData, data, size, target, offset, size);
+}
+
+static GLenum GLAPIENTRY lu_traced_glCheckFramebufferStatus(GLenum target) {
+  GLenum status = lu_real_glCheckFramebufferStatus(target);
+  LU_TRACE_ARGS(glCheckFramebufferStatus, target, status);
+  return status;
+}
+
+static GLenum GLAPIENTRY lu_traced_glClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout) {
+  GLenum result = lu_real_glClientWaitSync(sync, flags, timeout);
+  LU_TRACE_ARGS(glClientWaitSync, (uintptr_t)sync, flags, timeout, result);
+  return result;
+}
+
+static void GLAPIENTRY lu_traced_glCompileShader(GLuint shader) {
+  lu_real_glCompileShader(shader);
+  LU_TRACE_ARGS(glCompileShader, shader);
+}
+
+static void GLAPIENTRY lu_traced_glCopyImageSubData(GLuint srcName, GLenum srcTarget, GLint srcLevel, GLint srcX, GLint srcY, GLint srcZ, GLuint dstName,
+                                                    GLenum dstTarget, GLint dstLevel, GLint dstX, GLint dstY, GLint dstZ, GLsizei srcWidth,
+                                                    GLsizei srcHeight, GLsizei srcDepth) {
+  lu_real_glCopyImageSubData(srcName, srcTarget, srcLevel, srcX, srcY, srcZ, dstName, dstTarget, dstLevel, dstX, dstY, dstZ, srcWidth, srcHeight, srcDepth);
+  LU_TRACE_ARGS(glCopyImageSubData, srcName, srcTarget, srcLevel, srcX, srcY, srcZ, dstName, dstTarget, dstLevel, dstX, dstY, dstZ, srcWidth, srcHeight,
+                srcDepth);
+}
+
+static GLuint GLAPIENTRY lu_traced_glCreateProgram(void) {
+  GLuint program = lu_real_glCreateProgram();
+  LU_TRACE_ARGS(glCreateProgram, program);
+  return program;
+}
+
+static GLuint GLAPIENTRY lu_traced_glCreateShader(GLenum type) {
+  GLuint shader = lu_real_glCreateShader(type);
+  LU_TRACE_ARGS(glCreateShader, type, shader);
+  return shader;
+}
+
+// glGen*/glDelete* all look the same, the names go in the payload
+#define LU_TRACE_NAMES(name, names_type)                                                                                                   \
+  static void GLAPIENTRY lu_traced_gl##name(GLsizei n, names_type names) {                                                                 \
+    lu_real_gl##name(n, names);                                                                                                            \
+    LU_TRACE_CALL(LU_TRACE_gl##name, names, n > 0 ? n * sizeof(GLuint) : 0, n);                                                            \
+  }
+
+LU_TRACE_NAMES(DeleteBuffers, const GLuint *)
+LU_TRACE_NAMES(DeleteFramebuffers, const GLuint *)
+LU_TRACE_NAMES(DeleteProgramPipelines, const GLuint *)
+LU_TRACE_NAMES(DeleteQueries, const GLuint *)
+LU_TRACE_NAMES(DeleteRenderbuffers, const GLuint *)
+LU_TRACE_NAMES(DeleteVertexArrays, const GLuint *)
+LU_TRACE_NAMES(GenBuffers, GLuint *)
+LU_TRACE_NAMES(GenFramebuffers, GLuint *)
+LU_TRACE_NAMES(GenProgramPipelines, GLuint *)
+LU_TRACE_NAMES(GenQueries, GLuint *)
+LU_TRACE_NAMES(GenRenderbuffers, GLuint *)
+LU_TRACE_NAMES(GenVertexArrays, GLuint *)
+
+static void GLAPIENTRY lu_traced_glDeleteProgram(GLuint program) {
+  lu_real_glDeleteProgram(program);
+  LU_TRACE_ARGS(glDeleteProgram, program);
+}
+
+static void GLAPIENTRY lu_traced_glDeleteShader(GLuint shader) {
+  lu_real_glDeleteShader(shader);
+  LU_TRACE_ARGS(glDeleteShader, shader);
+}
+
+static void GLAPIENTRY lu_traced_glDeleteSync(GLsync sync) {
+  lu_real_glDeleteSync(sync);
+  LU_TRACE_ARGS(glDeleteSync, (uintptr_t)sync);
+}
+
+static void GLAPIENTRY lu_traced_glDetachShader(GLuint program, GLuint shader) {
+  lu_real_glDetachShader(program, shader);
+  LU_TRACE_ARGS(glDetachShader, program, shader);
+}
+
+static void GLAPIENTRY lu_traced_glDisableVertexAttribArray(GLuint index) {
+  lu_real_glDisableVertexAttribArray(index);
+  LU_TRACE_ARGS(glDisableVertexAttribArray, index);
+}
+
+static void GLAPIENTRY lu_traced_glDispatchCompute(GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z) {
+  lu_real_glDispatchCompute(num_groups_x, num_groups_y, num_groups_z);
+  LU_TRACE_ARGS(glDispatchCompute, num_groups_x, num_groups_y, num_groups_z);
+}
+
+static void GLAPIENTRY lu_traced_glDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instancecount) {
+  lu_real_glDrawArraysInstanced(mode, first, count, instancecount);
+  LU_TRACE_ARGS(glDrawArraysInstanced, mode, first, count, instancecount);
+}
+
+static void GLAPIENTRY lu_traced_glEnableVertexAttribArray(GLuint index) {
+  lu_real_glEnableVertexAttribArray(index);
+  LU_TRACE_ARGS(glEnableVertexAttribArray, index);
+}
+
+static void GLAPIENTRY lu_traced_glEndQuery(GLenum target) {
+  lu_real_glEndQuery(target);
+  LU_TRACE_ARGS(glEndQuery, target);
+}
+
+static GLsync GLAPIENTRY lu_traced_glFenceSync(GLenum condition, GLbitfield flags) {
+  GLsync sync = lu_real_glFenceSync(condition, flags);
+  LU_TRACE_ARGS(glFenceSync, condition, flags, (uintptr_t)sync);
+  return sync;
+}
+
+static void GLAPIENTRY lu_traced_glFramebufferRenderbuffer(GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer) {
+  lu_real_glFramebufferRenderbuffer(target, attachment, renderbuffertarget, renderbuffer);
+  LU_TRACE_ARGS(glFramebufferRenderbuffer, target, attachment, renderbuffertarget, renderbuffer);
+}
+
+static void GLAPIENTRY lu_traced_glGenerateMipmap(GLenum target) {
+  lu_real_glGenerateMipmap(target);
+  LU_TRACE_ARGS(glGenerateMipmap, target);
+}
+
+// Queries are recorded without their results, the replay just makes them again to see what they cost
+static void GLAPIENTRY lu_traced_glGetProgramInfoLog(GLuint program, GLsizei bufSize, GLsizei *length, GLchar *infoLog) {
+  lu_real_glGetProgramInfoLog(program, bufSize, length, infoLog);
+  LU_TRACE_ARGS(glGetProgramInfoLog, program, bufSize);
+}
+
+static void GLAPIENTRY lu_traced_glGetProgramiv(GLuint program, GLenum pname, GLint *params) {
+  lu_real_glGetProgramiv(program, pname, params);
+  LU_TRACE_ARGS(glGetProgramiv, program, pname);
+}
+
+static void GLAPIENTRY lu_traced_glGetProgramPipelineInfoLog(GLuint pipeline, GLsizei bufSize, GLsizei *length, GLchar *infoLog) {
+  lu_real_glGetProgramPipelineInfoLog(pipeline, bufSize, length, infoLog);
+  LU_TRACE_ARGS(glGetProgramPipelineInfoLog, pipeline, bufSize);
+}
+
+static void GLAPIENTRY lu_traced_glGetProgramPipelineiv(GLuint pipeline, GLenum pname, GLint *params) {
+  lu_real_glGetProgramPipelineiv(pipeline, pname, params);
+  LU_TRACE_ARGS(glGetProgramPipelineiv, pipeline, pname);
+}
+
+static void GLAPIENTRY lu_traced_glGetQueryObjectui64v(GLuint id, GLenum pname, GLuint64 *params) {
+  lu_real_glGetQueryObjectui64v(id, pname, params);
+  LU_TRACE_ARGS(glGetQueryObjectui64v, id, pname);
+}
+
+static void GLAPIENTRY lu_traced_glGetQueryObjectuiv(GLuint id, GLenum pname, GLuint *params) {
+  lu_real_glGetQueryObjectuiv(id, pname, params);
+  LU_TRACE_ARGS(glGetQueryObjectuiv, id, pname);
+}
+
+static void GLAPIENTRY lu_traced_glGetShaderInfoLog(GLuint shader, GLsizei bufSize, GLsizei *length, GLchar *infoLog) {
+  lu_real_glGetShaderInfoLog(shader, bufSize, length, infoLog);
+  LU_TRACE_ARGS(glGetShaderInfoLog, shader, bufSize);
+}
+
+static void GLAPIENTRY lu_traced_glGetShaderiv(GLuint shader, GLenum pname, GLint *params) {
+  lu_real_glGetShaderiv(shader, pname, params);
+  LU_TRACE_ARGS(glGetShaderiv, shader, pname);
+}
+
+static GLuint GLAPIENTRY lu_traced_glGetUniformBlockIndex(GLuint program, const GLchar *uniformBlockName) {
+  GLuint index = lu_real_glGetUniformBlockIndex(program, uniformBlockName);
+  LU_TRACE_CALL(LU_TRACE_glGetUniformBlockIndex, uniformBlockName, uniformBlockName ? strlen(uniformBlockName) + 1 : 0, program, index);
+  return index;
+}
+
+static GLint GLAPIENTRY lu_traced_glGetUniformLocation(GLuint program, const GLchar *name) {
+  GLint location = lu_real_glGetUniformLocation(program, name);
+  LU_TRACE_CALL(LU_TRACE_glGetUniformLocation, name, name ? strlen(name) + 1 : 0, program, location);
+  return location;
+}
+
+static GLboolean GLAPIENTRY lu_traced_glIsBuffer(GLuint buffer) {
+  GLboolean result = lu_real_glIsBuffer(buffer);
+  LU_TRACE_ARGS(glIsBuffer, buffer, result);
+  return result;
+}
+
+static GLboolean GLAPIENTRY lu_traced_glIsVertexArray(GLuint array) {
+  GLboolean result = lu_real_glIsVertexArray(array);
+  LU_TRACE_ARGS(glIsVertexArray, array, result);
+  return result;
+}
+
+static void GLAPIENTRY lu_traced_glLinkProgram(GLuint program) {
+  lu_real_glLinkProgram(program);
+  LU_TRACE_ARGS(glLinkProgram, program);
+}
+
+static void *GLAPIENTRY lu_traced_glMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access) {
+  void *data = lu_real_glMapBufferRange(target, offset, length, access);
+  if (!__atomic_load_n(&lu_tracer.active, __ATOMIC_RELAXED)) return data;
+  GLuint buffer = lu_trace_bound_buffer(target);
+  LU_TRACE_ARGS(glMapBufferRange, target, offset, length, access, buffer);
+  if (data && (access & GL_MAP_WRITE_BIT) && !(access & GL_MAP_PERSISTENT_BIT)) {
+    for (int i = 0; i < LU_TRACE_MAX_MAPPINGS; i++) {
+      if (lu_trace_mappings[i].target != 0 && lu_trace_mappings[i].target != target) continue;
+      lu_trace_mappings[i] = (lu_TraceMapping){target, buffer, offset, length, data};
+      break;
+    }
+  }
+  return data;
+}
+
+static void GLAPIENTRY lu_traced_glMemoryBarrier(GLbitfield barriers) {
+  lu_real_glMemoryBarrier(barriers);
+  LU_TRACE_ARGS(glMemoryBarrier, barriers);
+}
+
+static void GLAPIENTRY lu_traced_glProgramParameteri(GLuint program, GLenum pname, GLint value) {
+  lu_real_glProgramParameteri(program, pname, value);
+  LU_TRACE_ARGS(glProgramParameteri, program, pname, value);
+}
+
+static void GLAPIENTRY lu_traced_glQueryCounter(GLuint id, GLenum target) {
+  lu_real_glQueryCounter(id, target);
+  LU_TRACE_ARGS(glQueryCounter, id, target);
+}
+
+static void GLAPIENTRY lu_traced_glRenderbufferStorage(GLenum target, GLenum internalformat, GLsizei width, GLsizei height) {
+  lu_real_glRenderbufferStorage(target, internalformat, width, height);
+  LU_TRACE_ARGS(glRenderbufferStorage, target, internalformat, width, height);
+}
+
+static void GLAPIENTRY lu_traced_glShaderBinary(GLsizei count, const GLuint *shaders, GLenum binaryFormat, const void *binary, GLsizei length) {
+  lu_real_glShaderBinary(count, shaders, binaryFormat, binary, length);
+  if (!__atomic_load_n(&lu_tracer.active, __ATOMIC_RELAXED) || count < 0 || length < 0) return;
+  // Payload is the shader names then the binary
+  size_t names_bytes = (size_t)count * sizeof(GLuint);
+  uint8_t *payload = malloc(names_bytes + length);
+  if (!payload) return;
+  memcpy(payload, shaders, names_bytes);
+  memcpy(payload + names_bytes, binary, length);
+  LU_TRACE_CALL(LU_TRACE_glShaderBinary, payload, names_bytes + length, count, binaryFormat, length);
+  free(payload);
+}
+
+static void GLAPIENTRY lu_traced_glShaderSource(GLuint shader, GLsizei count, const GLchar *const *string, const GLint *length) {
+  lu_real_glShaderSource(shader, count, string, length);
+  if (!__atomic_load_n(&lu_tracer.active, __ATOMIC_RELAXED) || count < 0) return;
+  // The strings are joined into one, which is all the replay needs
+  size_t total = 0;
+  for (GLsizei i = 0; i < count; i++) total += length && length[i] >= 0 ? (size_t)length[i] : strlen(string[i]);
+  char *source = malloc(total + 1);
+  if (!source) return;
+  size_t at = 0;
+  for (GLsizei i = 0; i < count; i++) {
+    size_t len = length && length[i] >= 0 ? (size_t)length[i] : strlen(string[i]);
+    memcpy(source + at, string[i], len);
+    at += len;
+  }
+  source[total] = '\0';
+  LU_TRACE_CALL(LU_TRACE_glShaderSource, source, total + 1, shader);
+  free(source);
+}
+
+// Payload is the constant indices, then the values, then the entry point's name
+static void lu_trace_specialize(lu_TraceCall call, GLuint shader, const GLchar *pEntryPoint, GLuint numSpecializationConstants,
+                                const GLuint *pConstantIndex, const GLuint *pConstantValue) {
+  if (!__atomic_load_n(&lu_tracer.active, __ATOMIC_RELAXED)) return;
+  size_t constants_bytes = (size_t)numSpecializationConstants * sizeof(GLuint);
+  size_t entry_bytes = strlen(pEntryPoint) + 1;
+  uint8_t *payload = malloc(constants_bytes * 2 + entry_bytes);
+  if (!payload) return;
+  if (constants_bytes) {
+    memcpy(payload, pConstantIndex, constants_bytes);
+    memcpy(payload + constants_bytes, pConstantValue, constants_bytes);
+  }
+  memcpy(payload + constants_bytes * 2, pEntryPoint, entry_bytes);
+  LU_TRACE_CALL(call, payload, constants_bytes * 2 + entry_bytes, shader, numSpecializationConstants);
+  free(payload);
+}
+
+static void GLAPIENTRY lu_traced_glSpecializeShader(GLuint shader, const GLchar *pEntryPoint, GLuint numSpecializationConstants, const GLuint *pConstantIndex,
+                                                    const GLuint *pConstantValue) {
+  lu_real_glSpecializeShader(shader, pEntryPoint, numSpecializationConstants, pConstantIndex, pConstantValue);
+  lu_trace_specialize(LU_TRACE_glSpecializeShader, shader, pEntryPoint, numSpecializationConstants, pConstantIndex, pConstantValue);
+}
+
+static void GLAPIENTRY lu_traced_glSpecializeShaderARB(GLuint shader, const GLchar *pEntryPoint, GLuint numSpecializationConstants, const GLuint *pConstantIndex,
+                                                       const GLuint *pConstantValue) {
+  lu_real_glSpecializeShaderARB(shader, pEntryPoint, numSpecializationConstants, pConstantIndex, pConstantValue);
+  lu_trace_specialize(LU_TRACE_glSpecializeShaderARB, shader, pEntryPoint, numSpecializationConstants, pConstantIndex, pConstantValue);
+}
+
+static void GLAPIENTRY lu_traced_glUniform1f(GLint location, GLfloat v0) {
+  lu_real_glUniform1f(location, v0);
+  LU_TRACE_ARGS(glUniform1f, location, lu_trace_float(v0));
+}
+
+static void GLAPIENTRY lu_traced_glUniform1i(GLint location, GLint v0) {
+  lu_real_glUniform1i(location, v0);
+  LU_TRACE_ARGS(glUniform1i, location, v0);
+}
+
+static void GLAPIENTRY lu_traced_glUniform2f(GLint location, GLfloat v0, GLfloat v1) {
+  lu_real_glUniform2f(location, v0, v1);
+  LU_TRACE_ARGS(glUniform2f, location, lu_trace_float(v0), lu_trace_float(v1));
+}
+
+static void GLAPIENTRY lu_traced_glUniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2) {
+  lu_real_glUniform3f(location, v0, v1, v2);
+  LU_TRACE_ARGS(glUniform3f, location, lu_trace_float(v0), lu_trace_float(v1), lu_trace_float(v2));
+}
+
+static void GLAPIENTRY lu_traced_glUniform4f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3) {
+  lu_real_glUniform4f(location, v0, v1, v2, v3);
+  LU_TRACE_ARGS(glUniform4f, location, lu_trace_float(v0), lu_trace_float(v1), lu_trace_float(v2), lu_trace_float(v3));
+}
+
+static void GLAPIENTRY lu_traced_glUniformBlockBinding(GLuint program, GLuint uniformBlockIndex, GLuint uniformBlockBinding) {
+  lu_real_glUniformBlockBinding(program, uniformBlockIndex, uniformBlockBinding);
+  LU_TRACE_ARGS(glUniformBlockBinding, program, uniformBlockIndex, uniformBlockBinding);
+}
+
+static void GLAPIENTRY lu_traced_glUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) {
+  lu_real_glUniformMatrix4fv(location, count, transpose, value);
+  LU_TRACE_CALL(LU_TRACE_glUniformMatrix4fv, value, count > 0 ? count * 16 * sizeof(GLfloat) : 0, location, count, transpose);
+}
+
+static GLboolean GLAPIENTRY lu_traced_glUnmapBuffer(GLenum target) {
+  // Whatever was written through the mapping has to be recorded before it goes away
+  for (int i = 0; i < LU_TRACE_MAX_MAPPINGS; i++) {
+    lu_TraceMapping *mapping = &lu_trace_mappings[i];
+    if (mapping->target != target) continue;
+    lu_trace_buffer_write(mapping->buffer, mapping->offset, mapping->length, mapping->data);
+    *mapping = (lu_TraceMapping){0};
+  }
+  GLboolean result = lu_real_glUnmapBuffer(target);
+  LU_TRACE_ARGS(glUnmapBuffer, target, result);
+  return result;
+}
+
+static void GLAPIENTRY lu_traced_glUseProgram(GLuint program) {
+  lu_real_glUseProgram(program);
+  LU_TRACE_ARGS(glUseProgram, program);
+}
+
+static void GLAPIENTRY lu_traced_glUseProgramStages(GLuint pipeline, GLbitfield stages, GLuint program) {
+  lu_real_glUseProgramStages(pipeline, stages, program);
+  LU_TRACE_ARGS(glUseProgramStages, pipeline, stages, program);
+}
+
+static void GLAPIENTRY lu_traced_glValidateProgramPipeline(GLuint pipeline) {
+  lu_real_glValidateProgramPipeline(pipeline);
+  LU_TRACE_ARGS(glValidateProgramPipeline, pipeline);
+}
+
+static void GLAPIENTRY lu_traced_glVertexAttribBinding(GLuint attribindex, GLuint bindingindex) {
+  lu_real_glVertexAttribBinding(attribindex, bindingindex);
+  LU_TRACE_ARGS(glVertexAttribBinding, attribindex, bindingindex);
+}
+
+static void GLAPIENTRY lu_traced_glVertexAttribFormat(GLuint attribindex, GLint size, GLenum type, GLboolean normalized, GLuint relativeoffset) {
+  lu_real_glVertexAttribFormat(attribindex, size, type, normalized, relativeoffset);
+  LU_TRACE_ARGS(glVertexAttribFormat, attribindex, size, type, normalized, relativeoffset);
+}
+
+static void GLAPIENTRY lu_traced_glVertexAttribIFormat(GLuint attribindex, GLint size, GLenum type, GLuint relativeoffset) {
+  lu_real_glVertexAttribIFormat(attribindex, size, type, relativeoffset);
+  LU_TRACE_ARGS(glVertexAttribIFormat, attribindex, size, type, relativeoffset);
+}
+
+// luGL only ever passes offsets into the bound buffer here, so the pointer is stored as one
+static void GLAPIENTRY lu_traced_glVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void *pointer) {
+  lu_real_glVertexAttribPointer(index, size, type, normalized, stride, pointer);
+  LU_TRACE_ARGS(glVertexAttribPointer, index, size, type, normalized, stride, (uintptr_t)pointer);
+}
+
+static void GLAPIENTRY lu_traced_glWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout) {
+  lu_real_glWaitSync(sync, flags, timeout);
+  LU_TRACE_ARGS(glWaitSync, (uintptr_t)sync, flags, timeout);
+}
+
+// GL 1.1, reached through the redirects in luGL.h
+
+void GLAPIENTRY lu_traced_glBindTexture(GLenum target, GLuint texture) {
+  glBindTexture(target, texture);
+  LU_TRACE_ARGS(glBindTexture, target, texture);
+}
+
+void GLAPIENTRY lu_traced_glBlendFunc(GLenum sfactor, GLenum dfactor) {
+  glBlendFunc(sfactor, dfactor);
+  LU_TRACE_ARGS(glBlendFunc, sfactor, dfactor);
+}
+
+void GLAPIENTRY lu_traced_glClear(GLbitfield mask) {
+  glClear(mask);
+  LU_TRACE_ARGS(glClear, mask);
+}
+
+void GLAPIENTRY lu_traced_glClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha) {
+  glClearColor(red, green, blue, alpha);
+  LU_TRACE_ARGS(glClearColor, lu_trace_float(red), lu_trace_float(green), lu_trace_float(blue), lu_trace_float(alpha));
+}
+
+void GLAPIENTRY lu_traced_glCullFace(GLenum mode) {
+  glCullFace(mode);
+  LU_TRACE_ARGS(glCullFace, mode);
+}
+
+void GLAPIENTRY lu_traced_glDeleteTextures(GLsizei n, const GLuint *textures) {
+  glDeleteTextures(n, textures);
+  LU_TRACE_CALL(LU_TRACE_glDeleteTextures, textures, n > 0 ? n * sizeof(GLuint) : 0, n);
+}
+
+void GLAPIENTRY lu_traced_glDepthFunc(GLenum func) {
+  glDepthFunc(func);
+  LU_TRACE_ARGS(glDepthFunc, func);
+}
+
+void GLAPIENTRY lu_traced_glDepthMask(GLboolean flag) {
+  glDepthMask(flag);
+  LU_TRACE_ARGS(glDepthMask, flag);
+}
+
+void GLAPIENTRY lu_traced_glDisable(GLenum cap) {
+  glDisable(cap);
+  LU_TRACE_ARGS(glDisable, cap);
+}
+
+void GLAPIENTRY lu_traced_glDrawArrays(GLenum mode, GLint first, GLsizei count) {
+  glDrawArrays(mode, first, count);
+  LU_TRACE_ARGS(glDrawArrays, mode, first, count);
+}
+
+// indices is taken to be an offset into the bound element buffer, like a core profile needs
+void GLAPIENTRY lu_traced_glDrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices) {
+  glDrawElements(mode, count, type, indices);
+  LU_TRACE_ARGS(glDrawElements, mode, count, type, (uintptr_t)indices);
+}
+
+void GLAPIENTRY lu_traced_glEnable(GLenum cap) {
+  glEnable(cap);
+  LU_TRACE_ARGS(glEnable, cap);
+}
+
+void GLAPIENTRY lu_traced_glFinish(void) {
+  glFinish();
+  if (__atomic_load_n(&lu_tracer.active, __ATOMIC_RELAXED)) lu_trace_record(LU_TRACE_glFinish, 0, NULL, NULL, 0);
+}
+
+void GLAPIENTRY lu_traced_glFlush(void) {
+  glFlush();
+  if (__atomic_load_n(&lu_tracer.active, __ATOMIC_RELAXED)) lu_trace_record(LU_TRACE_glFlush, 0, NULL, NULL, 0);
+}
+
+void GLAPIENTRY lu_traced_glGenTextures(GLsizei n, GLuint *textures) {
+  glGenTextures(n, textures);
+  LU_TRACE_CALL(LU_TRACE_glGenTextures, textures, n > 0 ? n * sizeof(GLuint) : 0, n);
+}
+
+void GLAPIENTRY lu_traced_glGetIntegerv(GLenum pname, GLint *data) {
+  glGetIntegerv(pname, data);
+  LU_TRACE_ARGS(glGetIntegerv, pname);
+}
+
+void GLAPIENTRY lu_traced_glPixelStorei(GLenum pname, GLint param) {
+  glPixelStorei(pname, param);
+  LU_TRACE_ARGS(glPixelStorei, pname, param);
+}
+
+// With a pixel pack buffer bound, pixels is an offset into it, otherwise the replay reads into memory of its own
+void GLAPIENTRY lu_traced_glReadPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, void *pixels) {
+  glReadPixels(x, y, width, height, format, type, pixels);
+  if (!__atomic_load_n(&lu_tracer.active, __ATOMIC_RELAXED)) return;
+  GLuint pack_buffer = lu_trace_bound_buffer(GL_PIXEL_PACK_BUFFER);
+  LU_TRACE_ARGS(glReadPixels, x, y, width, height, format, type, pack_buffer ? (uintptr_t)pixels : 0, pack_buffer != 0);
+}
+
+void GLAPIENTRY lu_traced_glScissor(GLint x, GLint y, GLsizei width, GLsizei height) {
+  glScissor(x, y, width, height);
+  LU_TRACE_ARGS(glScissor, x, y, width, height);
+}
+
+// Pixels come from memory (recorded as the payload) or, with a pixel unpack buffer bound, from an offset into it (recorded as an argument)
+void GLAPIENTRY lu_traced_glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format,
+                                       GLenum type, const void *pixels) {
+  glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+  if (!__atomic_load_n(&lu_tracer.active, __ATOMIC_RELAXED)) return;
+  bool unpack_buffer = lu_trace_bound_buffer(GL_PIXEL_UNPACK_BUFFER) != 0;
+  size_t bytes = pixels && !unpack_buffer ? lu_trace_pixel_bytes(width, height, format, type, GL_UNPACK_ALIGNMENT) : 0;
+  LU_TRACE_CALL(LU_TRACE_glTexImage2D, pixels, bytes, target, level, internalformat, width, height, border, format, type,
+                unpack_buffer ? (uintptr_t)pixels : 0);
+}
+
+void GLAPIENTRY lu_traced_glTexParameteri(GLenum target, GLenum pname, GLint param) {
+  glTexParameteri(target, pname, param);
+  LU_TRACE_ARGS(glTexParameteri, target, pname, param);
+}
+
+void GLAPIENTRY lu_traced_glTexParameteriv(GLenum target, GLenum pname, const GLint *params) {
+  glTexParameteriv(target, pname, params);
+  size_t count = pname == GL_TEXTURE_SWIZZLE_RGBA || pname == GL_TEXTURE_BORDER_COLOR ? 4 : 1;
+  LU_TRACE_CALL(LU_TRACE_glTexParameteriv, params, count * sizeof(GLint), target, pname);
+}
+
+void GLAPIENTRY lu_traced_glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format,
+                                          GLenum type, const void *pixels) {
+  glTexSubImage2D(target, level, xoffset, yoffset, width, height, format, type, pixels);
+  if (!__atomic_load_n(&lu_tracer.active, __ATOMIC_RELAXED)) return;
+  bool unpack_buffer = lu_trace_bound_buffer(GL_PIXEL_UNPACK_BUFFER) != 0;
+  size_t bytes = pixels && !unpack_buffer ? lu_trace_pixel_bytes(width, height, format, type, GL_UNPACK_ALIGNMENT) : 0;
+  LU_TRACE_CALL(LU_TRACE_glTexSubImage2D, pixels, bytes, target, level, xoffset, yoffset, width, height, format, type,
+                unpack_buffer ? (uintptr_t)pixels : 0);
+}
+
+void GLAPIENTRY lu_traced_glViewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+  glViewport(x, y, width, height);
+  LU_TRACE_ARGS(glViewport, x, y, width, height);
+}
+
+bool lu_trace_start(const char *path) {
+  if (!path) {
+    lu_log(LU_LOG_ERROR, "(lu_trace_start): No path given.\n");
+    return false;
+  }
+  if (lu_trace_active()) {
+    lu_log(LU_LOG_ERROR, "(lu_trace_start): Already tracing, call lu_trace_stop first.\n");
+    return false;
+  }
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    lu_log(LU_LOG_ERROR, "(lu_trace_start): Could not open %s for writing.\n", path);
+    return false;
+  }
+  fwrite(LU_TRACE_MAGIC, 1, 8, file);
+  pthread_mutex_lock(&lu_tracer.lock);
+  lu_tracer.file = file;
+  lu_tracer.seq = 0;
+  for (lu_TraceBuffer *buf = lu_tracer.buffers; buf; buf = buf->next) buf->seq = 0;
+  pthread_mutex_unlock(&lu_tracer.lock);
+  // Functions the driver doesn't have stay NULL
+#define LU_TRACE_SWAP(name)                                                                                                                \
+  lu_real_gl##name = __glew##name;                                                                                                         \
+  if (__glew##name) __glew##name = lu_traced_gl##name;
+  LU_TRACE_GLEW_CALLS(LU_TRACE_SWAP)
+#undef LU_TRACE_SWAP
+  __atomic_store_n(&lu_tracer.active, true, __ATOMIC_SEQ_CST);
+  return true;
+}
+
+void lu_trace_stop(void) {
+  if (!__atomic_exchange_n(&lu_tracer.active, false, __ATOMIC_SEQ_CST)) return;
+#define LU_TRACE_RESTORE(name) __glew##name = lu_real_gl##name;
+  LU_TRACE_GLEW_CALLS(LU_TRACE_RESTORE)
+#undef LU_TRACE_RESTORE
+  pthread_mutex_lock(&lu_tracer.lock);
+  lu_TraceBuffer *buffers = lu_tracer.buffers;
+  pthread_mutex_unlock(&lu_tracer.lock);
+  // Let any thread in the middle of a record finish it. Not holding the lock, since a full buffer needs it to be written out.
+  for (lu_TraceBuffer *buf = buffers; buf; buf = buf->next) {
+    while (__atomic_load_n(&buf->busy, __ATOMIC_ACQUIRE)) sched_yield();
+  }
+  pthread_mutex_lock(&lu_tracer.lock);
+  for (lu_TraceBuffer *buf = lu_tracer.buffers; buf; buf = buf->next) {
+    lu_trace_flush_locked(buf);
+    free(buf->data);
+    buf->data = NULL;
+    buf->capacity = 0;
+  }
+  fclose(lu_tracer.file);
+  lu_tracer.file = NULL;
+  pthread_mutex_unlock(&lu_tracer.lock);
+}
+
+bool lu_trace_active(void) {
+  return __atomic_load_n(&lu_tracer.active, __ATOMIC_RELAXED);
+}
+
+void lu_trace_frame(void) {
+  if (__atomic_load_n(&lu_tracer.active, __ATOMIC_RELAXED)) lu_trace_record(LU_TRACE_FRAME, 0, NULL, NULL, 0);
+}
+
+void lu_trace_buffer_write(GLuint buffer, size_t offset, size_t size, const void *data) {
+  LU_TRACE_CALL(LU_TRACE_BUFFER_WRITE, data, size, buffer, offset, size);
+}
+
+#else
+
+bool lu_trace_start(const char *path) {
+  (void)path;
+  lu_log(LU_LOG_ERROR, "(lu_trace_start): luGL was built without LU_TRACE.\n");
+  return false;
+}
+
+void lu_trace_stop(void) {
+}
+
+bool lu_trace_active(void) {
+  return false;
+}
+
+void lu_trace_frame(void) {
+}
+
+void lu_trace_buffer_write(GLuint buffer, size_t offset, size_t size, const void *data) {
+  (void)buffer;
+  (void)offset;
+  (void)size;
+  (void)data;
+}
+
+#endif // LU_TRACE
+
+const char *lu_trace_call_name(lu_TraceCall call) {
+  static const char *names[LU_TRACE_CALL_COUNT] = {
+#define LU_TRACE_NAME(name) "gl" #name,
+      LU_TRACE_GLEW_CALLS(LU_TRACE_NAME) LU_TRACE_GL11_CALLS(LU_TRACE_NAME)
+#undef LU_TRACE_NAME
+      "lu_trace_frame", "lu_trace_buffer_write",
+  };
+  if ((unsigned)call >= LU_TRACE_CALL_COUNT) return "unknown";
+  return names[call];
+}
+
+#ifdef LU_TRACE
+// Now that the wrappers are defined, send the rest of this file's GL 1.1 calls through them
+#undef LU_TRACE_NO_REDIRECTS
+#include "luGL.h"
+#endif
+
+// Open addressed hash index, with linear probing. Maps 64 bit hashes to values (an array index or a pointer), and since the hash is all a
+// slot keeps, lookups walk the slots with a matching hash and compare the real key themselves:
+//   for (lu_IndexSlot *slot = lu_index_find(&index, hash); slot; slot = lu_index_find_next(&index, slot)) ...
+// Removing an entry leaves a deleted slot so probes still get past it, they're cleared out when the index is rebuilt at 70% full.
+
+#define LU_SLOT_EMPTY 0
+#define LU_SLOT_USED 1
+#define LU_SLOT_DELETED 2
+
+typedef struct {
+  uint64_t hash;
+  uintptr_t value;
+  uint8_t state;
+} lu_IndexSlot;
+
+typedef struct {
+  lu_IndexSlot *slots;
+  size_t capacity, count, taken; // taken counts deleted slots too, since they still lengthen probes
+} lu_Index;
+
+static uint64_t lu_hash_u32(uint32_t x) {
+  uint64_t h = x * 0x9e3779b97f4a7c15ull;
+  return h ^ (h >> 32);
+}
+
+// Starting value for lu_hash_bytes
+#define LU_HASH_SEED 14695981039346656037ull
+
+// FNV-1a over len bytes, carrying on from hash so a key made of several parts can be hashed a part at a time
+static uint64_t lu_hash_bytes(uint64_t hash, const void *data, size_t len) {
+  const uint8_t *bytes = data;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// The first used slot with hash from start on, NULL once an empty slot ends the probe
+static lu_IndexSlot *lu_index_probe(const lu_Index *index, uint64_t hash, size_t start) {
+  size_t mask = index->capacity - 1;
+  for (size_t i = start & mask;; i = (i + 1) & mask) {
+    lu_IndexSlot *slot = &index->slots[i];
+    if (slot->state == LU_SLOT_EMPTY) return NULL;
+    if (slot->state == LU_SLOT_USED && slot->hash == hash) return slot;
+  }
+}
+
+static lu_IndexSlot *lu_index_find(const lu_Index *index, uint64_t hash) {
+  return index->capacity ? lu_index_probe(index, hash, hash) : NULL;
+}
+
+static lu_IndexSlot *lu_index_find_next(const lu_Index *index, const lu_IndexSlot *slot) {
+  return lu_index_probe(index, slot->hash, (size_t)(slot - index->slots) + 1);
+}
+
+// The slot holding value under hash, NULL if there isn't one
+static lu_IndexSlot *lu_index_find_value(const lu_Index *index, uint64_t hash, uintptr_t value) {
+  lu_IndexSlot *slot = lu_index_find(index, hash);
+  while (slot && slot->value != value) slot = lu_index_find_next(index, slot);
+  return slot;
+}
+
+static void lu_index_place(lu_Index *index, uint64_t hash, uintptr_t value) {
+  size_t mask = index->capacity - 1;
+  size_t i = hash & mask;
+  while (index->slots[i].state == LU_SLOT_USED) i = (i + 1) & mask;
+  if (index->slots[i].state == LU_SLOT_EMPTY) index->taken++;
+  index->slots[i] = (lu_IndexSlot){.hash = hash, .value = value, .state = LU_SLOT_USED};
+  index->count++;
+}
+
+// Adds an entry, rebuilding without the deleted slots first when over 70% full. That only grows the index when the live entries alone
+// would fill more than half of it, otherwise it's the deleted slots that filled it up. False if out of memory.
+static bool lu_index_insert(lu_Index *index, uint64_t hash, uintptr_t value) {
+  if ((index->taken + 1) * 10 >= index->capacity * 7) {
+    size_t capacity = index->capacity == 0 ? 64 : (index->count + 1) * 20 < index->capacity * 7 ? index->capacity : index->capacity * 2;
+    lu_Index rebuilt = {.slots = calloc(capacity, sizeof(lu_IndexSlot)), .capacity = capacity};
+    if (!rebuilt.slots) return false;
+    for (size_t i = 0; i < index->capacity; i++) {
+      if (index->slots[i].state == LU_SLOT_USED) lu_index_place(&rebuilt, index->slots[i].hash, index->slots[i].value);
+    }
+    free(index->slots);
+    *index = rebuilt;
+  }
+  lu_index_place(index, hash, value);
+  return true;
+}
+
+static void lu_index_remove(lu_Index *index, lu_IndexSlot *slot) {
+  slot->state = LU_SLOT_DELETED;
+  index->count--;
+}
+
+// Empties the index, keeping its memory
+static void lu_index_clear(lu_Index *index) {
+  if (index->slots) memset(index->slots, 0, index->capacity * sizeof(lu_IndexSlot));
+  index->count = 0;
+  index->taken = 0;
+}
+
+static void lu_index_free(lu_Index *index) {
+  free(index->slots);
+  *index = (lu_Index){0};
+}
+
+// Debug object tracking. The wrappers below record every name luGL makes and deletes in a set per type, and the #defines after them
+// send the rest of this file's gen/create/delete calls through the wrappers.
+#ifdef LU_DEBUG_OBJECTS
+
+static struct {
+  pthread_mutex_t lock;
+  lu_Index keys; // Every live object's lu_tracker_key
+  lu_ObjectStats stats;
+} lu_tracker = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// The type goes in the top byte so names of different types don't collide (sync objects are pointers, which fit below it)
+static uint64_t lu_tracker_key(lu_ObjectType type, uint64_t name) {
+  return ((uint64_t)(type + 1) << 56) | (name & 0x00ffffffffffffffull);
+}
+
+// Names are handed out in order, so mix them up before they're used to pick a slot
+static uint64_t lu_tracker_hash(uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdull;
+  key ^= key >> 33;
+  return key;
+}
+
+static void lu_track_create(lu_ObjectType type, uint64_t name) {
+  if (name == 0) return;
+  pthread_mutex_lock(&lu_tracker.lock);
+  uint64_t key = lu_tracker_key(type, name);
+  uint64_t hash = lu_tracker_hash(key);
+  if (!lu_index_find_value(&lu_tracker.keys, hash, key) && lu_index_insert(&lu_tracker.keys, hash, key)) lu_tracker.stats.live[type]++;
+  lu_tracker.stats.created[type]++;
+  pthread_mutex_unlock(&lu_tracker.lock);
+}
+
+static void lu_track_delete(lu_ObjectType type, uint64_t name) {
+  // Deleting 0 is allowed and does nothing
+  if (name == 0) return;
+  pthread_mutex_lock(&lu_tracker.lock);
+  uint64_t key = lu_tracker_key(type, name);
+  lu_IndexSlot *slot = lu_index_find_value(&lu_tracker.keys, lu_tracker_hash(key), key);
+  if (slot) {
+    lu_index_remove(&lu_tracker.keys, slot);
+    lu_tracker.stats.deleted[type]++;
+    lu_tracker.stats.live[type]--;
+  } else {
+    lu_tracker.stats.bad_deletes[type]++;
+  }
+  pthread_mutex_unlock(&lu_tracker.lock);
+}
+
+// glGen*/glDelete* pairs all look the same. Some are only called in some builds (framebuffers and renderbuffers need LU_HEADLESS).
+#define LU_TRACK_GEN_DELETE(gen, del, wrap_gen, wrap_del, type)                                                                            \
+  __attribute__((unused)) static void wrap_gen(GLsizei n, GLuint *names) {                                                                 \
+    gen(n, names);                                                                                                                         \
+    for (GLsizei i = 0; i < n; i++) lu_track_create(type, names[i]);                                                                       \
+  }                                                                                                                                        \
+  __attribute__((unused)) static void wrap_del(GLsizei n, const GLuint *names) {                                                           \
+    for (GLsizei i = 0; i < n; i++) lu_track_delete(type, names[i]);                                                                       \
+    del(n, names);                                                                                                                         \
+  }
+
+LU_TRACK_GEN_DELETE(glGenBuffers, glDeleteBuffers, lu_tracked_gen_buffers, lu_tracked_delete_buffers, LU_OBJECT_BUFFER)
+LU_TRACK_GEN_DELETE(glGenVertexArrays, glDeleteVertexArrays, lu_tracked_gen_vertex_arrays, lu_tracked_delete_vertex_arrays, LU_OBJECT_VERTEX_ARRAY)
+LU_TRACK_GEN_DELETE(glGenTextures, glDeleteTextures, lu_tracked_gen_textures, lu_tracked_delete_textures, LU_OBJECT_TEXTURE)
+LU_TRACK_GEN_DELETE(glGenFramebuffers, glDeleteFramebuffers, lu_tracked_gen_framebuffers, lu_tracked_delete_framebuffers, LU_OBJECT_FRAMEBUFFER)
+LU_TRACK_GEN_DELETE(glGenRenderbuffers, glDeleteRenderbuffers, lu_tracked_gen_renderbuffers, lu_tracked_delete_renderbuffers, LU_OBJECT_RENDERBUFFER)
+LU_TRACK_GEN_DELETE(glGenQueries, glDeleteQueries, lu_tracked_gen_queries, lu_tracked_delete_queries, LU_OBJECT_QUERY)
+LU_TRACK_GEN_DELETE(glGenProgramPipelines, glDeleteProgramPipelines, lu_tracked_gen_program_pipelines, lu_tracked_delete_program_pipelines, LU_OBJECT_PIPELINE)
+
+static GLuint lu_tracked_create_shader(GLenum type) {
+  GLuint shader = glCreateShader(type);
+  lu_track_create(LU_OBJECT_SHADER, shader);
+  return shader;
+}
+
+static void lu_tracked_delete_shader(GLuint shader) {
+  lu_track_delete(LU_OBJECT_SHADER, shader);
+  glDeleteShader(shader);
+}
+
+static GLuint lu_tracked_create_program(void) {
+  GLuint program = glCreateProgram();
+  lu_track_create(LU_OBJECT_PROGRAM, program);
+  return program;
+}
+
+static void lu_tracked_delete_program(GLuint program) {
+  lu_track_delete(LU_OBJECT_PROGRAM, program);
+  glDeleteProgram(program);
+}
+
+static GLsync lu_tracked_fence_sync(GLenum condition, GLbitfield flags) {
+  GLsync sync = glFenceSync(condition, flags);
+  lu_track_create(LU_OBJECT_SYNC, (uintptr_t)sync);
+  return sync;
+}
+
+static void lu_tracked_delete_sync(GLsync sync) {
+  lu_track_delete(LU_OBJECT_SYNC, (uintptr_t)sync);
+  glDeleteSync(sync);
+}
+
+#undef glGenBuffers
+#undef glDeleteBuffers
+#undef glGenVertexArrays
+#undef glDeleteVertexArrays
+#undef glGenTextures
+#undef glDeleteTextures
+#undef glGenFramebuffers
+#undef glDeleteFramebuffers
+#undef glGenRenderbuffers
+#undef glDeleteRenderbuffers
+#undef glGenQueries
+#undef glDeleteQueries
+#undef glGenProgramPipelines
+#undef glDeleteProgramPipelines
+#undef glCreateShader
+#undef glDeleteShader
+#undef glCreateProgram
+#undef glDeleteProgram
+#undef glFenceSync
+#undef glDeleteSync
+#define glGenBuffers lu_tracked_gen_buffers
+#define glDeleteBuffers lu_tracked_delete_buffers
+#define glGenVertexArrays lu_tracked_gen_vertex_arrays
+#define glDeleteVertexArrays lu_tracked_delete_vertex_arrays
+#define glGenTextures lu_tracked_gen_textures
+#define glDeleteTextures lu_tracked_delete_textures
+#define glGenFramebuffers lu_tracked_gen_framebuffers
+#define glDeleteFramebuffers lu_tracked_delete_framebuffers
+#define glGenRenderbuffers lu_tracked_gen_renderbuffers
+#define glDeleteRenderbuffers lu_tracked_delete_renderbuffers
+#define glGenQueries lu_tracked_gen_queries
+#define glDeleteQueries lu_tracked_delete_queries
+#define glGenProgramPipelines lu_tracked_gen_program_pipelines
+#define glDeleteProgramPipelines lu_tracked_delete_program_pipelines
+#define glCreateShader lu_tracked_create_shader
+#define glDeleteShader lu_tracked_delete_shader
+#define glCreateProgram lu_tracked_create_program
+#define glDeleteProgram lu_tracked_delete_program
+#define glFenceSync lu_tracked_fence_sync
+#define glDeleteSync lu_tracked_delete_sync
+
+void lu_debug_object_stats(lu_ObjectStats *stats) {
+  if (!stats) return;
+  pthread_mutex_lock(&lu_tracker.lock);
+  *stats = lu_tracker.stats;
+  pthread_mutex_unlock(&lu_tracker.lock);
+}
+
+#else
+
+void lu_debug_object_stats(lu_ObjectStats *stats) {
+  if (stats) memset(stats, 0, sizeof(*stats));
+}
+
+#endif // LU_DEBUG_OBJECTS
+
+size_t lu_debug_report_objects(void) {
+  static const char *names[LU_OBJECT_TYPE_COUNT] = {"buffers", "vertex arrays", "textures", "framebuffers", "renderbuffers", "queries", "pipelines", "shaders", "programs", "syncs"};
+#ifndef LU_DEBUG_OBJECTS
+  (void)names;
+  lu_log(LU_LOG_ERROR, "(lu_debug_report_objects): luGL was built without LU_DEBUG_OBJECTS.\n");
+  return 0;
+#else
+  lu_ObjectStats stats;
+  lu_debug_object_stats(&stats);
+  size_t total = 0;
+  for (int i = 0; i < LU_OBJECT_TYPE_COUNT; i++) {
+    total += stats.live[i];
+    if (stats.live[i] || stats.bad_deletes[i])
+      lu_log(LU_LOG_WARNING, "(lu_debug_report_objects): %zu %s live (%zu created, %zu deleted, %zu bad deletes).\n", stats.live[i], names[i], stats.created[i], stats.deleted[i], stats.bad_deletes[i]);
+  }
+  return total;
+#endif
+}
+
+// Instrumentation counters. With LU_INSTRUMENT, LU_INSTRUMENT_SCOPE at the top of a function counts the call and its time into the
+// calling thread's own block of counters (on every return, thanks to the cleanup attribute), so threads never write to the same cache
+// line. Without it the macros are empty and nothing is compiled in.
+#ifdef LU_INSTRUMENT
+
+typedef struct lu_ThreadStats {
+  _Alignas(64) lu_StatCounter counters[LU_STAT_COUNT];
+  struct lu_ThreadStats *next;
+} lu_ThreadStats;
+
+static struct {
+  pthread_mutex_t lock;
+  lu_ThreadStats *head;
+  size_t num_threads;
+} lu_stats_registry = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static __thread lu_ThreadStats *lu_thread_stats;
+
+// Blocks are never freed, so counts from threads that have exited still show up in snapshots
+static lu_ThreadStats *lu_get_thread_stats(void) {
+  if (lu_thread_stats) return lu_thread_stats;
+  lu_ThreadStats *stats = aligned_alloc(64, sizeof(lu_ThreadStats));
+  if (!stats) return NULL;
+  memset(stats, 0, sizeof(*stats));
+  pthread_mutex_lock(&lu_stats_registry.lock);
+  stats->next = lu_stats_registry.head;
+  lu_stats_registry.head = stats;
+  lu_stats_registry.num_threads++;
+  pthread_mutex_unlock(&lu_stats_registry.lock);
+  lu_thread_stats = stats;
+  return stats;
+}
+
+static inline uint64_t lu_stat_now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+typedef struct {
+  lu_StatId id;
+  uint64_t bytes;
+  uint64_t start;
+} lu_StatScope;
+
+static void lu_stat_scope_end(lu_StatScope *scope) {
+  uint64_t elapsed = lu_stat_now_ns() - scope->start;
+  lu_ThreadStats *stats = lu_get_thread_stats();
+  if (!stats) return;
+  lu_StatCounter *counter = &stats->counters[scope->id];
+  // Only this thread writes its counters, the relaxed stores just stop snapshots from reading torn values
+  __atomic_store_n(&counter->calls, counter->calls + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&counter->bytes, counter->bytes + scope->bytes, __ATOMIC_RELAXED);
+  __atomic_store_n(&counter->ns, counter->ns + elapsed, __ATOMIC_RELAXED);
+}
+
+#define LU_INSTRUMENT_SCOPE(id) lu_StatScope lu_stat_scope_ __attribute__((cleanup(lu_stat_scope_end))) = {(id), 0, lu_stat_now_ns()}
+#define LU_INSTRUMENT_BYTES(n) (lu_stat_scope_.bytes += (n))
+
+#else
+
+#define LU_INSTRUMENT_SCOPE(id)
+#define LU_INSTRUMENT_BYTES(n)
+
+#endif // LU_INSTRUMENT
+
+const char *lu_stat_name(lu_StatId id) {
+  static const char *names[LU_STAT_COUNT] = {
+      "lu_create_shader_program", "lu_compile_shader",    "lu_mesh_add_bytes", "lu_mesh_send",        "lu_mesh_render",
+      "lu_image_load",            "lu_texture_from_image", "lu_load_texture",   "lu_uniform_ring_alloc", "lu_structured_buffer_upload",
+      "lu_vt_update",             "lu_dispatch_compute",   "lu_upload_job",     "lu_read_pixels",
+  };
+  if ((unsigned)id >= LU_STAT_COUNT) return "unknown";
+  return names[id];
+}
+
+// Copies the pipeline statistics' passes into a snapshot, they live further down with the rest of the pipeline statistics
+static void lu_pipeline_stats_copy_passes(lu_Stats *stats);
+
+void lu_stats_snapshot(lu_Stats *stats) {
+  if (!stats) return;
+  memset(stats, 0, sizeof(*stats));
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  stats->time = now.tv_sec + now.tv_nsec / 1e9;
+#ifdef LU_INSTRUMENT
+  pthread_mutex_lock(&lu_stats_registry.lock);
+  for (lu_ThreadStats *thread = lu_stats_registry.head; thread; thread = thread->next) {
+    for (int i = 0; i < LU_STAT_COUNT; i++) {
+      stats->counters[i].calls += __atomic_load_n(&thread->counters[i].calls, __ATOMIC_RELAXED);
+      stats->counters[i].bytes += __atomic_load_n(&thread->counters[i].bytes, __ATOMIC_RELAXED);
+      stats->counters[i].ns += __atomic_load_n(&thread->counters[i].ns, __ATOMIC_RELAXED);
+    }
+  }
+  stats->threads = lu_stats_registry.num_threads;
+  pthread_mutex_unlock(&lu_stats_registry.lock);
+#endif
+  lu_pipeline_stats_copy_passes(stats);
+}
+
+void lu_stats_write(FILE *out, const lu_Stats *stats, bool json) {
+  if (!out || !stats) return;
+  if (json) {
+    // One line per snapshot, so a periodic dump is a JSON Lines file
+    fprintf(out, "{\"time\":%.6f,\"threads\":%zu,\"counters\":{", stats->time, stats->threads);
+    bool first = true;
+    for (int i = 0; i < LU_STAT_COUNT; i++) {
+      const lu_StatCounter *c = &stats->counters[i];
+      if (c->calls == 0) continue;
+      fprintf(out, "%s\"%s\":{\"calls\":%llu,\"bytes\":%llu,\"ns\":%llu}", first ? "" : ",", lu_stat_name(i), (unsigned long long)c->calls, (unsigned long long)c->bytes, (unsigned long long)c->ns);
+      first = false;
+    }
+    fprintf(out, "},\"passes\":{");
+    for (size_t i = 0; i < stats->num_passes; i++) {
+      const lu_PipelineStats *pass = &stats->passes[i];
+      const lu_PipelineCounters *c = &pass->total;
+      fprintf(out, "%s\"", i ? "," : "");
+      for (const char *ch = pass->name; *ch; ch++) {
+        if (*ch == '"' || *ch == '\\') fputc('\\', out);
+        if ((unsigned char)*ch >= 0x20) fputc(*ch, out);
+      }
+      fprintf(out, "\":{\"frames\":%llu,\"calls\":%llu,\"vertices\":%llu,\"primitives\":%llu,\"vertex_invocations\":%llu,\"clipped_primitives\":%llu,\"fragment_invocations\":%llu,\"samples_passed\":%llu}",
+              (unsigned long long)pass->frames, (unsigned long long)pass->calls, (unsigned long long)c->vertices, (unsigned long long)c->primitives, (unsigned long long)c->vertex_invocations,
+              (unsigned long long)c->clipped_primitives, (unsigned long long)c->fragment_invocations, (unsigned long long)c->samples_passed);
+    }
+    fprintf(out, "}}\n");
+  } else {
+    fprintf(out, "%-28s %12s %14s %12s %10s\n", "luGL call", "calls", "bytes", "total ms", "avg us");
+    for (int i = 0; i < LU_STAT_COUNT; i++) {
+      const lu_StatCounter *c = &stats->counters[i];
+      if (c->calls == 0) continue;
+      fprintf(out, "%-28s %12llu %14llu %12.3f %10.3f\n", lu_stat_name(i), (unsigned long long)c->calls, (unsigned long long)c->bytes, c->ns / 1e6, c->ns / 1e3 / c->calls);
+    }
+    if (stats->num_passes) fprintf(out, "%-28s %12s %12s %12s %12s %12s %12s (average per frame)\n", "Pipeline pass", "vertices", "primitives", "VS runs", "clipped", "FS runs", "samples");
+    for (size_t i = 0; i < stats->num_passes; i++) {
+      const lu_PipelineStats *pass = &stats->passes[i];
+      const lu_PipelineCounters *c = &pass->total;
+      double frames = pass->frames ? (double)pass->frames : 1.0;
+      fprintf(out, "%-28s %12.0f %12.0f %12.0f %12.0f %12.0f %12.0f\n", pass->name, c->vertices / frames, c->primitives / frames, c->vertex_invocations / frames, c->clipped_primitives / frames,
+              c->fragment_invocations / frames, c->samples_passed / frames);
+    }
+  }
+  fflush(out);
+}
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t stop;
+  pthread_t thread;
+  bool running, stopping;
+  FILE *out;
+  double interval;
+  bool json;
+} lu_stats_dumper = {.lock = PTHREAD_MUTEX_INITIALIZER, .stop = PTHREAD_COND_INITIALIZER};
+
+static void *lu_stats_dump_thread(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&lu_stats_dumper.lock);
+  while (!lu_stats_dumper.stopping) {
+    // Sleep on the condition variable so lu_stats_stop_dump doesn't have to wait out the interval
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    double seconds = lu_stats_dumper.interval;
+    until.tv_sec += (time_t)seconds;
+    until.tv_nsec += (long)((seconds - (time_t)seconds) * 1e9);
+    if (until.tv_nsec >= 1000000000L) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000L;
+    }
+    while (!lu_stats_dumper.stopping && pthread_cond_timedwait(&lu_stats_dumper.stop, &lu_stats_dumper.lock, &until) == 0) {
+    }
+    if (lu_stats_dumper.stopping) break;
+    lu_Stats stats;
+    lu_stats_snapshot(&stats);
+    lu_stats_write(lu_stats_dumper.out, &stats, lu_stats_dumper.json);
+  }
+  pthread_mutex_unlock(&lu_stats_dumper.lock);
+  return NULL;
+}
+
+bool lu_stats_start_dump(FILE *out, double interval_seconds, bool json) {
+  if (!out || interval_seconds <= 0.0) {
+    lu_log(LU_LOG_ERROR, "(lu_stats_start_dump): Need somewhere to write to and an interval above 0.\n");
+    return false;
+  }
+  lu_stats_stop_dump();
+  lu_stats_dumper.out = out;
+  lu_stats_dumper.interval = interval_seconds;
+  lu_stats_dumper.json = json;
+  lu_stats_dumper.stopping = false;
+  if (pthread_create(&lu_stats_dumper.thread, NULL, lu_stats_dump_thread, NULL) != 0) {
+    lu_log(LU_LOG_ERROR, "(lu_stats_start_dump): Failed to start dump thread.\n");
+    return false;
+  }
+  lu_stats_dumper.running = true;
+  return true;
+}
+
+void lu_stats_stop_dump(void) {
+  if (!lu_stats_dumper.running) return;
+  pthread_mutex_lock(&lu_stats_dumper.lock);
+  lu_stats_dumper.stopping = true;
+  pthread_cond_signal(&lu_stats_dumper.stop);
+  pthread_mutex_unlock(&lu_stats_dumper.lock);
+  pthread_join(lu_stats_dumper.thread, NULL);
+  lu_stats_dumper.running = false;
+}
+
+// KHR_debug output. Only hooked up on debug contexts, everywhere else lu_debug_output stays false and labelling objects is one branch.
+// Debug state belongs to a context, so these are per thread and set again by lu_debug_output_setup whenever luGL makes a context current.
+
+static __thread bool lu_debug_output;
+static __thread GLint lu_debug_max_label;
+
+static void GLAPIENTRY lu_debug_message(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, const void *user) {
+  if (type == GL_DEBUG_TYPE_PERFORMANCE) {
+    lu_log(LU_LOG_PERFORMANCE, "(GL performance warning %u): %s", id, message);
+    return;
+  }
+  // Only high severity errors are real errors, drivers report things like deprecated usage with lower ones
+  lu_LogSeverity level = severity == GL_DEBUG_SEVERITY_HIGH ? LU_LOG_ERROR : severity == GL_DEBUG_SEVERITY_NOTIFICATION ? LU_LOG_INFO : LU_LOG_WARNING;
+  const char *name = severity == GL_DEBUG_SEVERITY_HIGH ? "" : severity == GL_DEBUG_SEVERITY_MEDIUM ? ", medium severity" : severity == GL_DEBUG_SEVERITY_LOW ? ", low severity" : ", notification";
+  lu_log(level, "(GL error %u%s): %s", id, name, message);
+}
+
+// Sends the current context's errors and performance warnings to lu_log, if it really is a debug context and has KHR_debug
+static void lu_debug_output_setup(void) {
+  lu_debug_output = false;
+  if (!GLEW_VERSION_4_3 && !GLEW_KHR_debug) return;
+  GLint flags = 0;
+  glGetIntegerv(GL_CONTEXT_FLAGS, &flags);
+  if (!(flags & GL_CONTEXT_FLAG_DEBUG_BIT)) return;
+
+  glEnable(GL_DEBUG_OUTPUT);
+  // Messages come on the thread and call that caused them, instead of whenever the driver gets round to it
+  glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+  glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_FALSE);
+  glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_ERROR, GL_DONT_CARE, 0, NULL, GL_TRUE);
+  glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_PERFORMANCE, GL_DONT_CARE, 0, NULL, GL_TRUE);
+  glDebugMessageCallback(lu_debug_message, NULL);
+  glGetIntegerv(GL_MAX_LABEL_LENGTH, &lu_debug_max_label);
+  lu_debug_output = true;
+}
+
+// Labels an object with the file it came from. Labels that are too long keep their end, which has the file name in it.
+static void lu_label_object(GLenum identifier, GLuint name, const char *label) {
+  if (!lu_debug_output || !name || !label) return;
+  size_t len = strlen(label);
+  if (len >= (size_t)lu_debug_max_label) {
+    label += len - (lu_debug_max_label - 1);
+    len = lu_debug_max_label - 1;
+  }
+  glObjectLabel(identifier, name, (GLsizei)len, label);
+}
+
+// Checks options for combinations no driver will accept
+static bool lu_context_options_valid(const lu_ContextOptions *options, const char *caller) {
+  if (options->debug && options->no_error) {
+    lu_log(LU_LOG_ERROR, "(%s): A context can't be both a debug and a no error context.\n", caller);
+    return false;
+  }
+  if (options->gl_major == 0 && options->gl_minor != 0) {
+    lu_log(LU_LOG_ERROR, "(%s): gl_minor needs gl_major to be set too.\n", caller);
+    return false;
+  }
+  // Profiles only exist from 3.2 on, GLFW and EGL both refuse a core profile for anything older
+  if (options->core_profile && options->gl_major != 0 && (options->gl_major < 3 || (options->gl_major == 3 && options->gl_minor < 2))) {
+    lu_log(LU_LOG_ERROR, "(%s): A core profile needs OpenGL 3.2 or newer, not %d.%d.\n", caller, options->gl_major, options->gl_minor);
+    return false;
+  }
+  return true;
+}
+
+// Whether GLFW has been initialised, checked without telling the app's error callback about GLFW_NOT_INITIALIZED
+static bool lu_glfw_initialised(void) {
+  GLFWerrorfun callback = glfwSetErrorCallback(NULL);
+  bool initialised = glfwGetTimerFrequency() != 0;
+#if GLFW_VERSION_MAJOR > 3 || GLFW_VERSION_MINOR >= 3
+  if (!initialised) glfwGetError(NULL);
+#endif
+  glfwSetErrorCallback(callback);
+  return initialised;
+}
+
+GLFWwindow *lu_create_window_ex(const char *window_title, int width, int height, bool fullscreen, const lu_ContextOptions *options) {
+  lu_ContextOptions defaults = {0};
+  if (!options) options = &defaults;
+  if (!lu_context_options_valid(options, "lu_create_window")) return NULL;
+
+  // Initialise GLFW. If it was already running the app may have other windows, so it only gets terminated on failure if this call started it.
+  bool terminate_on_failure = !lu_glfw_initialised();
   if (glfwInit() != GLFW_TRUE) {
-    fprintf(stderr, "(lu_create_window): Error intitialising GLFW.\n");
+    lu_log(LU_LOG_ERROR, "(lu_create_window): Error intitialising GLFW.\n");
+    return NULL;
+  }
+
+  // Start from GLFW's defaults so hints from an earlier window don't carry over
+  glfwDefaultWindowHints();
+  if (options->gl_major) {
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, options->gl_major);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, options->gl_minor);
+  } else if (options->core_profile) {
+    // GLFW's default version is 1.0, which has no core profile
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  }
+  if (options->core_profile) {
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    // macOS only gives out core contexts that are forward compatible
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
+  }
+  if (options->debug) glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
+  if (options->no_error) glfwWindowHint(GLFW_CONTEXT_NO_ERROR, GLFW_TRUE);
+  if (options->srgb) glfwWindowHint(GLFW_SRGB_CAPABLE, GLFW_TRUE);
+  if (options->samples > 0) glfwWindowHint(GLFW_SAMPLES, options->samples);
+
+  // Create the window
+  GLFWwindow *window;
+  if (!fullscreen)
+    window = glfwCreateWindow(width, height, window_title, NULL, NULL);
+  else
+    window = glfwCreateWindow(width, height, window_title, glfwGetPrimaryMonitor(), NULL);
+  if (window == NULL) {
+    lu_log(LU_LOG_ERROR, "(lu_create_window): Error creating window with glfwCreateWindow().\n");
+    if (terminate_on_failure) glfwTerminate();
+    return NULL;
+  }
+  glfwMakeContextCurrent(window); // Set the context as current
+
+  // Initialise GLEW
+  glewExperimental = GL_TRUE;
+  if (glewInit() != GLEW_OK) {
+    lu_log(LU_LOG_ERROR, "(lu_create_window): Error initialising GLEW.\n");
+    glfwDestroyWindow(window);
+    if (terminate_on_failure) glfwTerminate();
+    return NULL;
+  }
+
+  // Called on every context, so one that isn't a debug context turns labelling back off for this thread
+  lu_debug_output_setup();
+  if (options->srgb) glEnable(GL_FRAMEBUFFER_SRGB);
+  if (options->samples > 0) glEnable(GL_MULTISAMPLE);
+  switch (options->vsync) {
+  case LU_VSYNC_OFF:
+    glfwSwapInterval(0);
+    break;
+  case LU_VSYNC_ON:
+    glfwSwapInterval(1);
+    break;
+  case LU_VSYNC_ADAPTIVE:
+    // Late frames swap straight away instead of waiting for the next vblank (needs EXT_swap_control_tear, otherwise it's just vsync)
+    glfwSwapInterval(-1);
+    break;
+  default:
+    break;
+  }
+
+  return window;
+}
+
+GLFWwindow *lu_create_window(const char *window_title, int width, int height, bool fullscreen) {
+  return lu_create_window_ex(window_title, width, height, fullscreen, NULL);
+}
+
+// Headless contexts
+
+struct lu_HeadlessContext {
+#ifdef LU_HEADLESS
+  EGLDisplay display;
+  EGLContext context;
+  EGLConfig config;
+  EGLint attribs[16]; // What the context was made with, so worker contexts can match it
+#endif
+  GLuint framebuffer, color, depth;
+  int width, height;
+  bool shared; // Made by lu_create_shared_headless_context, so the display and framebuffer belong to another context
+};
+
+#ifdef LU_HEADLESS
+// Gets an EGL display that doesn't need a window system, preferring Mesa's surfaceless platform
+static EGLDisplay lu_headless_display(void) {
+  const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (extensions && strstr(extensions, "EGL_MESA_platform_surfaceless") && get_platform_display) {
+    EGLDisplay display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (display != EGL_NO_DISPLAY) return display;
+  }
+  // Other drivers can usually do surfaceless contexts on their default display
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+// A new context sharing objects with ctx, made the same way ctx was
+static EGLContext lu_headless_share_context(lu_HeadlessContext *ctx) {
+  return eglCreateContext(ctx->display, ctx->config, ctx->context, ctx->attribs);
+}
+#endif
+
+lu_HeadlessContext *lu_create_headless_context(int width, int height) {
+  return lu_create_headless_context_ex(width, height, NULL);
+}
+
+lu_HeadlessContext *lu_create_headless_context_ex(int width, int height, const lu_ContextOptions *options) {
+#ifndef LU_HEADLESS
+  lu_log(LU_LOG_ERROR, "(lu_create_headless_context): luGL was built without LU_HEADLESS.\n");
+  return NULL;
+#else
+  lu_ContextOptions defaults = {0};
+  if (!options) options = &defaults;
+  if (!lu_context_options_valid(options, "lu_create_headless_context")) return NULL;
+  if (width <= 0 || height <= 0) {
+    lu_log(LU_LOG_ERROR, "(lu_create_headless_context): Invalid size %dx%d.\n", width, height);
+    return NULL;
+  }
+  lu_HeadlessContext *ctx = calloc(1, sizeof(*ctx));
+  if (!ctx) {
+    lu_log(LU_LOG_ERROR, "(lu_create_headless_context): Failed to allocate memory.\n");
+    return NULL;
+  }
+  ctx->width = width;
+  ctx->height = height;
+
+  ctx->display = lu_headless_display();
+  if (ctx->display == EGL_NO_DISPLAY || !eglInitialize(ctx->display, NULL, NULL)) {
+    lu_log(LU_LOG_ERROR, "(lu_create_headless_context): Error initialising EGL.\n");
+    free(ctx);
+    return NULL;
+  }
+  eglBindAPI(EGL_OPENGL_API);
+
+  // No surface is ever made, so any config will do (and the surfaceless platform might not have any)
+  EGLint config_attribs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+  EGLConfig config = EGL_NO_CONFIG_KHR;
+  EGLint num_configs = 0;
+  if (!eglChooseConfig(ctx->display, config_attribs, &config, 1, &num_configs) || num_configs == 0) config = EGL_NO_CONFIG_KHR;
+  ctx->config = config;
+
+  // The version asked for, or else the newest core context the driver will give us.
+  // There's nothing to present, so vsync, sRGB and samples don't apply (make a multisampled FBO instead).
+  int versions[][2] = {{4, 6}, {4, 5}, {4, 3}, {4, 1}, {3, 3}};
+  size_t num_versions = sizeof(versions) / sizeof(versions[0]);
+  if (options->gl_major) {
+    versions[0][0] = options->gl_major;
+    versions[0][1] = options->gl_minor;
+    num_versions = 1;
+  }
+  ctx->context = EGL_NO_CONTEXT;
+  for (size_t i = 0; i < num_versions && ctx->context == EGL_NO_CONTEXT; i++) {
+    int n = 0;
+    ctx->attribs[n++] = EGL_CONTEXT_MAJOR_VERSION;
+    ctx->attribs[n++] = versions[i][0];
+    ctx->attribs[n++] = EGL_CONTEXT_MINOR_VERSION;
+    ctx->attribs[n++] = versions[i][1];
+    ctx->attribs[n++] = EGL_CONTEXT_OPENGL_PROFILE_MASK;
+    ctx->attribs[n++] = options->gl_major && !options->core_profile ? EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT : EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT;
+    if (options->debug) {
+      ctx->attribs[n++] = EGL_CONTEXT_OPENGL_DEBUG;
+      ctx->attribs[n++] = EGL_TRUE;
+    }
+    if (options->no_error) {
+      ctx->attribs[n++] = EGL_CONTEXT_OPENGL_NO_ERROR_KHR;
+      ctx->attribs[n++] = EGL_TRUE;
+    }
+    ctx->attribs[n++] = EGL_NONE;
+    ctx->context = eglCreateContext(ctx->display, config, EGL_NO_CONTEXT, ctx->attribs);
+  }
+  if (ctx->context == EGL_NO_CONTEXT || !eglMakeCurrent(ctx->display, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx->context)) {
+    lu_log(LU_LOG_ERROR, "(lu_create_headless_context): Error creating a surfaceless OpenGL context (EGL error 0x%x).\n", eglGetError());
+    if (ctx->context != EGL_NO_CONTEXT) eglDestroyContext(ctx->display, ctx->context);
+    eglTerminate(ctx->display);
+    free(ctx);
+    return NULL;
+  }
+
+  // glewInit wants a window system, glewContextInit only needs the context
+  glewExperimental = GL_TRUE;
+  if (glewContextInit() != GLEW_OK) {
+    lu_log(LU_LOG_ERROR, "(lu_create_headless_context): Error initialising GLEW.\n");
+    lu_headless_context_delete(ctx);
+    return NULL;
+  }
+  lu_debug_output_setup();
+
+  // There's no default framebuffer, so make one and leave it bound for everything else to draw into
+  glGenRenderbuffers(1, &ctx->color);
+  glBindRenderbuffer(GL_RENDERBUFFER, ctx->color);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glGenRenderbuffers(1, &ctx->depth);
+  glBindRenderbuffer(GL_RENDERBUFFER, ctx->depth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &ctx->framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, ctx->framebuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, ctx->color);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, ctx->depth);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    lu_log(LU_LOG_ERROR, "(lu_create_headless_context): Framebuffer is incomplete.\n");
+    lu_headless_context_delete(ctx);
+    return NULL;
+  }
+  glViewport(0, 0, width, height);
+
+  return ctx;
+#endif
+}
+
+lu_HeadlessContext *lu_create_shared_headless_context(lu_HeadlessContext *share) {
+#ifndef LU_HEADLESS
+  (void)share;
+  lu_log(LU_LOG_ERROR, "(lu_create_shared_headless_context): luGL was built without LU_HEADLESS.\n");
+  return NULL;
+#else
+  if (!share) {
+    lu_log(LU_LOG_ERROR, "(lu_create_shared_headless_context): No context to share with.\n");
+    return NULL;
+  }
+  lu_HeadlessContext *ctx = malloc(sizeof(*ctx));
+  if (!ctx) {
+    lu_log(LU_LOG_ERROR, "(lu_create_shared_headless_context): Failed to allocate memory.\n");
+    return NULL;
+  }
+  *ctx = *share;
+  // Framebuffers aren't shared between contexts, so there's none to draw into until one is made
+  ctx->framebuffer = ctx->color = ctx->depth = 0;
+  ctx->shared = true;
+  ctx->context = lu_headless_share_context(share);
+  if (ctx->context == EGL_NO_CONTEXT) {
+    lu_log(LU_LOG_ERROR, "(lu_create_shared_headless_context): Error creating a shared context (EGL error 0x%x).\n", eglGetError());
+    free(ctx);
+    return NULL;
+  }
+  return ctx;
+#endif
+}
+
+bool lu_headless_make_current(lu_HeadlessContext *ctx) {
+#ifndef LU_HEADLESS
+  (void)ctx;
+  lu_log(LU_LOG_ERROR, "(lu_headless_make_current): luGL was built without LU_HEADLESS.\n");
+  return false;
+#else
+  if (!ctx || !eglMakeCurrent(ctx->display, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx->context)) {
+    lu_log(LU_LOG_ERROR, "(lu_headless_make_current): Error making the context current (EGL error 0x%x).\n", eglGetError());
+    return false;
+  }
+  lu_debug_output_setup();
+  return true;
+#endif
+}
+
+void lu_headless_context_delete(lu_HeadlessContext *ctx) {
+  if (!ctx) return;
+#ifdef LU_HEADLESS
+  if (ctx->shared) {
+    // Leave whatever other context is current alone, the display is still in use by the one shared with
+    if (eglGetCurrentContext() == ctx->context) eglMakeCurrent(ctx->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(ctx->display, ctx->context);
+    free(ctx);
+    return;
+  }
+  if (ctx->framebuffer) glDeleteFramebuffers(1, &ctx->framebuffer);
+  if (ctx->color) glDeleteRenderbuffers(1, &ctx->color);
+  if (ctx->depth) glDeleteRenderbuffers(1, &ctx->depth);
+  eglMakeCurrent(ctx->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglDestroyContext(ctx->display, ctx->context);
+  eglTerminate(ctx->display);
+#endif
+  free(ctx);
+}
+
+GLuint lu_headless_framebuffer(lu_HeadlessContext *ctx) {
+  return ctx ? ctx->framebuffer : 0;
+}
+
+lu_Image lu_read_pixels(int x, int y, int width, int height) {
+  LU_INSTRUMENT_SCOPE(LU_STAT_READ_PIXELS);
+  lu_Image image = {0};
+  if (width <= 0 || height <= 0) {
+    lu_log(LU_LOG_ERROR, "(lu_read_pixels): Invalid size %dx%d.\n", width, height);
+    return image;
+  }
+  size_t row_bytes = (size_t)width * 4;
+  uint8_t *pixels = malloc(row_bytes * height);
+  if (!pixels) {
+    lu_log(LU_LOG_ERROR, "(lu_read_pixels): Failed to allocate memory.\n");
+    return image;
+  }
+  // A bound pixel pack buffer would make the pointer an offset into it, so unbind it and put the caller's state back afterwards
+  GLint old_alignment, old_pack_buffer;
+  glGetIntegerv(GL_PACK_ALIGNMENT, &old_alignment);
+  glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &old_pack_buffer);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  if (old_pack_buffer) glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+  if (old_pack_buffer) glBindBuffer(GL_PIXEL_PACK_BUFFER, old_pack_buffer);
+  glPixelStorei(GL_PACK_ALIGNMENT, old_alignment);
+
+  // OpenGL gives the bottom row first, images start at the top
+  uint8_t *row = malloc(row_bytes);
+  if (row) {
+    for (int i = 0; i < height / 2; i++) {
+      uint8_t *top = pixels + (size_t)i * row_bytes, *bottom = pixels + (size_t)(height - 1 - i) * row_bytes;
+      memcpy(row, top, row_bytes);
+      memcpy(top, bottom, row_bytes);
+      memcpy(bottom, row, row_bytes);
+    }
+    free(row);
+  }
+
+  image.pixels = pixels;
+  image.width = width;
+  image.height = height;
+  image.channels = 4;
+  image.type = GL_UNSIGNED_BYTE;
+  LU_INSTRUMENT_BYTES(row_bytes * height);
+  return image;
+}
+
+static char *lu_read_file(const char *file_name, size_t *file_len) {
+  FILE *ptr = fopen(file_name, "rb"); // Open the file for reading
+  if (ptr == NULL) {
+    lu_log(LU_LOG_ERROR, "(lu_read_file): Could not open file %s, returning NULL.\n", file_name);
+    return NULL;
+  }
+  fseek(ptr, 0, SEEK_END);
+  (*file_len) = ftell(ptr);
+  if ((*file_len) == 0) {
+    fclose(ptr);
+    lu_log(LU_LOG_ERROR, "(lu_read_file): Could not read file %s, file has 0 length.", file_name);
+    return NULL;
+  }
+
+  // Allocate output
+  char *out = malloc(sizeof(char) * (*file_len + 1));
+
+  // Read the file
+  fseek(ptr, 0, SEEK_SET);
+  if (fread((void *)out, 1, (*file_len), ptr) != (*file_len)) {
+    lu_log(LU_LOG_ERROR, "(lu_read_file): Could not read file %s, fread() failed.\n", file_name);
+    fclose(ptr);
+    return NULL;
+  }
+  // Null terminate
+  out[*file_len] = '\0';
+  // Close file
+  fclose(ptr);
+  return out;
+}
+
+// Running totals of shader work, see lu_get_shader_stats
+static lu_ShaderStats lu_shader_stats;
+
+// Detects the shader type based on file extension, returns 0 if it isn't one luGL knows.
+// SPIR-V modules go by the extension before .spv, so shader.frag.spv is a fragment shader.
+static GLenum lu_shader_type(const char *shader_file_location) {
+  const char *ext = strrchr(shader_file_location, '.');
+  if (ext == NULL) return 0;
+  if (strcmp(ext, ".spv") == 0) {
+    const char *inner = ext;
+    while (inner > shader_file_location && *(inner - 1) != '.' && *(inner - 1) != '/') inner--;
+    if (inner == shader_file_location || *(inner - 1) != '.') return 0;
+    char stage[8];
+    snprintf(stage, sizeof(stage), ".%.*s", (int)(ext - inner), inner);
+    return lu_shader_type(stage);
+  }
+  if (strcmp(ext, ".vert") == 0) return GL_VERTEX_SHADER;
+  if (strcmp(ext, ".frag") == 0) return GL_FRAGMENT_SHADER;
+  if (strcmp(ext, ".geom") == 0) return GL_GEOMETRY_SHADER;
+  if (strcmp(ext, ".tesc") == 0) return GL_TESS_CONTROL_SHADER;
+  if (strcmp(ext, ".tese") == 0) return GL_TESS_EVALUATION_SHADER;
+  if (strcmp(ext, ".comp") == 0) return GL_COMPUTE_SHADER;
+  return 0;
+}
+
+// A growable string for building shader sources
+typedef struct {
+  char *data;
+  size_t len, cap;
+} lu_String;
+
+// Makes room for n more characters and the terminator
+static void lu_string_reserve(lu_String *str, size_t n) {
+  if (str->len + n + 1 > str->cap) {
+    while (str->len + n + 1 > str->cap) str->cap = str->cap ? str->cap * 2 : 256;
+    str->data = realloc(str->data, str->cap);
+  }
+}
+
+static void lu_string_append(lu_String *str, const char *src, size_t n) {
+  lu_string_reserve(str, n);
+  memcpy(str->data + str->len, src, n);
+  str->len += n;
+  str->data[str->len] = '\0';
+}
+
+static void lu_string_appendf(lu_String *str, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(NULL, 0, fmt, args);
+  va_end(args);
+  if (n <= 0) return;
+  // Sized first so long defines don't get cut short, then formatted straight into the string
+  lu_string_reserve(str, (size_t)n);
+  va_start(args, fmt);
+  vsnprintf(str->data + str->len, (size_t)n + 1, fmt, args);
+  va_end(args);
+  str->len += n;
+}
+
+// Appends #define lines for a list of "NAME" or "NAME=VALUE" strings
+static void lu_append_defines(lu_String *out, size_t num_defines, const char *const *defines) {
+  for (size_t i = 0; i < num_defines; i++) {
+    const char *eq = strchr(defines[i], '=');
+    if (eq)
+      lu_string_appendf(out, "#define %.*s %s\n", (int)(eq - defines[i]), defines[i], eq + 1);
+    else
+      lu_string_appendf(out, "#define %s\n", defines[i]);
+  }
+}
+
+// Reads a shader and everything it #includes into out. Defines are added straight after the #version line of the top level file.
+// #line directives keep compile errors pointing at the right line of each file.
+static bool lu_preprocess_into(lu_String *out, const char *shader_file_location, size_t num_defines, const char *const *defines, int depth) {
+  if (depth > LU_MAX_INCLUDE_DEPTH) {
+    lu_log(LU_LOG_ERROR, "(lu_preprocess_shader): Includes nested more than %d deep at %s, probably an include cycle.\n", LU_MAX_INCLUDE_DEPTH, shader_file_location);
+    return false;
+  }
+  size_t src_len;
+  char *source = lu_read_file(shader_file_location, &src_len);
+  if (!source) {
+    lu_log(LU_LOG_ERROR, "(lu_preprocess_shader): Failed to read %s\n", shader_file_location);
+    return false;
+  }
+  // Includes are relative to the including file
+  const char *slash = strrchr(shader_file_location, '/');
+  int dir_len = slash ? (int)(slash - shader_file_location + 1) : 0;
+
+  bool inject = depth == 0 && num_defines > 0;
+  // No #version line means the defines go right at the start
+  if (inject && strstr(source, "#version") == NULL) {
+    lu_append_defines(out, num_defines, defines);
+    lu_string_append(out, "#line 1\n", 8);
+    inject = false;
+  }
+
+  bool ok = true;
+  int line_number = 1;
+  for (char *line = source; *line && ok; line_number++) {
+    char *end = strchr(line, '\n');
+    size_t line_len = end ? (size_t)(end - line + 1) : strlen(line);
+    char *p = line;
+    while (*p == ' ' || *p == '\t') p++;
+
+    if (strncmp(p, "#include", 8) == 0) {
+      char *open = strpbrk(p + 8, "\"<");
+      char *close = open ? strchr(open + 1, *open == '<' ? '>' : '"') : NULL;
+      if (!close || (end && close > end)) {
+        lu_log(LU_LOG_ERROR, "(lu_preprocess_shader): Bad #include on line %d of %s\n", line_number, shader_file_location);
+        ok = false;
+        break;
+      }
+      char include_path[1024];
+      int name_len = (int)(close - open - 1);
+      if (open[1] == '/')
+        snprintf(include_path, sizeof(include_path), "%.*s", name_len, open + 1);
+      else
+        snprintf(include_path, sizeof(include_path), "%.*s%.*s", dir_len, shader_file_location, name_len, open + 1);
+      lu_string_append(out, "#line 1\n", 8);
+      ok = lu_preprocess_into(out, include_path, 0, NULL, depth + 1);
+      lu_string_appendf(out, "\n#line %d\n", line_number + 1);
+    } else {
+      lu_string_append(out, line, line_len);
+      if (inject && strncmp(p, "#version", 8) == 0) {
+        if (!end) lu_string_append(out, "\n", 1);
+        lu_append_defines(out, num_defines, defines);
+        lu_string_appendf(out, "#line %d\n", line_number + 1);
+        inject = false;
+      }
+    }
+    line += line_len;
+  }
+  free(source);
+  return ok;
+}
+
+// Returns the fully preprocessed source of a shader, or NULL on failure
+static char *lu_preprocess_shader(const char *shader_file_location, size_t num_defines, const char *const *defines, size_t *out_len) {
+  lu_String out = {0};
+  if (!lu_preprocess_into(&out, shader_file_location, num_defines, defines, 0)) {
+    free(out.data);
+    return NULL;
+  }
+  *out_len = out.len;
+  return out.data;
+}
+
+// Compiles source into a new shader object, returns 0 and prints the log on failure
+static GLuint lu_compile_shader_source(GLenum shader_type, const char *source, size_t src_len, const char *shader_name) {
+  // Create and compile the shader
+  GLuint shader = glCreateShader(shader_type);
+  const GLchar *src = source;
+  GLint len = (GLint)src_len;
+  glShaderSource(shader, 1, &src, &len);
+
+  glCompileShader(shader);
+  lu_shader_stats.compiles++;
+
+  // Check for compilation errors
+  GLint success;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+  if (!success) {
+    char log[1024];
+    glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+    lu_log(LU_LOG_ERROR, "(lu_compile_shader): Compilation failed for %s:\n%s", shader_name, log);
+    glDeleteShader(shader);
+    return 0;
+  }
+  lu_label_object(GL_SHADER, shader, shader_name);
+
+  return shader;
+}
+
+static bool lu_is_spirv(const char *shader_file_location) {
+  size_t len = strlen(shader_file_location);
+  return len > 4 && strcmp(shader_file_location + len - 4, ".spv") == 0;
+}
+
+bool lu_spirv_supported(void) {
+  return GLEW_VERSION_4_6 || GLEW_ARB_gl_spirv;
+}
+
+// Compiles the GLSL next to a SPIR-V module (shader.frag for shader.frag.spv), for drivers without SPIR-V support.
+// Specialization constants become LU_CONSTANT_<id> defines, which the GLSL can use in place of its constant_id layouts.
+static GLuint lu_compile_spirv_fallback(const char *shader_file_location, size_t num_constants, const GLuint *constant_ids, const GLuint *constant_values) {
+  char glsl_location[1024];
+  snprintf(glsl_location, sizeof(glsl_location), "%.*s", (int)(strlen(shader_file_location) - 4), shader_file_location);
+
+  char (*define_storage)[48] = malloc(sizeof(*define_storage) * (num_constants + 1));
+  const char **defines = malloc(sizeof(char *) * (num_constants + 1));
+  for (size_t i = 0; i < num_constants; i++) {
+    snprintf(define_storage[i], sizeof(define_storage[i]), "LU_CONSTANT_%u=%u", constant_ids[i], constant_values[i]);
+    defines[i] = define_storage[i];
+  }
+  size_t src_len;
+  char *source = lu_preprocess_shader(glsl_location, num_constants, defines, &src_len);
+  free(defines);
+  free(define_storage);
+  if (!source) {
+    lu_log(LU_LOG_ERROR, "(lu_compile_spirv_shader): SPIR-V isn't supported and there's no GLSL fallback at %s\n", glsl_location);
+    return 0;
+  }
+  GLuint shader = lu_compile_shader_source(lu_shader_type(glsl_location), source, src_len, glsl_location);
+  free(source);
+  return shader;
+}
+
+GLuint lu_compile_spirv_shader(const char *shader_file_location, size_t num_constants, const GLuint *constant_ids, const GLuint *constant_values) {
+  GLenum shader_type = lu_shader_type(shader_file_location);
+  if (shader_type == 0 || !lu_is_spirv(shader_file_location)) {
+    lu_log(LU_LOG_ERROR, "(lu_compile_spirv_shader): Unsupported extension in %s (use e.g. .vert.spv or .frag.spv)\n", shader_file_location);
+    return 0;
+  }
+  if (!lu_spirv_supported()) return lu_compile_spirv_fallback(shader_file_location, num_constants, constant_ids, constant_values);
+
+  size_t binary_len;
+  char *binary = lu_read_file(shader_file_location, &binary_len);
+  if (!binary) {
+    lu_log(LU_LOG_ERROR, "(lu_compile_spirv_shader): Failed to read %s\n", shader_file_location);
+    return 0;
+  }
+
+  // Load the module, then pick the entry point and constants, which is the part that actually compiles it
+  GLuint shader = glCreateShader(shader_type);
+  glShaderBinary(1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V_ARB, binary, (GLsizei)binary_len);
+  free(binary);
+  if (GLEW_VERSION_4_6)
+    glSpecializeShader(shader, "main", (GLuint)num_constants, constant_ids, constant_values);
+  else
+    glSpecializeShaderARB(shader, "main", (GLuint)num_constants, constant_ids, constant_values);
+  lu_shader_stats.spirv_shaders++;
+
+  // Check for specialization errors
+  GLint success;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+  if (!success) {
+    char log[1024];
+    glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+    lu_log(LU_LOG_ERROR, "(lu_compile_spirv_shader): Specialization failed for %s:\n%s", shader_file_location, log);
+    glDeleteShader(shader);
+    return 0;
+  }
+  lu_label_object(GL_SHADER, shader, shader_file_location);
+  return shader;
+}
+
+static GLuint lu_compile_shader(const char *shader_file_location) {
+  LU_INSTRUMENT_SCOPE(LU_STAT_COMPILE_SHADER);
+  GLenum shader_type = lu_shader_type(shader_file_location);
+  if (shader_type == 0) {
+    lu_log(LU_LOG_ERROR, "(lu_compile_shader): Unsupported extension in %s (use .vert, .frag, .geom, .tesc, .tese or .comp, optionally followed by .spv)\n", shader_file_location);
+    return 0;
+  }
+  if (lu_is_spirv(shader_file_location)) return lu_compile_spirv_shader(shader_file_location, 0, NULL, NULL);
+
+  // Read the shader file's contents (and anything it includes) into a string
+  size_t src_len;
+  char *source = lu_preprocess_shader(shader_file_location, 0, NULL, &src_len);
+
+  if (!source) {
+    lu_log(LU_LOG_ERROR, "(lu_compile_shader): Failed to read %s\n", shader_file_location);
+    return 0;
+  }
+
+  GLuint shader = lu_compile_shader_source(shader_type, source, src_len, shader_file_location);
+  free(source);
+  return shader;
+}
+
+GLuint lu_create_shader_program(size_t num_shaders, ...) {
+  LU_INSTRUMENT_SCOPE(LU_STAT_CREATE_SHADER_PROGRAM);
+  va_list args;
+  va_start(args, num_shaders);
+
+  GLuint *shaders = malloc(sizeof(unsigned int) * num_shaders);
+  lu_String label = {0};
+  for (int i = 0; i < num_shaders; i++) {
+    // Create and compile each shader
+    char *shader_file_name = va_arg(args, char *);
+    if (lu_debug_output) lu_string_appendf(&label, "%s%s", i ? " + " : "", shader_file_name);
+    GLuint shader = lu_compile_shader(shader_file_name);
+    // Check for compilation error
+    if (shader == 0) {
+      lu_log(LU_LOG_ERROR, "(lu_create_shader_program): Couldn't create shader program, compilation of shader %s failed.\n", shader_file_name);
+      // Delete all other shaders on failure to compile
+      for (int j = 0; j < i; j++) {
+        glDeleteShader(shaders[j]);
+      }
+      free(shaders);
+      free(label.data);
+      return 0;
+    }
+
+    shaders[i] = shader;
+  }
+  va_end(args);
+
+  // Create the program
+  GLuint shader_program = glCreateProgram();
+  for (int i = 0; i < num_shaders; i++) {
+    glAttachShader(shader_program, shaders[i]);
+  }
+
+  glLinkProgram(shader_program);
+  lu_shader_stats.links++;
+  // Delete all shaders now, stack overflow says i can do it lol
+  for (int i = 0; i < num_shaders; i++) {
+    glDeleteShader(shaders[i]);
+  }
+  free(shaders);
+
+  // Check for linking errors
+  GLint success;
+  glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
+  if (!success) {
+    char log[1024];
+    glGetProgramInfoLog(shader_program, sizeof(log), NULL, log);
+    lu_log(LU_LOG_ERROR, "(lu_create_shader_program): Shader linking failed:\n%s", log);
+    glDeleteProgram(shader_program);
+    free(label.data);
+    return 0;
+  }
+  lu_label_object(GL_PROGRAM, shader_program, label.data);
+  free(label.data);
+
+  return shader_program;
+}
+
+// Turns off attributes a VAO's previous layout used past the first num_used
+static void lu_disable_stale_attribs(size_t num_used) {
+  static GLint max_attribs = 0;
+  if (max_attribs == 0) glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &max_attribs);
+  for (GLint i = (GLint)num_used; i < max_attribs; i++) glDisableVertexAttribArray(i);
+}
+
+void lu_define_layout(GLuint *VAO, GLuint *VBO, size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types) {
+  // Reuse the names from a previous layout, only making new ones the first time
+  if (*VBO == 0 || !glIsBuffer(*VBO)) glGenBuffers(1, VBO);
+  glBindBuffer(GL_ARRAY_BUFFER, *VBO);
+
+  if (*VAO == 0 || !glIsVertexArray(*VAO)) glGenVertexArrays(1, VAO);
+  glBindVertexArray(*VAO);
+
+  // Calculate stride
+  int stride = 0;
+  for (int i = 0; i < num_components; i++) {
+    stride += component_sizes[i] * component_counts[i];
+  }
+  // Attrib pointer to each component
+  int offset = 0;
+  for (int i = 0; i < num_components; i++) {
+    glVertexAttribPointer(i, component_counts[i], component_types[i], GL_FALSE, stride, (GLvoid *)(intptr_t)offset);
+    glEnableVertexAttribArray(i);
+    offset += component_sizes[i] * component_counts[i];
+  }
+  lu_disable_stale_attribs(num_components);
+}
+
+// Converts a single float to a half, rounding to nearest even. Out of range values become infinity.
+static uint16_t lu_float_to_half_scalar(float value) {
+  uint32_t x;
+  memcpy(&x, &value, sizeof(x));
+  uint32_t sign = x & 0x80000000u;
+  x ^= sign;
+
+  uint16_t out;
+  if (x >= (143u << 23)) {
+    // Too big for a half, or already inf/nan
+    out = (x > (255u << 23)) ? 0x7e00 : 0x7c00;
+  } else if (x < (113u << 23)) {
+    // Becomes a denormal half, let the FPU do the rounding by adding a magic number
+    const uint32_t magic_bits = 126u << 23;
+    float magic, f;
+    memcpy(&magic, &magic_bits, sizeof(magic));
+    memcpy(&f, &x, sizeof(f));
+    f += magic;
+    memcpy(&x, &f, sizeof(x));
+    out = (uint16_t)(x - magic_bits);
+  } else {
+    // Normal half, rebias the exponent and round the mantissa to nearest even
+    uint32_t mantissa_odd = (x >> 13) & 1;
+    x += 0xc8000000u + 0xfff; // (15 - 127) << 23, plus rounding
+    x += mantissa_odd;
+    out = (uint16_t)(x >> 13);
+  }
+  return out | (uint16_t)(sign >> 16);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define LU_HAVE_F16C_PATH
+// 8 floats at a time with the F16C conversion instruction, compiled for it even if the rest of the file isn't
+__attribute__((target("avx,f16c"))) static void lu_float_to_half_f16c(uint16_t *dst, const float *src, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128((__m128i *)(dst + i), h);
+  }
+  for (; i < count; i++) dst[i] = lu_float_to_half_scalar(src[i]);
+}
+#endif
+
+void lu_float_to_half(uint16_t *dst, const float *src, size_t count) {
+#ifdef LU_HAVE_F16C_PATH
+  static int has_f16c = -1;
+  if (has_f16c < 0) has_f16c = __builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx");
+  if (has_f16c) {
+    lu_float_to_half_f16c(dst, src, count);
+    return;
+  }
+#endif
+  for (size_t i = 0; i < count; i++) dst[i] = lu_float_to_half_scalar(src[i]);
+}
+
+// Picks the GL formats for an image with the given number of channels and pixel type
+// (GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_HALF_FLOAT).
+// Grey and grey+alpha images get a swizzle mask so shaders still see (grey, grey, grey, alpha).
+static void lu_texture_format(int channels, GLenum type, bool srgb, GLint *internal_format, GLenum *format, GLint swizzle[4]) {
+  // Only 8 bit colour has sRGB formats, and there is no core single channel one
+  static const GLint formats_8[] = {GL_R8, GL_RG8, GL_RGB8, GL_RGBA8};
+  static const GLint formats_16[] = {GL_R16, GL_RG16, GL_RGB16, GL_RGBA16};
+  // RGB half float data gets packed into 32 bits per pixel, since it can't be negative coming from an image file anyway
+  static const GLint formats_half[] = {GL_R16F, GL_RG16F, GL_R11F_G11F_B10F, GL_RGBA16F};
+  static const GLenum formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+  if (channels < 1) channels = 1;
+  if (channels > 4) channels = 4;
+
+  if (type == GL_HALF_FLOAT)
+    *internal_format = formats_half[channels - 1];
+  else if (type == GL_UNSIGNED_SHORT)
+    *internal_format = formats_16[channels - 1];
+  else if (srgb && channels == 3)
+    *internal_format = GL_SRGB8;
+  else if (srgb && channels == 4)
+    *internal_format = GL_SRGB8_ALPHA8;
+  else
+    *internal_format = formats_8[channels - 1];
+  *format = formats[channels - 1];
+
+  swizzle[0] = GL_RED;
+  swizzle[1] = GL_GREEN;
+  swizzle[2] = GL_BLUE;
+  swizzle[3] = GL_ALPHA;
+  if (channels == 1) {
+    swizzle[1] = GL_RED;
+    swizzle[2] = GL_RED;
+    swizzle[3] = GL_ONE;
+  } else if (channels == 2) {
+    swizzle[1] = GL_RED;
+    swizzle[2] = GL_RED;
+    swizzle[3] = GL_GREEN;
+  }
+}
+
+// Largest unpack alignment (8, 4, 2 or 1) that evenly divides a row of row_bytes bytes
+static GLint lu_unpack_alignment(size_t row_bytes) {
+  if (row_bytes % 8 == 0) return 8;
+  if (row_bytes % 4 == 0) return 4;
+  if (row_bytes % 2 == 0) return 2;
+  return 1;
+}
+
+static size_t lu_type_size(GLenum type) {
+  switch (type) {
+  case GL_UNSIGNED_SHORT:
+  case GL_HALF_FLOAT:
+    return 2;
+  case GL_FLOAT:
+    return 4;
+  default:
+    return 1;
+  }
+}
+
+// Sets the filtering and swizzle parameters of the texture bound to GL_TEXTURE_2D
+static void lu_texture_parameters(int channels, const GLint swizzle[4], unsigned int flags) {
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (flags & LU_TEXTURE_MIPMAPS) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  if (channels < 3) glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+}
+
+// Creates a texture from tightly packed pixel data with 1-4 channels of type GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_HALF_FLOAT.
+// Leaves GL_TEXTURE_2D unbound on the active texture unit.
+static GLuint lu_upload_texture(const void *pixels, int width, int height, int channels, GLenum type, unsigned int flags) {
+  GLint internal_format;
+  GLenum format;
+  GLint swizzle[4];
+  lu_texture_format(channels, type, (flags & LU_TEXTURE_SRGB) != 0, &internal_format, &format, swizzle);
+
+  GLuint texture = 0;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+
+  // Set parameters
+  lu_texture_parameters(channels, swizzle, flags);
+
+  // Rows are tightly packed, so a 3 channel or odd width image usually won't be 4 byte aligned
+  GLint old_alignment;
+  glGetIntegerv(GL_UNPACK_ALIGNMENT, &old_alignment);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, lu_unpack_alignment((size_t)width * channels * lu_type_size(type)));
+  glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, type, pixels);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, old_alignment);
+
+  if (flags & LU_TEXTURE_MIPMAPS) glGenerateMipmap(GL_TEXTURE_2D);
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  return texture;
+}
+
+bool lu_image_load(const char *image_location, unsigned int flags, lu_Image *image) {
+  LU_INSTRUMENT_SCOPE(LU_STAT_IMAGE_LOAD);
+  if (!image) return false;
+  memset(image, 0, sizeof(lu_Image));
+  // The per thread flag, since upload workers and the render thread can be loading images at the same time
+  stbi_set_flip_vertically_on_load_thread((flags & LU_TEXTURE_FLIP_Y) ? 1 : 0);
+
+  // Ask stb_image for 0 channels so it keeps however many the file actually has
+  if (stbi_is_hdr(image_location)) {
+    // Radiance HDR (and friends) come out as 32 bit floats, halve them straight away
+    float *pixels = stbi_loadf(image_location, &image->width, &image->height, &image->channels, 0);
+    if (pixels == NULL) {
+      lu_log(LU_LOG_ERROR, "(lu_image_load): Error loading image file %s, stbi_loadf returned NULL (%s).\n", image_location, stbi_failure_reason());
+      return false;
+    }
+    size_t count = (size_t)image->width * image->height * image->channels;
+    uint16_t *half = malloc(sizeof(uint16_t) * count);
+    if (half == NULL) {
+      lu_log(LU_LOG_ERROR, "(lu_image_load): Out of memory converting %s to half floats.\n", image_location);
+      stbi_image_free(pixels);
+      memset(image, 0, sizeof(lu_Image));
+      return false;
+    }
+    lu_float_to_half(half, pixels, count);
+    stbi_image_free(pixels);
+    image->pixels = half;
+    image->type = GL_HALF_FLOAT;
+  } else if (stbi_is_16_bit(image_location)) {
+    image->pixels = stbi_load_16(image_location, &image->width, &image->height, &image->channels, 0);
+    if (image->pixels == NULL) {
+      lu_log(LU_LOG_ERROR, "(lu_image_load): Error loading image file %s, stbi_load_16 returned NULL (%s).\n", image_location, stbi_failure_reason());
+      return false;
+    }
+    image->type = GL_UNSIGNED_SHORT;
+  } else {
+    image->pixels = stbi_load(image_location, &image->width, &image->height, &image->channels, 0);
+    if (image->pixels == NULL) {
+      lu_log(LU_LOG_ERROR, "(lu_image_load): Error loading image file %s, stbi_load returned NULL (%s).\n", image_location, stbi_failure_reason());
+      return false;
+    }
+    image->type = GL_UNSIGNED_BYTE;
+  }
+  LU_INSTRUMENT_BYTES(lu_image_bytes(image));
+  return true;
+}
+
+void lu_image_free(lu_Image *image) {
+  if (!image) return;
+  // stb_image allocates with plain malloc, so this covers the half float copies too
+  if (image->pixels) free(image->pixels);
+  image->pixels = NULL;
+}
+
+size_t lu_image_bytes(const lu_Image *image) {
+  if (!image) return 0;
+  return (size_t)image->width * image->height * image->channels * lu_type_size(image->type);
+}
+
+GLuint lu_texture_from_image(const lu_Image *image, unsigned int flags) {
+  if (!image || !image->pixels) return 0;
+  LU_INSTRUMENT_SCOPE(LU_STAT_TEXTURE_FROM_IMAGE);
+  LU_INSTRUMENT_BYTES(lu_image_bytes(image));
+  return lu_upload_texture(image->pixels, image->width, image->height, image->channels, image->type, flags);
+}
+
+GLuint lu_load_texture(const char *texture_location, unsigned int flags) {
+  LU_INSTRUMENT_SCOPE(LU_STAT_LOAD_TEXTURE);
+  lu_Image image;
+  if (!lu_image_load(texture_location, flags, &image)) {
+    lu_log(LU_LOG_ERROR, "(lu_load_texture): Couldn't load %s, returning 0.\n", texture_location);
+    return 0;
+  }
+  GLuint texture = lu_texture_from_image(&image, flags);
+  lu_label_object(GL_TEXTURE, texture, texture_location);
+  // Free image
+  lu_image_free(&image);
+  return texture;
+}
+
+unsigned int lu_send_uniform_texture(char *texture_location, GLuint shader_program, char *texture_uniform_name) {
+  unsigned int texture = lu_load_texture(texture_location, LU_TEXTURE_FLIP_Y);
+  if (texture == 0) {
+    lu_log(LU_LOG_ERROR, "(lu_send_uniform_texture): Error loading image file, lu_load_texture returned 0.\n");
+    return 0;
+  }
+
+  // Send the texture as a uniform
+  glUseProgram(shader_program);
+  glUniform1i(glGetUniformLocation(shader_program, texture_uniform_name), 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, texture);
+
+  // Unbind texture
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  return texture;
+}
+
+// Structure of arrays meshes keep each component in its own stream. On the CPU, stream i starts at (bytes of streams before it) * capacity,
+// where capacity is how many vertices the allocation has room for. In the VBO the streams are packed, so capacity is the vertex count.
+struct lu_MeshStreams {
+  size_t num_components;
+  size_t bytes[LU_MAX_VERTEX_ATTRIBS]; // Bytes per vertex of each stream
+  size_t sizes[LU_MAX_VERTEX_ATTRIBS];
+  size_t counts[LU_MAX_VERTEX_ATTRIBS];
+  GLenum types[LU_MAX_VERTEX_ATTRIBS];
+};
+
+// Copies one component of num_vertices interleaved vertices into a tightly packed stream
+static void lu_scatter_component(const uint8_t *src, size_t stride, size_t num_vertices, size_t bytes, uint8_t *dst) {
+  // Constant sizes let the compiler turn the copies into plain loads and stores
+  switch (bytes) {
+  case 4:
+    for (size_t v = 0; v < num_vertices; v++) memcpy(dst + v * 4, src + v * stride, 4);
+    break;
+  case 8:
+    for (size_t v = 0; v < num_vertices; v++) memcpy(dst + v * 8, src + v * stride, 8);
+    break;
+  case 12:
+    for (size_t v = 0; v < num_vertices; v++) memcpy(dst + v * 12, src + v * stride, 12);
+    break;
+  case 16:
+    for (size_t v = 0; v < num_vertices; v++) memcpy(dst + v * 16, src + v * stride, 16);
+    break;
+  default:
+    for (size_t v = 0; v < num_vertices; v++) memcpy(dst + v * bytes, src + v * stride, bytes);
+  }
+}
+
+// The reverse of lu_scatter_component
+static void lu_gather_component(const uint8_t *src, size_t num_vertices, size_t bytes, uint8_t *dst, size_t stride) {
+  switch (bytes) {
+  case 4:
+    for (size_t v = 0; v < num_vertices; v++) memcpy(dst + v * stride, src + v * 4, 4);
+    break;
+  case 8:
+    for (size_t v = 0; v < num_vertices; v++) memcpy(dst + v * stride, src + v * 8, 8);
+    break;
+  case 12:
+    for (size_t v = 0; v < num_vertices; v++) memcpy(dst + v * stride, src + v * 12, 12);
+    break;
+  case 16:
+    for (size_t v = 0; v < num_vertices; v++) memcpy(dst + v * stride, src + v * 16, 16);
+    break;
+  default:
+    for (size_t v = 0; v < num_vertices; v++) memcpy(dst + v * stride, src + v * bytes, bytes);
+  }
+}
+
+// Where stream i starts, for streams that have room for capacity vertices
+static size_t lu_stream_offset(const struct lu_MeshStreams *soa, size_t component, size_t capacity) {
+  size_t offset = 0;
+  for (size_t i = 0; i < component; i++) offset += soa->bytes[i] * capacity;
+  return offset;
+}
+
+static void lu_mesh_add_soa(lu_Mesh *mesh, const uint8_t *src, size_t n_bytes) {
+  if (n_bytes % mesh->stride != 0) {
+    lu_log(LU_LOG_ERROR, "(lu_mesh_add_bytes): Structure of arrays meshes can only take whole vertices.\n");
+    return;
+  }
+  if (!mesh->data) {
+    mesh->bytes_alloced = 0;
+    mesh->bytes_added = 0;
+  }
+  size_t used = mesh->bytes_added / mesh->stride;
+  size_t capacity = mesh->bytes_alloced / mesh->stride;
+  size_t num_vertices = n_bytes / mesh->stride;
+
+  // Streams can't just be realloced since they all move, so copy them into the bigger block one by one
+  if (used + num_vertices > capacity) {
+    size_t new_capacity = capacity ? capacity : 16;
+    while (used + num_vertices > new_capacity) new_capacity *= 2;
+    uint8_t *data = malloc(new_capacity * mesh->stride);
+    if (!data) {
+      lu_log(LU_LOG_ERROR, "(lu_mesh_add_bytes): Failed to allocate memory.\n");
+      return;
+    }
+    for (size_t i = 0; i < mesh->soa->num_components; i++) {
+      memcpy(data + lu_stream_offset(mesh->soa, i, new_capacity), mesh->data + lu_stream_offset(mesh->soa, i, capacity), mesh->soa->bytes[i] * used);
+    }
+    free(mesh->data);
+    mesh->data = data;
+    mesh->bytes_alloced = new_capacity * mesh->stride;
+    capacity = new_capacity;
+  }
+
+  size_t offset = 0;
+  for (size_t i = 0; i < mesh->soa->num_components; i++) {
+    uint8_t *stream = mesh->data + lu_stream_offset(mesh->soa, i, capacity);
+    lu_scatter_component(src + offset, mesh->stride, num_vertices, mesh->soa->bytes[i], stream + mesh->soa->bytes[i] * used);
+    offset += mesh->soa->bytes[i];
+  }
+  mesh->bytes_added += n_bytes;
+}
+
+lu_Mesh lu_mesh_create(size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types) {
+  lu_Mesh mesh = {0};
+  mesh.data = NULL;
+  mesh.bytes_alloced = 0;
+  mesh.bytes_added = 0;
+  mesh.stride = 0;
+  for (int i = 0; i < num_components; i++) {
+    mesh.stride += component_sizes[i] * component_counts[i];
+  }
+
+  lu_define_layout(&mesh.VAO, &mesh.VBO, num_components, component_sizes, component_counts, component_types);
+  return mesh;
+}
+
+void lu_mesh_add_bytes(lu_Mesh *mesh, void *src, size_t n_bytes) {
+  LU_INSTRUMENT_SCOPE(LU_STAT_MESH_ADD_BYTES);
+  LU_INSTRUMENT_BYTES(n_bytes);
+  if (n_bytes == 0) return;
+  if (!src) return;
+  if (!mesh) return;
+  if (mesh->soa) {
+    lu_mesh_add_soa(mesh, src, n_bytes);
+    return;
+  }
+
+  if (!mesh->data) {
+    mesh->bytes_alloced = 64;
+    mesh->data = malloc(sizeof(uint8_t) * mesh->bytes_alloced);
+    mesh->bytes_added = 0;
+  }
+
+  if (mesh->bytes_added + n_bytes > mesh->bytes_alloced) {
+    while (mesh->bytes_added + n_bytes > mesh->bytes_alloced) {
+      mesh->bytes_alloced *= 2;
+    }
+    mesh->data = realloc(mesh->data, mesh->bytes_alloced * sizeof(uint8_t));
+  }
+
+  memcpy(mesh->data + mesh->bytes_added, src, n_bytes);
+  mesh->bytes_added += n_bytes;
+}
+
+void lu_mesh_free(lu_Mesh *mesh) {
+  if (!mesh) return;
+  if (mesh->data) free(mesh->data);
+  mesh->data = NULL;
+  mesh->bytes_alloced = 0;
+  // dont reset mesh->bytes_added, lu_mesh_add_bytes will do that for us
+}
+
+// From the pipeline statistics further down, they count each mesh's draws when per mesh stats are on
+static bool lu_pipeline_mesh_begin(const lu_Mesh *mesh);
+static void lu_pipeline_mesh_end(void);
+static void lu_pipeline_mesh_forget(GLuint vbo);
+
+void lu_mesh_delete(lu_Mesh *mesh) {
+  if (!mesh) return;
+  lu_mesh_free(mesh);
+  // The buffer name can be handed out again, and a new mesh using it mustn't pick up this one's numbers
+  lu_pipeline_mesh_forget(mesh->VBO);
+  // Shared VAOs belong to the layout cache
+  if (!mesh->shared_vao) glDeleteVertexArrays(1, &(mesh->VAO));
+  glDeleteBuffers(1, &(mesh->VBO));
+  free(mesh->soa);
+  mesh->soa = NULL;
+}
+
+static void lu_mesh_bind(lu_Mesh *mesh) {
+  if (!mesh) return;
+  glBindVertexArray(mesh->VAO);
+  glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
+  // A shared VAO doesn't remember a buffer, so point its binding at this mesh's
+  if (mesh->shared_vao) glBindVertexBuffer(0, mesh->VBO, 0, mesh->stride);
+}
+
+static void lu_mesh_unbind() {
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void lu_mesh_send(lu_Mesh *mesh) {
+  if (!mesh) return;
+  if (!mesh->data) return;
+  LU_INSTRUMENT_SCOPE(LU_STAT_MESH_SEND);
+  LU_INSTRUMENT_BYTES(mesh->bytes_added);
+  lu_mesh_bind(mesh);
+  if (mesh->soa) {
+    // Pack the streams together on the way up, and point the attributes at wherever they ended up
+    size_t num_vertices = mesh->bytes_added / mesh->stride;
+    size_t capacity = mesh->bytes_alloced / mesh->stride;
+    if (capacity == num_vertices) {
+      glBufferData(GL_ARRAY_BUFFER, mesh->bytes_added, mesh->data, GL_STATIC_DRAW);
+    } else {
+      glBufferData(GL_ARRAY_BUFFER, mesh->bytes_added, NULL, GL_STATIC_DRAW);
+      for (size_t i = 0; i < mesh->soa->num_components; i++) {
+        glBufferSubData(GL_ARRAY_BUFFER, lu_stream_offset(mesh->soa, i, num_vertices), mesh->soa->bytes[i] * num_vertices, mesh->data + lu_stream_offset(mesh->soa, i, capacity));
+      }
+    }
+    lu_define_soa_layout(&mesh->VAO, &mesh->VBO, mesh->soa->num_components, mesh->soa->sizes, mesh->soa->counts, mesh->soa->types, num_vertices);
+  } else {
+    glBufferData(GL_ARRAY_BUFFER, mesh->bytes_added, mesh->data, GL_STATIC_DRAW);
+  }
+  lu_mesh_unbind();
+}
+
+void lu_mesh_allocate(lu_Mesh *mesh, size_t n_bytes) {
+  if (!mesh) return;
+  lu_mesh_bind(mesh);
+  glBufferData(GL_ARRAY_BUFFER, n_bytes, NULL, GL_DYNAMIC_COPY);
+  if (mesh->soa) lu_define_soa_layout(&mesh->VAO, &mesh->VBO, mesh->soa->num_components, mesh->soa->sizes, mesh->soa->counts, mesh->soa->types, n_bytes / mesh->stride);
+  lu_mesh_unbind();
+  // Nothing on the CPU side, but lu_mesh_render goes by bytes_added
+  mesh->bytes_added = n_bytes;
+}
+
+void lu_mesh_bind_storage(lu_Mesh *mesh, GLuint binding) {
+  if (!mesh) return;
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, mesh->VBO);
+}
+
+void lu_mesh_render_instanced(lu_Mesh *mesh, GLenum render_mode, size_t instance_count) {
+  LU_INSTRUMENT_SCOPE(LU_STAT_MESH_RENDER);
+  lu_mesh_bind(mesh);
+  bool counted = lu_pipeline_stats_on && lu_pipeline_mesh_begin(mesh);
+  glDrawArraysInstanced(render_mode, 0, mesh->bytes_added / mesh->stride, (GLsizei)instance_count);
+  if (counted) lu_pipeline_mesh_end();
+  lu_mesh_unbind();
+}
+
+void lu_mesh_render(lu_Mesh *mesh, GLenum render_mode) {
+  LU_INSTRUMENT_SCOPE(LU_STAT_MESH_RENDER);
+  lu_mesh_bind(mesh);
+  bool counted = lu_pipeline_stats_on && lu_pipeline_mesh_begin(mesh);
+  glDrawArrays(render_mode, 0, mesh->bytes_added / mesh->stride);
+  if (counted) lu_pipeline_mesh_end();
+  lu_mesh_unbind();
+}
+
+void lu_mesh_render_many(lu_Mesh *meshes, size_t num_meshes, GLenum render_mode) {
+  LU_INSTRUMENT_SCOPE(LU_STAT_MESH_RENDER);
+  if (!meshes) return;
+  // Only touch the VAO when it changes, meshes with a shared layout just swap vertex buffers
+  GLuint bound_vao = 0;
+  for (size_t i = 0; i < num_meshes; i++) {
+    lu_Mesh *mesh = &meshes[i];
+    if (mesh->stride == 0) continue;
+    if (mesh->VAO != bound_vao) {
+      glBindVertexArray(mesh->VAO);
+      bound_vao = mesh->VAO;
+    }
+    if (mesh->shared_vao) glBindVertexBuffer(0, mesh->VBO, 0, mesh->stride);
+    bool counted = lu_pipeline_stats_on && lu_pipeline_mesh_begin(mesh);
+    glDrawArrays(render_mode, 0, mesh->bytes_added / mesh->stride);
+    if (counted) lu_pipeline_mesh_end();
+  }
+  lu_mesh_unbind();
+}
+
+// Structure of arrays meshes
+
+void lu_define_soa_layout(GLuint *VAO, GLuint *VBO, size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types, size_t num_vertices) {
+  // Reuse the names from a previous layout, only making new ones the first time
+  if (*VBO == 0 || !glIsBuffer(*VBO)) glGenBuffers(1, VBO);
+  glBindBuffer(GL_ARRAY_BUFFER, *VBO);
+  if (*VAO == 0 || !glIsVertexArray(*VAO)) glGenVertexArrays(1, VAO);
+  glBindVertexArray(*VAO);
+
+  // Each stream is tightly packed, so its stride is just the size of the component
+  size_t offset = 0;
+  for (size_t i = 0; i < num_components; i++) {
+    size_t bytes = component_sizes[i] * component_counts[i];
+    glVertexAttribPointer(i, component_counts[i], component_types[i], GL_FALSE, bytes, (GLvoid *)(intptr_t)offset);
+    glEnableVertexAttribArray(i);
+    offset += bytes * num_vertices;
+  }
+  lu_disable_stale_attribs(num_components);
+}
+
+void lu_mesh_relayout(lu_Mesh *mesh, size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types) {
+  if (!mesh) return;
+  if (mesh->shared_vao) {
+    lu_log(LU_LOG_ERROR, "(lu_mesh_relayout): Meshes with a shared layout can't be relaid out, create one with another lu_VertexLayout instead.\n");
+    return;
+  }
+
+  size_t stride = 0;
+  for (size_t i = 0; i < num_components; i++) stride += component_sizes[i] * component_counts[i];
+  if (stride == 0) {
+    lu_log(LU_LOG_ERROR, "(lu_mesh_relayout): Layout has no components.\n");
+    return;
+  }
+
+  if (mesh->soa) {
+    if (num_components > LU_MAX_VERTEX_ATTRIBS) {
+      lu_log(LU_LOG_ERROR, "(lu_mesh_relayout): Meshes need between 1 and %d components.\n", LU_MAX_VERTEX_ATTRIBS);
+      return;
+    }
+    lu_mesh_free(mesh);
+    mesh->soa->num_components = num_components;
+    for (size_t i = 0; i < num_components; i++) {
+      mesh->soa->sizes[i] = component_sizes[i];
+      mesh->soa->counts[i] = component_counts[i];
+      mesh->soa->types[i] = component_types[i];
+      mesh->soa->bytes[i] = component_sizes[i] * component_counts[i];
+    }
+    mesh->stride = stride;
+    mesh->bytes_added = 0;
+    lu_define_soa_layout(&mesh->VAO, &mesh->VBO, num_components, component_sizes, component_counts, component_types, 0);
+  } else {
+    mesh->stride = stride;
+    lu_define_layout(&mesh->VAO, &mesh->VBO, num_components, component_sizes, component_counts, component_types);
+  }
+  lu_mesh_unbind();
+}
+
+lu_Mesh lu_mesh_create_soa(size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types) {
+  lu_Mesh mesh = {0};
+  if (num_components == 0 || num_components > LU_MAX_VERTEX_ATTRIBS) {
+    lu_log(LU_LOG_ERROR, "(lu_mesh_create_soa): Meshes need between 1 and %d components.\n", LU_MAX_VERTEX_ATTRIBS);
+    return mesh;
+  }
+  mesh.soa = calloc(1, sizeof(*mesh.soa));
+  if (!mesh.soa) {
+    lu_log(LU_LOG_ERROR, "(lu_mesh_create_soa): Failed to allocate memory.\n");
+    return mesh;
+  }
+  mesh.soa->num_components = num_components;
+  for (size_t i = 0; i < num_components; i++) {
+    mesh.soa->sizes[i] = component_sizes[i];
+    mesh.soa->counts[i] = component_counts[i];
+    mesh.soa->types[i] = component_types[i];
+    mesh.soa->bytes[i] = component_sizes[i] * component_counts[i];
+    mesh.stride += mesh.soa->bytes[i];
+  }
+
+  lu_define_soa_layout(&mesh.VAO, &mesh.VBO, num_components, component_sizes, component_counts, component_types, 0);
+  lu_mesh_unbind();
+  return mesh;
+}
+
+void *lu_mesh_stream(lu_Mesh *mesh, size_t component, size_t *num_vertices) {
+  if (num_vertices) *num_vertices = 0;
+  if (!mesh || !mesh->soa || !mesh->data || component >= mesh->soa->num_components) return NULL;
+  if (num_vertices) *num_vertices = mesh->bytes_added / mesh->stride;
+  return mesh->data + lu_stream_offset(mesh->soa, component, mesh->bytes_alloced / mesh->stride);
+}
+
+void lu_aos_to_soa(const void *src, size_t num_vertices, size_t num_components, const size_t *component_bytes, void *dst) {
+  if (!src || !dst || !component_bytes) return;
+  size_t stride = 0;
+  for (size_t i = 0; i < num_components; i++) stride += component_bytes[i];
+
+  const uint8_t *in = src;
+  uint8_t *out = dst;
+  for (size_t i = 0; i < num_components; i++) {
+    lu_scatter_component(in, stride, num_vertices, component_bytes[i], out);
+    in += component_bytes[i];
+    out += component_bytes[i] * num_vertices;
+  }
+}
+
+void lu_soa_to_aos(const void *src, size_t num_vertices, size_t num_components, const size_t *component_bytes, void *dst) {
+  if (!src || !dst || !component_bytes) return;
+  size_t stride = 0;
+  for (size_t i = 0; i < num_components; i++) stride += component_bytes[i];
+
+  const uint8_t *in = src;
+  uint8_t *out = dst;
+  for (size_t i = 0; i < num_components; i++) {
+    lu_gather_component(in, num_vertices, component_bytes[i], out, stride);
+    in += component_bytes[i] * num_vertices;
+    out += component_bytes[i];
+  }
+}
+
+// Virtual textures
+
+#define LU_VT_MAGIC 0x5456554c // "LUVT"
+#define LU_VT_VERSION 1
+#define LU_VT_NOT_RESIDENT (-1)
+#define LU_VT_PENDING (-2)
+
+typedef struct {
+  uint32_t magic, version;
+  uint32_t width, height;  // Size of the source image in pixels
+  uint32_t tile_size;      // Width and height of every tile in pixels, tiles are always RGBA8
+  uint32_t num_levels;     // Levels in the pyramid, the last one is a single tile
+  uint32_t pyramid_tiles;  // Tiles per side of level 0 once rounded up to a power of two
+  uint32_t pad;
+} lu_VTHeader;
+
+typedef struct {
+  uint64_t key;
+  uint8_t *pixels;
+} lu_VTTile;
+
+typedef struct {
+  int level, x, y;
+  uint64_t last_used;
+  bool pinned;
+} lu_VTSlot;
+
+// Half open rectangle of page table entries, empty when x0 >= x1
+typedef struct {
+  uint32_t x0, y0, x1, y1;
+} lu_VTRect;
+
+struct lu_VirtualTexture {
+  lu_VTHeader header;
+  uint64_t *level_offsets; // File offset of each level's first tile
+  size_t tile_bytes;
+
+  // Residency, one entry per real tile per level, either a slot index or LU_VT_NOT_RESIDENT/LU_VT_PENDING
+  int32_t **residency;
+  // Page table texels per level, (slot x, slot y, resident level, 255) for every tile of the power of two pyramid
+  uint8_t **page_entries;
+  lu_VTRect *page_dirty; // Per level, the entries that have to be worked out again and uploaded
+
+  lu_VTSlot *slots;
+  int cache_side, num_slots;
+  uint64_t frame;
+
+  GLuint page_table, cache;
+  lu_VTStats stats;
+
+  // Loader thread state, everything below is protected by mutex
+  FILE *file;
+  pthread_t thread;
+  bool thread_running;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  uint64_t *queue;
+  size_t queue_capacity, queue_head, queue_count;
+  lu_VTTile *done;
+  size_t done_count, done_capacity;
+  bool quit;
+};
+
+static uint64_t lu_vt_key(int level, int x, int y) {
+  return ((uint64_t)level << 48) | ((uint64_t)y << 24) | (uint64_t)x;
+}
+
+static void lu_vt_unkey(uint64_t key, int *level, int *x, int *y) {
+  *level = (int)(key >> 48);
+  *y = (int)((key >> 24) & 0xffffff);
+  *x = (int)(key & 0xffffff);
+}
+
+// Size of a level of the source image in pixels
+static uint32_t lu_vt_level_extent(uint32_t extent, int level) {
+  uint32_t out = extent;
+  for (int i = 0; i < level; i++) out = (out + 1) / 2;
+  return out;
+}
+
+// Number of real (stored) tiles across a level
+static void lu_vt_level_tiles(const lu_VTHeader *h, int level, uint32_t *tiles_x, uint32_t *tiles_y) {
+  *tiles_x = (lu_vt_level_extent(h->width, level) + h->tile_size - 1) / h->tile_size;
+  *tiles_y = (lu_vt_level_extent(h->height, level) + h->tile_size - 1) / h->tile_size;
+}
+
+// One level of the pyramid while lu_vt_build_rows is making it
+typedef struct {
+  uint32_t width, height, tiles_x;
+  uint64_t offset;  // Where the level's tiles start in the file
+  uint32_t rows;    // Rows received so far
+  uint8_t *strip;   // The tile row being filled, tile_size rows of the level
+  uint8_t *pending; // Even row waiting for its odd neighbour to be box filtered into the next level
+} lu_VTBuildLevel;
+
+typedef struct {
+  FILE *out;
+  const char *vt_location;
+  uint32_t tile_size, num_levels;
+  uint8_t *tile;
+  lu_VTBuildLevel *levels;
+} lu_VTBuilder;
+
+// Cuts the strip of a level into tiles and writes them, clamping to the edge where a tile hangs off the image
+static bool lu_vt_build_write_strip(lu_VTBuilder *b, lu_VTBuildLevel *lv) {
+  uint32_t ts = b->tile_size;
+  uint32_t ty = (lv->rows - 1) / ts, filled = lv->rows - ty * ts;
+  size_t tile_bytes = (size_t)ts * ts * 4;
+  if (fseeko(b->out, (off_t)(lv->offset + (uint64_t)ty * lv->tiles_x * tile_bytes), SEEK_SET) != 0) return false;
+  for (uint32_t tx = 0; tx < lv->tiles_x; tx++) {
+    uint32_t x0 = tx * ts, inside = (lv->width - x0 < ts) ? lv->width - x0 : ts;
+    for (uint32_t y = 0; y < ts; y++) {
+      const uint8_t *src = lv->strip + ((size_t)(y < filled ? y : filled - 1) * lv->width + x0) * 4;
+      uint8_t *dst = b->tile + (size_t)y * ts * 4;
+      memcpy(dst, src, (size_t)inside * 4);
+      for (uint32_t x = inside; x < ts; x++) memcpy(dst + x * 4, src + (inside - 1) * 4, 4);
+    }
+    if (fwrite(b->tile, tile_bytes, 1, b->out) != 1) return false;
+  }
+  return true;
+}
+
+// Row r of level l has just been put in its strip: box filter it down into the next level and write the strip out once it's full
+static bool lu_vt_build_add_row(lu_VTBuilder *b, uint32_t l, uint32_t r) {
+  lu_VTBuildLevel *lv = &b->levels[l];
+  const uint8_t *row = lv->strip + (size_t)(r % b->tile_size) * lv->width * 4;
+  lv->rows = r + 1;
+  if (l + 1 < b->num_levels) {
+    if (r % 2 == 0 && r + 1 < lv->height) {
+      memcpy(lv->pending, row, (size_t)lv->width * 4);
+    } else {
+      // A last even row gets averaged with itself
+      const uint8_t *above = (r % 2 == 0) ? row : lv->pending;
+      lu_VTBuildLevel *next = &b->levels[l + 1];
+      uint8_t *dst = next->strip + (size_t)((r / 2) % b->tile_size) * next->width * 4;
+      for (uint32_t x = 0; x < next->width; x++) {
+        uint32_t x0 = x * 2, x1 = (x * 2 + 1 < lv->width) ? x * 2 + 1 : x * 2;
+        for (int c = 0; c < 4; c++) {
+          unsigned int sum = above[x0 * 4 + c] + above[x1 * 4 + c] + row[x0 * 4 + c] + row[x1 * 4 + c];
+          dst[x * 4 + c] = (uint8_t)((sum + 2) / 4);
+        }
+      }
+      if (!lu_vt_build_add_row(b, l + 1, r / 2)) return false;
+    }
+  }
+  if (lv->rows % b->tile_size == 0 || lv->rows == lv->height) {
+    if (!lu_vt_build_write_strip(b, lv)) {
+      lu_log(LU_LOG_ERROR, "(lu_vt_build_rows): Error writing tiles to %s.\n", b->vt_location);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool lu_vt_build_rows(const char *vt_location, uint32_t width, uint32_t height, int tile_size, lu_VTRowReader read_rows, void *user) {
+  if (tile_size <= 0) {
+    lu_log(LU_LOG_ERROR, "(lu_vt_build_rows): Invalid tile size %d.\n", tile_size);
+    return false;
+  }
+  uint32_t tiles = ((width > height ? width : height) + (uint64_t)tile_size - 1) / tile_size;
+  if (width == 0 || height == 0 || tiles > (1u << 24)) {
+    lu_log(LU_LOG_ERROR, "(lu_vt_build_rows): Invalid image size %ux%u.\n", width, height);
+    return false;
+  }
+
+  lu_VTHeader header = {0};
+  header.magic = LU_VT_MAGIC;
+  header.version = LU_VT_VERSION;
+  header.width = width;
+  header.height = height;
+  header.tile_size = tile_size;
+  header.pyramid_tiles = 1;
+  header.num_levels = 1;
+  while (header.pyramid_tiles < tiles) {
+    header.pyramid_tiles *= 2;
+    header.num_levels++;
+  }
+
+  FILE *out = fopen(vt_location, "wb");
+  if (out == NULL) {
+    lu_log(LU_LOG_ERROR, "(lu_vt_build_rows): Could not open %s for writing.\n", vt_location);
+    return false;
+  }
+  fwrite(&header, sizeof(header), 1, out);
+
+  lu_VTBuilder b = {.out = out, .vt_location = vt_location, .tile_size = tile_size, .num_levels = header.num_levels};
+  b.tile = malloc((size_t)tile_size * tile_size * 4);
+  b.levels = calloc(header.num_levels, sizeof(lu_VTBuildLevel));
+  uint64_t offset = sizeof(lu_VTHeader);
+  bool ok = true;
+  for (uint32_t l = 0; l < header.num_levels; l++) {
+    lu_VTBuildLevel *lv = &b.levels[l];
+    lv->width = lu_vt_level_extent(width, l);
+    lv->height = lu_vt_level_extent(height, l);
+    uint32_t tiles_y;
+    lu_vt_level_tiles(&header, l, &lv->tiles_x, &tiles_y);
+    lv->offset = offset;
+    offset += (uint64_t)lv->tiles_x * tiles_y * tile_size * tile_size * 4;
+    lv->strip = malloc((size_t)lv->width * tile_size * 4);
+    lv->pending = malloc((size_t)lv->width * 4);
+    if (!lv->strip || !lv->pending) ok = false;
+  }
+  if (!b.tile || !ok) {
+    lu_log(LU_LOG_ERROR, "(lu_vt_build_rows): Out of memory for %ux%u strips.\n", width, tile_size);
+    ok = false;
+  }
+
+  // Level 0 is read straight into its strip, every other level is filled by filtering the one above it
+  for (uint32_t y = 0; y < height && ok; y += tile_size) {
+    uint32_t num_rows = (height - y < (uint32_t)tile_size) ? height - y : (uint32_t)tile_size;
+    if (!read_rows(user, y, num_rows, b.levels[0].strip)) {
+      lu_log(LU_LOG_ERROR, "(lu_vt_build_rows): Reading rows %u to %u failed.\n", y, y + num_rows - 1);
+      ok = false;
+      break;
+    }
+    for (uint32_t r = y; r < y + num_rows && ok; r++) ok = lu_vt_build_add_row(&b, 0, r);
+  }
+
+  for (uint32_t l = 0; l < header.num_levels; l++) {
+    free(b.levels[l].strip);
+    free(b.levels[l].pending);
+  }
+  free(b.levels);
+  free(b.tile);
+  if (fclose(out) != 0) ok = false;
+  return ok;
+}
+
+typedef struct {
+  const uint8_t *pixels;
+  uint32_t width;
+} lu_VTImageRows;
+
+static bool lu_vt_copy_image_rows(void *user, uint32_t y, uint32_t num_rows, uint8_t *rows) {
+  lu_VTImageRows *image = user;
+  memcpy(rows, image->pixels + (size_t)y * image->width * 4, (size_t)num_rows * image->width * 4);
+  return true;
+}
+
+bool lu_vt_build(const char *image_location, const char *vt_location, int tile_size) {
+  int width, height, channels;
+  stbi_set_flip_vertically_on_load_thread(0);
+  stbi_uc *pixels = stbi_load(image_location, &width, &height, &channels, STBI_rgb_alpha);
+  if (pixels == NULL) {
+    lu_log(LU_LOG_ERROR, "(lu_vt_build): Error loading image file %s (%s).\n", image_location, stbi_failure_reason());
+    return false;
+  }
+  lu_VTImageRows image = {pixels, (uint32_t)width};
+  bool ok = lu_vt_build_rows(vt_location, width, height, tile_size, lu_vt_copy_image_rows, &image);
+  stbi_image_free(pixels);
+  return ok;
+}
+
+static bool lu_vt_read_tile(lu_VirtualTexture *vt, int level, int x, int y, uint8_t *out) {
+  uint32_t tiles_x, tiles_y;
+  lu_vt_level_tiles(&vt->header, level, &tiles_x, &tiles_y);
+  uint64_t offset = vt->level_offsets[level] + ((uint64_t)y * tiles_x + x) * vt->tile_bytes;
+  if (fseeko(vt->file, (off_t)offset, SEEK_SET) != 0) return false;
+  return fread(out, vt->tile_bytes, 1, vt->file) == 1;
+}
+
+static void *lu_vt_loader(void *arg) {
+  lu_VirtualTexture *vt = arg;
+  pthread_mutex_lock(&vt->mutex);
+  while (true) {
+    while (vt->queue_count == 0 && !vt->quit) pthread_cond_wait(&vt->cond, &vt->mutex);
+    if (vt->quit) break;
+    uint64_t key = vt->queue[vt->queue_head];
+    vt->queue_head = (vt->queue_head + 1) % vt->queue_capacity;
+    vt->queue_count--;
+    pthread_mutex_unlock(&vt->mutex);
+
+    // The file is only touched by this thread once it has started, so read without the lock held
+    int level, x, y;
+    lu_vt_unkey(key, &level, &x, &y);
+    uint8_t *pixels = malloc(vt->tile_bytes);
+    if (!lu_vt_read_tile(vt, level, x, y, pixels)) {
+      lu_log(LU_LOG_ERROR, "(lu_vt_loader): Error reading tile %d (%d, %d).\n", level, x, y);
+      free(pixels);
+      pixels = NULL;
+    }
+
+    pthread_mutex_lock(&vt->mutex);
+    if (vt->done_count == vt->done_capacity) {
+      vt->done_capacity = vt->done_capacity ? vt->done_capacity * 2 : 64;
+      vt->done = realloc(vt->done, sizeof(lu_VTTile) * vt->done_capacity);
+    }
+    vt->done[vt->done_count].key = key;
+    vt->done[vt->done_count].pixels = pixels;
+    vt->done_count++;
+  }
+  pthread_mutex_unlock(&vt->mutex);
+  return NULL;
+}
+
+static void lu_vt_upload_tile(lu_VirtualTexture *vt, int slot, const uint8_t *pixels) {
+  int ts = vt->header.tile_size;
+  glBindTexture(GL_TEXTURE_2D, vt->cache);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % vt->cache_side) * ts, (slot / vt->cache_side) * ts, ts, ts, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  vt->stats.uploads++;
+  vt->stats.upload_bytes += vt->tile_bytes;
+}
+
+// A tile came or went, so its page table entry changes along with every finer entry that falls back to it
+static void lu_vt_mark_dirty(lu_VirtualTexture *vt, int level, uint32_t x, uint32_t y) {
+  for (int l = level; l >= 0; l--) {
+    int shift = level - l;
+    lu_VTRect *r = &vt->page_dirty[l];
+    uint32_t x0 = x << shift, y0 = y << shift, x1 = (x + 1) << shift, y1 = (y + 1) << shift;
+    if (r->x0 >= r->x1) {
+      *r = (lu_VTRect){x0, y0, x1, y1};
+      continue;
+    }
+    if (x0 < r->x0) r->x0 = x0;
+    if (y0 < r->y0) r->y0 = y0;
+    if (x1 > r->x1) r->x1 = x1;
+    if (y1 > r->y1) r->y1 = y1;
+  }
+}
+
+lu_VirtualTexture *lu_vt_open(const char *vt_location, int cache_tiles_per_side) {
+  FILE *file = fopen(vt_location, "rb");
+  if (file == NULL) {
+    lu_log(LU_LOG_ERROR, "(lu_vt_open): Could not open file %s, returning NULL.\n", vt_location);
+    return NULL;
+  }
+  lu_VTHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != LU_VT_MAGIC || header.version != LU_VT_VERSION) {
+    lu_log(LU_LOG_ERROR, "(lu_vt_open): %s is not a luGL virtual texture, returning NULL.\n", vt_location);
+    fclose(file);
+    return NULL;
+  }
+  GLint max_size;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+  // Page table entries store the slot position in 8 bits each
+  if (cache_tiles_per_side < 1 || cache_tiles_per_side > 256 || (GLint)(cache_tiles_per_side * header.tile_size) > max_size) {
+    lu_log(LU_LOG_ERROR, "(lu_vt_open): Can't make a cache of %d tiles per side (at most 256, and it must fit in GL_MAX_TEXTURE_SIZE %d), returning NULL.\n", cache_tiles_per_side, max_size);
+    fclose(file);
+    return NULL;
+  }
+
+  lu_VirtualTexture *vt = calloc(1, sizeof(lu_VirtualTexture));
+  vt->header = header;
+  vt->file = file;
+  vt->tile_bytes = (size_t)header.tile_size * header.tile_size * 4;
+  vt->cache_side = cache_tiles_per_side;
+  vt->num_slots = cache_tiles_per_side * cache_tiles_per_side;
+  vt->slots = calloc(vt->num_slots, sizeof(lu_VTSlot));
+  for (int i = 0; i < vt->num_slots; i++) vt->slots[i].level = -1;
+
+  vt->level_offsets = malloc(sizeof(uint64_t) * header.num_levels);
+  vt->residency = malloc(sizeof(int32_t *) * header.num_levels);
+  vt->page_entries = malloc(sizeof(uint8_t *) * header.num_levels);
+  vt->page_dirty = calloc(header.num_levels, sizeof(lu_VTRect));
+  uint64_t offset = sizeof(lu_VTHeader);
+  for (uint32_t l = 0; l < header.num_levels; l++) {
+    uint32_t tiles_x, tiles_y;
+    lu_vt_level_tiles(&header, l, &tiles_x, &tiles_y);
+    vt->level_offsets[l] = offset;
+    offset += (uint64_t)tiles_x * tiles_y * vt->tile_bytes;
+    vt->residency[l] = malloc(sizeof(int32_t) * tiles_x * tiles_y);
+    for (size_t i = 0; i < (size_t)tiles_x * tiles_y; i++) vt->residency[l][i] = LU_VT_NOT_RESIDENT;
+    size_t side = header.pyramid_tiles >> l;
+    vt->page_entries[l] = calloc(side * side, 4);
+  }
+
+  // Physical tile cache
+  glGenTextures(1, &vt->cache);
+  glBindTexture(GL_TEXTURE_2D, vt->cache);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cache_tiles_per_side * header.tile_size, cache_tiles_per_side * header.tile_size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+  // Page table, one mip level per pyramid level so the shader can look it up with the same lod as the image
+  glGenTextures(1, &vt->page_table);
+  glBindTexture(GL_TEXTURE_2D, vt->page_table);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.num_levels - 1);
+  for (uint32_t l = 0; l < header.num_levels; l++) {
+    GLsizei side = header.pyramid_tiles >> l;
+    glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA8, side, side, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  // The single tile of the last level stays resident forever, so every lookup has something to fall back to
+  int top = header.num_levels - 1;
+  uint8_t *pixels = malloc(vt->tile_bytes);
+  if (!lu_vt_read_tile(vt, top, 0, 0, pixels)) {
+    lu_log(LU_LOG_ERROR, "(lu_vt_open): Error reading tiles from %s, returning NULL.\n", vt_location);
+    free(pixels);
+    lu_vt_delete(vt);
+    return NULL;
+  }
+  lu_vt_upload_tile(vt, 0, pixels);
+  free(pixels);
+  vt->slots[0] = (lu_VTSlot){.level = top, .x = 0, .y = 0, .last_used = 0, .pinned = true};
+  vt->residency[top][0] = 0;
+  lu_vt_mark_dirty(vt, top, 0, 0);
+
+  // Start the loader
+  vt->queue_capacity = (size_t)vt->num_slots * 2;
+  vt->queue = malloc(sizeof(uint64_t) * vt->queue_capacity);
+  pthread_mutex_init(&vt->mutex, NULL);
+  pthread_cond_init(&vt->cond, NULL);
+  if (pthread_create(&vt->thread, NULL, lu_vt_loader, vt) != 0) {
+    lu_log(LU_LOG_ERROR, "(lu_vt_open): Could not start the tile loader thread, returning NULL.\n");
+    pthread_mutex_destroy(&vt->mutex);
+    pthread_cond_destroy(&vt->cond);
+    lu_vt_delete(vt);
+    return NULL;
+  }
+  vt->thread_running = true;
+  return vt;
+}
+
+void lu_vt_delete(lu_VirtualTexture *vt) {
+  if (!vt) return;
+  if (vt->thread_running) {
+    pthread_mutex_lock(&vt->mutex);
+    vt->quit = true;
+    pthread_cond_signal(&vt->cond);
+    pthread_mutex_unlock(&vt->mutex);
+    pthread_join(vt->thread, NULL);
+    pthread_mutex_destroy(&vt->mutex);
+    pthread_cond_destroy(&vt->cond);
+  }
+  for (size_t i = 0; i < vt->done_count; i++) free(vt->done[i].pixels);
+  free(vt->done);
+  free(vt->queue);
+  for (uint32_t l = 0; l < vt->header.num_levels; l++) {
+    free(vt->residency[l]);
+    free(vt->page_entries[l]);
+  }
+  free(vt->residency);
+  free(vt->page_entries);
+  free(vt->page_dirty);
+  free(vt->level_offsets);
+  free(vt->slots);
+  glDeleteTextures(1, &vt->page_table);
+  glDeleteTextures(1, &vt->cache);
+  fclose(vt->file);
+  free(vt);
+}
+
+void lu_vt_begin_frame(lu_VirtualTexture *vt) {
+  if (!vt) return;
+  vt->frame++;
+  vt->stats.requests = 0;
+  vt->stats.hits = 0;
+  vt->stats.misses = 0;
+  vt->stats.uploads = 0;
+  vt->stats.upload_bytes = 0;
+  vt->stats.evictions = 0;
+}
+
+void lu_vt_request_tile(lu_VirtualTexture *vt, int level, int x, int y) {
+  if (!vt) return;
+  if (level < 0 || level >= (int)vt->header.num_levels) return;
+  uint32_t tiles_x, tiles_y;
+  lu_vt_level_tiles(&vt->header, level, &tiles_x, &tiles_y);
+  if (x < 0 || y < 0 || x >= (int)tiles_x || y >= (int)tiles_y) return;
+
+  vt->stats.requests++;
+  vt->stats.total_requests++;
+  int32_t *state = &vt->residency[level][(size_t)y * tiles_x + x];
+  if (*state >= 0) {
+    vt->slots[*state].last_used = vt->frame;
+    vt->stats.hits++;
+    vt->stats.total_hits++;
+    return;
+  }
+  vt->stats.misses++;
+  if (*state == LU_VT_PENDING) return;
+
+  // Queue it for the loader, if the queue is full it'll just get requested again next frame
+  pthread_mutex_lock(&vt->mutex);
+  if (vt->queue_count < vt->queue_capacity) {
+    vt->queue[(vt->queue_head + vt->queue_count) % vt->queue_capacity] = lu_vt_key(level, x, y);
+    vt->queue_count++;
+    *state = LU_VT_PENDING;
+    pthread_cond_signal(&vt->cond);
+  }
+  pthread_mutex_unlock(&vt->mutex);
+}
+
+void lu_vt_request_region(lu_VirtualTexture *vt, float u0, float v0, float u1, float v1, int level) {
+  if (!vt) return;
+  if (level < 0) level = 0;
+  if (level >= (int)vt->header.num_levels) level = vt->header.num_levels - 1;
+  float lw = (float)lu_vt_level_extent(vt->header.width, level);
+  float lh = (float)lu_vt_level_extent(vt->header.height, level);
+  float ts = (float)vt->header.tile_size;
+  int x0 = (int)floorf(u0 * lw / ts), x1 = (int)floorf(u1 * lw / ts);
+  int y0 = (int)floorf(v0 * lh / ts), y1 = (int)floorf(v1 * lh / ts);
+  for (int y = y0; y <= y1; y++) {
+    for (int x = x0; x <= x1; x++) {
+      lu_vt_request_tile(vt, level, x, y);
+    }
+  }
+}
+
+void lu_vt_request_feedback(lu_VirtualTexture *vt, const uint8_t *feedback, size_t num_pixels) {
+  if (!vt || !feedback) return;
+  for (size_t i = 0; i < num_pixels; i++) {
+    const uint8_t *p = feedback + i * 4;
+    if (p[3] == 0) continue; // Nothing was drawn here
+    int x = p[0] | ((p[2] & 0x0f) << 8);
+    int y = p[1] | ((p[2] >> 4) << 8);
+    lu_vt_request_tile(vt, p[3] - 1, x, y);
+  }
+}
+
+// Finds the least recently used slot that wasn't touched this frame, or -1
+static int lu_vt_find_slot(lu_VirtualTexture *vt) {
+  int best = -1;
+  for (int i = 0; i < vt->num_slots; i++) {
+    lu_VTSlot *s = &vt->slots[i];
+    if (s->level < 0) return i;
+    if (s->pinned || s->last_used == vt->frame) continue;
+    if (best < 0 || s->last_used < vt->slots[best].last_used) best = i;
+  }
+  return best;
+}
+
+// Works out and uploads the page table entries inside each level's dirty rectangle
+static void lu_vt_update_page_table(lu_VirtualTexture *vt) {
+  GLint old_alignment, old_row_length;
+  bool bound = false;
+  // Go from the coarsest level to the finest, so tiles that aren't resident can copy their parent's entry
+  for (int l = vt->header.num_levels - 1; l >= 0; l--) {
+    lu_VTRect r = vt->page_dirty[l];
+    if (r.x0 >= r.x1) continue;
+    uint32_t side = vt->header.pyramid_tiles >> l;
+    uint32_t tiles_x, tiles_y;
+    lu_vt_level_tiles(&vt->header, l, &tiles_x, &tiles_y);
+    uint8_t *entries = vt->page_entries[l];
+    for (uint32_t y = r.y0; y < r.y1; y++) {
+      for (uint32_t x = r.x0; x < r.x1; x++) {
+        uint8_t *e = entries + ((size_t)y * side + x) * 4;
+        int32_t slot = (x < tiles_x && y < tiles_y) ? vt->residency[l][(size_t)y * tiles_x + x] : LU_VT_NOT_RESIDENT;
+        if (slot >= 0) {
+          e[0] = (uint8_t)(slot % vt->cache_side);
+          e[1] = (uint8_t)(slot / vt->cache_side);
+          e[2] = (uint8_t)l;
+          e[3] = 255;
+        } else if (l + 1 < (int)vt->header.num_levels) {
+          uint32_t parent_side = side / 2;
+          memcpy(e, vt->page_entries[l + 1] + ((size_t)(y / 2) * parent_side + x / 2) * 4, 4);
+        }
+      }
+    }
+
+    if (!bound) {
+      glBindTexture(GL_TEXTURE_2D, vt->page_table);
+      glGetIntegerv(GL_UNPACK_ALIGNMENT, &old_alignment);
+      glGetIntegerv(GL_UNPACK_ROW_LENGTH, &old_row_length);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+      bound = true;
+    }
+    // Rows of the rectangle are side entries apart in page_entries
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, side);
+    GLsizei w = r.x1 - r.x0, h = r.y1 - r.y0;
+    glTexSubImage2D(GL_TEXTURE_2D, l, r.x0, r.y0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, entries + ((size_t)r.y0 * side + r.x0) * 4);
+    vt->stats.upload_bytes += (size_t)w * h * 4;
+    vt->stats.total_upload_bytes += (size_t)w * h * 4;
+    vt->page_dirty[l] = (lu_VTRect){0};
+  }
+  if (bound) {
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, old_row_length);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, old_alignment);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+}
+
+// Where a tile's residency is kept, its cache slot or one of the LU_VT_* states
+static int32_t *lu_vt_tile_state(lu_VirtualTexture *vt, uint64_t key) {
+  int level, x, y;
+  lu_vt_unkey(key, &level, &x, &y);
+  uint32_t tiles_x, tiles_y;
+  lu_vt_level_tiles(&vt->header, level, &tiles_x, &tiles_y);
+  return &vt->residency[level][(size_t)y * tiles_x + x];
+}
+
+void lu_vt_update(lu_VirtualTexture *vt, size_t max_uploads) {
+  LU_INSTRUMENT_SCOPE(LU_STAT_VT_UPDATE);
+  if (!vt) return;
+
+  // Grab whatever the loader has finished
+  pthread_mutex_lock(&vt->mutex);
+  size_t count = vt->done_count, capacity = vt->done_capacity, kept = 0;
+  lu_VTTile *done = vt->done;
+  vt->done = NULL;
+  vt->done_count = 0;
+  vt->done_capacity = 0;
+  pthread_mutex_unlock(&vt->mutex);
+
+  for (size_t i = 0; i < count; i++) {
+    if (done[i].pixels && max_uploads != 0 && vt->stats.uploads >= max_uploads) {
+      // Over budget, keep it for the next update rather than reading it from disk again
+      done[kept++] = done[i];
+      continue;
+    }
+    int level, x, y;
+    lu_vt_unkey(done[i].key, &level, &x, &y);
+    int32_t *state = lu_vt_tile_state(vt, done[i].key);
+
+    int slot = done[i].pixels ? lu_vt_find_slot(vt) : -1;
+    if (slot < 0) {
+      // Failed to load or the cache is full of tiles this frame needs, drop it so it gets requested again
+      *state = LU_VT_NOT_RESIDENT;
+      free(done[i].pixels);
+      continue;
+    }
+
+    lu_VTSlot *s = &vt->slots[slot];
+    if (s->level >= 0) {
+      uint32_t old_tiles_x, old_tiles_y;
+      lu_vt_level_tiles(&vt->header, s->level, &old_tiles_x, &old_tiles_y);
+      vt->residency[s->level][(size_t)s->y * old_tiles_x + s->x] = LU_VT_NOT_RESIDENT;
+      lu_vt_mark_dirty(vt, s->level, s->x, s->y);
+      vt->stats.evictions++;
+    }
+    lu_vt_upload_tile(vt, slot, done[i].pixels);
+    free(done[i].pixels);
+    *s = (lu_VTSlot){.level = level, .x = x, .y = y, .last_used = vt->frame, .pinned = false};
+    *state = slot;
+    vt->stats.total_upload_bytes += vt->tile_bytes;
+    lu_vt_mark_dirty(vt, level, x, y);
+  }
+
+  // Put the kept tiles back in front of anything the loader finished meanwhile, so they go up first next time
+  if (kept > 0) {
+    pthread_mutex_lock(&vt->mutex);
+    lu_VTTile *bigger = kept + vt->done_count > capacity ? realloc(done, sizeof(lu_VTTile) * (kept + vt->done_count)) : done;
+    if (!bigger) {
+      lu_log(LU_LOG_ERROR, "(lu_vt_update): Failed to allocate memory, dropping %zu loaded tiles.\n", kept);
+      for (size_t i = 0; i < kept; i++) {
+        *lu_vt_tile_state(vt, done[i].key) = LU_VT_NOT_RESIDENT;
+        free(done[i].pixels);
+      }
+      free(done);
+      pthread_mutex_unlock(&vt->mutex);
+      lu_vt_update_page_table(vt);
+      return;
+    }
+    done = bigger;
+    if (kept + vt->done_count > capacity) capacity = kept + vt->done_count;
+    if (vt->done_count) memcpy(done + kept, vt->done, sizeof(lu_VTTile) * vt->done_count);
+    free(vt->done);
+    vt->done = done;
+    vt->done_count += kept;
+    vt->done_capacity = capacity;
+    pthread_mutex_unlock(&vt->mutex);
+  } else {
+    free(done);
+  }
+
+  lu_vt_update_page_table(vt);
+}
+
+void lu_vt_bind(lu_VirtualTexture *vt, GLuint shader_program, GLuint page_table_unit, GLuint cache_unit) {
+  if (!vt) return;
+  glUseProgram(shader_program);
+  glActiveTexture(GL_TEXTURE0 + page_table_unit);
+  glBindTexture(GL_TEXTURE_2D, vt->page_table);
+  glActiveTexture(GL_TEXTURE0 + cache_unit);
+  glBindTexture(GL_TEXTURE_2D, vt->cache);
+  glActiveTexture(GL_TEXTURE0);
+
+  // The pyramid is a power of two number of tiles across, so image uvs need scaling to cover only the real part of it
+  float pyramid_size = (float)vt->header.pyramid_tiles * vt->header.tile_size;
+  glUniform1i(glGetUniformLocation(shader_program, "lu_vt_page_table"), page_table_unit);
+  glUniform1i(glGetUniformLocation(shader_program, "lu_vt_cache"), cache_unit);
+  glUniform4f(glGetUniformLocation(shader_program, "lu_vt_params"), (float)vt->header.pyramid_tiles, (float)vt->cache_side, vt->header.width / pyramid_size, vt->header.height / pyramid_size);
+}
+
+lu_VTStats lu_vt_get_stats(const lu_VirtualTexture *vt) {
+  lu_VTStats stats = {0};
+  if (vt) stats = vt->stats;
+  return stats;
+}
+
+// Texture manager
+
+typedef struct {
+  bool used;            // Slot holds a texture
+  lu_Image image;       // Decoded copy, kept so evicted textures can come back without touching the disk
+  unsigned int flags;
+  GLuint texture;       // 0 while evicted
+  int dropped_levels;   // How many of the top mip levels are currently missing
+  size_t bytes;         // Current GPU size, 0 while evicted
+  uint64_t last_used;   // Value of the manager's use counter when it was last touched
+  uint64_t used_frame;
+} lu_ManagedTexture;
+
+struct lu_TextureManager {
+  lu_ManagedTexture *textures;
+  size_t num_textures, capacity;
+  uint64_t uses, frame;
+  lu_TextureManagerStats stats;
+};
+
+// Bytes per pixel on the GPU, not counting any driver padding
+static size_t lu_texel_size(int channels, GLenum type) {
+  if (type == GL_HALF_FLOAT && channels == 3) return 4; // GL_R11F_G11F_B10F
+  return channels * lu_type_size(type);
+}
+
+// Bytes used by a full mip chain starting at width x height
+static size_t lu_mip_chain_bytes(int width, int height, size_t texel_size) {
+  size_t bytes = 0;
+  while (true) {
+    bytes += (size_t)width * height * texel_size;
+    if (width == 1 && height == 1) break;
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+  }
+  return bytes;
+}
+
+static int lu_mip_count(int width, int height) {
+  int levels = 1;
+  while (width > 1 || height > 1) {
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+    levels++;
+  }
+  return levels;
+}
+
+static size_t lu_managed_texture_bytes(const lu_ManagedTexture *t, int dropped_levels) {
+  int w = t->image.width >> dropped_levels, h = t->image.height >> dropped_levels;
+  return lu_mip_chain_bytes(w > 0 ? w : 1, h > 0 ? h : 1, lu_texel_size(t->image.channels, t->image.type));
+}
+
+lu_TextureManager *lu_texture_manager_create(size_t budget_bytes) {
+  lu_TextureManager *manager = calloc(1, sizeof(lu_TextureManager));
+  manager->stats.budget_bytes = budget_bytes;
+  return manager;
+}
+
+void lu_texture_manager_delete(lu_TextureManager *manager) {
+  if (!manager) return;
+  for (size_t i = 0; i < manager->num_textures; i++) {
+    lu_ManagedTexture *t = &manager->textures[i];
+    if (!t->used) continue;
+    if (t->texture) glDeleteTextures(1, &t->texture);
+    lu_image_free(&t->image);
+  }
+  free(manager->textures);
+  free(manager);
+}
+
+// Uploads the full resolution texture from the decoded copy
+static void lu_managed_texture_restore(lu_TextureManager *manager, lu_ManagedTexture *t) {
+  if (t->texture) {
+    glDeleteTextures(1, &t->texture);
+    manager->stats.resident_bytes -= t->bytes;
+  }
+  t->texture = lu_texture_from_image(&t->image, t->flags);
+  t->dropped_levels = 0;
+  t->bytes = lu_managed_texture_bytes(t, 0);
+  manager->stats.resident_bytes += t->bytes;
+}
+
+static void lu_managed_texture_evict(lu_TextureManager *manager, lu_ManagedTexture *t) {
+  glDeleteTextures(1, &t->texture);
+  t->texture = 0;
+  manager->stats.resident_bytes -= t->bytes;
+  t->bytes = 0;
+  manager->stats.evictions++;
+}
+
+// Replaces a texture with a copy missing its top mip level, copying the remaining levels on the GPU.
+// Returns false if that can't be done, in which case the texture is left alone.
+static bool lu_managed_texture_drop_level(lu_TextureManager *manager, lu_ManagedTexture *t) {
+  int w = t->image.width >> (t->dropped_levels + 1), h = t->image.height >> (t->dropped_levels + 1);
+  // glCopyImageSubData is GL 4.3, and there is no point going below 1 pixel
+  if (!GLEW_VERSION_4_3 || (w < 1 && h < 1)) return false;
+  if (w < 1) w = 1;
+  if (h < 1) h = 1;
+
+  GLint internal_format;
+  GLenum format;
+  GLint swizzle[4];
+  lu_texture_format(t->image.channels, t->image.type, (t->flags & LU_TEXTURE_SRGB) != 0, &internal_format, &format, swizzle);
+
+  GLuint smaller;
+  glGenTextures(1, &smaller);
+  glBindTexture(GL_TEXTURE_2D, smaller);
+  lu_texture_parameters(t->image.channels, swizzle, t->flags);
+  // Every level has to exist before copying, glCopyImageSubData refuses incomplete textures
+  int levels = lu_mip_count(w, h);
+  for (int l = 0, lw = w, lh = h; l < levels; l++) {
+    glTexImage2D(GL_TEXTURE_2D, l, internal_format, lw, lh, 0, format, t->image.type, NULL);
+    lw = lw > 1 ? lw / 2 : 1;
+    lh = lh > 1 ? lh / 2 : 1;
+  }
+  for (int l = 0, lw = w, lh = h; l < levels; l++) {
+    glCopyImageSubData(t->texture, GL_TEXTURE_2D, l + 1, 0, 0, 0, smaller, GL_TEXTURE_2D, l, 0, 0, 0, lw, lh, 1);
+    lw = lw > 1 ? lw / 2 : 1;
+    lh = lh > 1 ? lh / 2 : 1;
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glDeleteTextures(1, &t->texture);
+
+  t->texture = smaller;
+  t->dropped_levels++;
+  manager->stats.resident_bytes -= t->bytes;
+  t->bytes = lu_managed_texture_bytes(t, t->dropped_levels);
+  manager->stats.resident_bytes += t->bytes;
+  manager->stats.reductions++;
+  return true;
+}
+
+// Shrinks or evicts least recently used textures until the budget is met.
+// Textures used this frame are left alone, since their names may already be in use.
+static void lu_texture_manager_enforce(lu_TextureManager *manager) {
+  while (manager->stats.resident_bytes > manager->stats.budget_bytes) {
+    lu_ManagedTexture *victim = NULL;
+    for (size_t i = 0; i < manager->num_textures; i++) {
+      lu_ManagedTexture *t = &manager->textures[i];
+      if (!t->used || !t->texture || t->used_frame == manager->frame) continue;
+      if (!victim || t->last_used < victim->last_used) victim = t;
+    }
+    if (!victim) return; // Everything resident is in use, nothing can go
+
+    // Take the big top levels off first, and only evict completely once it's down to a few pixels
+    bool small = (victim->image.width >> victim->dropped_levels) <= LU_TEXTURE_MANAGER_MIN_SIZE && (victim->image.height >> victim->dropped_levels) <= LU_TEXTURE_MANAGER_MIN_SIZE;
+    if (small || !lu_managed_texture_drop_level(manager, victim)) lu_managed_texture_evict(manager, victim);
+  }
+}
+
+int lu_texture_manager_load(lu_TextureManager *manager, const char *texture_location, unsigned int flags) {
+  if (!manager) return -1;
+
+  // Find a free slot
+  size_t index = manager->num_textures;
+  for (size_t i = 0; i < manager->num_textures; i++) {
+    if (!manager->textures[i].used) {
+      index = i;
+      break;
+    }
+  }
+  if (index == manager->num_textures) {
+    if (manager->num_textures == manager->capacity) {
+      manager->capacity = manager->capacity ? manager->capacity * 2 : 16;
+      manager->textures = realloc(manager->textures, sizeof(lu_ManagedTexture) * manager->capacity);
+    }
+    manager->num_textures++;
+  }
+
+  lu_ManagedTexture *t = &manager->textures[index];
+  memset(t, 0, sizeof(lu_ManagedTexture));
+  if (!lu_image_load(texture_location, flags, &t->image)) {
+    lu_log(LU_LOG_ERROR, "(lu_texture_manager_load): Couldn't load %s, returning -1.\n", texture_location);
+    return -1;
+  }
+  // Mip levels are what lets the manager shrink textures instead of throwing them away
+  t->flags = flags | LU_TEXTURE_MIPMAPS;
+  t->used = true;
+  t->last_used = ++manager->uses;
+  t->used_frame = manager->frame;
+  lu_managed_texture_restore(manager, t);
+  manager->stats.cache_bytes += lu_image_bytes(&t->image);
+  lu_texture_manager_enforce(manager);
+  return (int)index;
+}
+
+void lu_texture_manager_unload(lu_TextureManager *manager, int handle) {
+  if (!manager || handle < 0 || (size_t)handle >= manager->num_textures) return;
+  lu_ManagedTexture *t = &manager->textures[handle];
+  if (!t->used) return;
+  if (t->texture) {
+    glDeleteTextures(1, &t->texture);
+    manager->stats.resident_bytes -= t->bytes;
+  }
+  manager->stats.cache_bytes -= lu_image_bytes(&t->image);
+  lu_image_free(&t->image);
+  t->used = false;
+}
+
+GLuint lu_texture_manager_use(lu_TextureManager *manager, int handle) {
+  if (!manager || handle < 0 || (size_t)handle >= manager->num_textures) return 0;
+  lu_ManagedTexture *t = &manager->textures[handle];
+  if (!t->used) return 0;
+  t->last_used = ++manager->uses;
+  t->used_frame = manager->frame;
+  if (!t->texture || t->dropped_levels > 0) {
+    lu_managed_texture_restore(manager, t);
+    manager->stats.reloads++;
+    lu_texture_manager_enforce(manager);
+  }
+  return t->texture;
+}
+
+void lu_texture_manager_begin_frame(lu_TextureManager *manager) {
+  if (!manager) return;
+  manager->frame++;
+}
+
+void lu_texture_manager_set_budget(lu_TextureManager *manager, size_t budget_bytes) {
+  if (!manager) return;
+  manager->stats.budget_bytes = budget_bytes;
+  lu_texture_manager_enforce(manager);
+}
+
+lu_TextureManagerStats lu_texture_manager_get_stats(const lu_TextureManager *manager) {
+  lu_TextureManagerStats stats = {0};
+  if (!manager) return stats;
+  stats = manager->stats;
+  for (size_t i = 0; i < manager->num_textures; i++) {
+    const lu_ManagedTexture *t = &manager->textures[i];
+    if (!t->used) continue;
+    stats.num_textures++;
+    if (!t->texture)
+      stats.num_evicted++;
+    else if (t->dropped_levels > 0)
+      stats.num_reduced++;
+    else
+      stats.num_resident++;
+  }
+  return stats;
+}
+
+// Texture registry
+
+typedef struct {
+  GLuint texture;
+  unsigned int flags;
+  size_t refs;
+  size_t bytes;
+  // Every path string that leads to this texture, the first one is the canonical path
+  char **keys;
+  size_t num_keys;
+} lu_TextureRecord;
+
+// Indexes from (path, flags) to record and from texture name back to its record
+static struct {
+  lu_Index paths, names;
+  lu_TextureRegistryStats stats;
+} lu_registry;
+
+static uint64_t lu_hash_path(const char *path, unsigned int flags) {
+  return lu_hash_bytes(lu_hash_bytes(LU_HASH_SEED, path, strlen(path)), &flags, sizeof(flags));
+}
+
+static lu_TextureRecord *lu_registry_find_path(const char *path, unsigned int flags, uint64_t hash) {
+  for (lu_IndexSlot *slot = lu_index_find(&lu_registry.paths, hash); slot; slot = lu_index_find_next(&lu_registry.paths, slot)) {
+    lu_TextureRecord *record = (lu_TextureRecord *)slot->value;
+    if (record->flags != flags) continue;
+    for (size_t i = 0; i < record->num_keys; i++) {
+      if (strcmp(record->keys[i], path) == 0) return record;
+    }
+  }
+  return NULL;
+}
+
+static lu_IndexSlot *lu_registry_find_name(GLuint texture) {
+  uint64_t hash = lu_hash_u32(texture);
+  for (lu_IndexSlot *slot = lu_index_find(&lu_registry.names, hash); slot; slot = lu_index_find_next(&lu_registry.names, slot)) {
+    if (((lu_TextureRecord *)slot->value)->texture == texture) return slot;
+  }
+  return NULL;
+}
+
+// Remembers another path string for a record
+static void lu_registry_add_key(lu_TextureRecord *record, const char *path, uint64_t hash) {
+  char *key = strdup(path);
+  record->keys = realloc(record->keys, sizeof(char *) * (record->num_keys + 1));
+  record->keys[record->num_keys++] = key;
+  lu_index_insert(&lu_registry.paths, hash, (uintptr_t)record);
+}
+
+// The key a spelling of a path is remembered by. Relative spellings mean another file after a chdir, so they get the working directory in
+// front (in joined). NULL if the working directory can't be had, which leaves that spelling out of the fast path.
+static const char *lu_registry_spelling(const char *path, char *joined, size_t joined_size) {
+  if (path[0] == '/') return path;
+  if (!getcwd(joined, joined_size)) return NULL;
+  size_t len = strlen(joined);
+  if (snprintf(joined + len, joined_size - len, "/%s", path) >= (int)(joined_size - len)) return NULL;
+  return joined;
+}
+
+GLuint lu_texture_acquire(const char *texture_location, unsigned int flags) {
+  if (!texture_location) return 0;
+  lu_registry.stats.acquires++;
+
+  // Fast path, this exact string has been seen before from the same working directory
+  char joined[PATH_MAX];
+  const char *spelling = lu_registry_spelling(texture_location, joined, sizeof(joined));
+  uint64_t hash = spelling ? lu_hash_path(spelling, flags) : 0;
+  lu_TextureRecord *record = spelling ? lu_registry_find_path(spelling, flags, hash) : NULL;
+  if (record) {
+    record->refs++;
+    lu_registry.stats.duplicates++;
+    lu_registry.stats.bytes_saved += record->bytes;
+    return record->texture;
+  }
+
+  // Otherwise it might be another spelling of a path that's already loaded
+  char *canonical = realpath(texture_location, NULL);
+  if (canonical == NULL) {
+    lu_log(LU_LOG_ERROR, "(lu_texture_acquire): Could not resolve path %s, returning 0.\n", texture_location);
+    return 0;
+  }
+  uint64_t canonical_hash = lu_hash_path(canonical, flags);
+  record = lu_registry_find_path(canonical, flags, canonical_hash);
+  if (record) {
+    record->refs++;
+    lu_registry.stats.duplicates++;
+    lu_registry.stats.bytes_saved += record->bytes;
+    // Remember this spelling too, so next time it takes the fast path
+    if (spelling) lu_registry_add_key(record, spelling, hash);
+    free(canonical);
+    return record->texture;
+  }
+
+  // First time, actually load it
+  lu_Image image;
+  if (!lu_image_load(canonical, flags, &image)) {
+    lu_log(LU_LOG_ERROR, "(lu_texture_acquire): Couldn't load %s, returning 0.\n", canonical);
+    free(canonical);
+    return 0;
+  }
+  record = calloc(1, sizeof(lu_TextureRecord));
+  record->texture = lu_texture_from_image(&image, flags);
+  lu_label_object(GL_TEXTURE, record->texture, canonical);
+  record->flags = flags;
+  record->refs = 1;
+  size_t texel_size = lu_texel_size(image.channels, image.type);
+  record->bytes = (flags & LU_TEXTURE_MIPMAPS) ? lu_mip_chain_bytes(image.width, image.height, texel_size) : (size_t)image.width * image.height * texel_size;
+  lu_image_free(&image);
+
+  lu_registry_add_key(record, canonical, canonical_hash);
+  if (spelling && strcmp(canonical, spelling) != 0) lu_registry_add_key(record, spelling, hash);
+  lu_index_insert(&lu_registry.names, lu_hash_u32(record->texture), (uintptr_t)record);
+  free(canonical);
+
+  lu_registry.stats.loads++;
+  lu_registry.stats.live_textures++;
+  lu_registry.stats.live_bytes += record->bytes;
+  return record->texture;
+}
+
+void lu_texture_release(GLuint texture) {
+  lu_IndexSlot *name = lu_registry_find_name(texture);
+  if (!name) {
+    lu_log(LU_LOG_ERROR, "(lu_texture_release): Texture %u didn't come from lu_texture_acquire.\n", texture);
+    return;
+  }
+  lu_TextureRecord *record = (lu_TextureRecord *)name->value;
+  if (--record->refs > 0) return;
+
+  // Last reference, forget every path that led here and delete the texture
+  for (size_t i = 0; i < record->num_keys; i++) {
+    lu_IndexSlot *slot = lu_index_find_value(&lu_registry.paths, lu_hash_path(record->keys[i], record->flags), (uintptr_t)record);
+    if (slot) lu_index_remove(&lu_registry.paths, slot);
+    free(record->keys[i]);
+  }
+  lu_index_remove(&lu_registry.names, name);
+  glDeleteTextures(1, &record->texture);
+  lu_registry.stats.live_textures--;
+  lu_registry.stats.live_bytes -= record->bytes;
+  free(record->keys);
+  free(record);
+}
+
+lu_TextureRegistryStats lu_texture_registry_get_stats(void) {
+  return lu_registry.stats;
+}
+
+// Separable programs and program pipelines
+
+GLbitfield lu_shader_stage_bit(GLenum shader_type) {
+  switch (shader_type) {
+  case GL_VERTEX_SHADER:
+    return GL_VERTEX_SHADER_BIT;
+  case GL_FRAGMENT_SHADER:
+    return GL_FRAGMENT_SHADER_BIT;
+  case GL_GEOMETRY_SHADER:
+    return GL_GEOMETRY_SHADER_BIT;
+  case GL_TESS_CONTROL_SHADER:
+    return GL_TESS_CONTROL_SHADER_BIT;
+  case GL_TESS_EVALUATION_SHADER:
+    return GL_TESS_EVALUATION_SHADER_BIT;
+  case GL_COMPUTE_SHADER:
+    return GL_COMPUTE_SHADER_BIT;
+  default:
+    return 0;
+  }
+}
+
+lu_StageProgram lu_create_stage_program(const char *shader_file_location) {
+  lu_StageProgram out = {0};
+  if (!GLEW_VERSION_4_1 && !GLEW_ARB_separate_shader_objects) {
+    lu_log(LU_LOG_ERROR, "(lu_create_stage_program): Separable programs need GL 4.1 or ARB_separate_shader_objects.\n");
+    return out;
+  }
+  GLuint shader = lu_compile_shader(shader_file_location);
+  if (shader == 0) {
+    lu_log(LU_LOG_ERROR, "(lu_create_stage_program): Couldn't create program, compilation of shader %s failed.\n", shader_file_location);
+    return out;
+  }
+
+  GLuint program = glCreateProgram();
+  glProgramParameteri(program, GL_PROGRAM_SEPARABLE, GL_TRUE);
+  glAttachShader(program, shader);
+  glLinkProgram(program);
+  lu_shader_stats.links++;
+  glDetachShader(program, shader);
+  glDeleteShader(shader);
+
+  // Check for linking errors
+  GLint success;
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  if (!success) {
+    char log[1024];
+    glGetProgramInfoLog(program, sizeof(log), NULL, log);
+    lu_log(LU_LOG_ERROR, "(lu_create_stage_program): Linking failed for %s:\n%s", shader_file_location, log);
+    glDeleteProgram(program);
+    return out;
+  }
+  lu_label_object(GL_PROGRAM, program, shader_file_location);
+
+  out.program = program;
+  out.stages = lu_shader_stage_bit(lu_shader_type(shader_file_location));
+  return out;
+}
+
+typedef struct {
+  GLuint programs[LU_MAX_STAGES]; // Program for each stage, indexed by the stage bit's position
+  GLuint pipeline;
+} lu_PipelineEntry;
+
+// Cache of pipelines keyed by the program used for each stage, the index points at heap allocated entries
+static lu_Index lu_pipelines;
+
+GLuint lu_get_program_pipeline(size_t num_programs, const lu_StageProgram *programs) {
+  lu_PipelineEntry key = {0};
+  for (size_t i = 0; i < num_programs; i++) {
+    // A program can cover several stages, put it in the key once for each
+    for (int s = 0; s < LU_MAX_STAGES; s++) {
+      if (programs[i].stages & (1u << s)) key.programs[s] = programs[i].program;
+    }
+  }
+  uint64_t hash = lu_hash_bytes(LU_HASH_SEED, key.programs, sizeof(key.programs));
+  lu_shader_stats.pipeline_lookups++;
+
+  for (lu_IndexSlot *slot = lu_index_find(&lu_pipelines, hash); slot; slot = lu_index_find_next(&lu_pipelines, slot)) {
+    lu_PipelineEntry *entry = (lu_PipelineEntry *)slot->value;
+    if (memcmp(entry->programs, key.programs, sizeof(key.programs)) == 0) return entry->pipeline;
+  }
+
+  // Not seen this combination yet, make it
+  glGenProgramPipelines(1, &key.pipeline);
+  for (size_t i = 0; i < num_programs; i++) {
+    glUseProgramStages(key.pipeline, programs[i].stages, programs[i].program);
+  }
+  glValidateProgramPipeline(key.pipeline);
+  GLint valid;
+  glGetProgramPipelineiv(key.pipeline, GL_VALIDATE_STATUS, &valid);
+  if (!valid) {
+    char log[1024];
+    glGetProgramPipelineInfoLog(key.pipeline, sizeof(log), NULL, log);
+    lu_log(LU_LOG_ERROR, "(lu_get_program_pipeline): Pipeline validation failed:\n%s", log);
+    glDeleteProgramPipelines(1, &key.pipeline);
+    return 0;
+  }
+  lu_PipelineEntry *entry = malloc(sizeof(lu_PipelineEntry));
+  if (!entry || !lu_index_insert(&lu_pipelines, hash, (uintptr_t)entry)) {
+    lu_log(LU_LOG_ERROR, "(lu_get_program_pipeline): Out of memory caching the pipeline, returning 0.\n");
+    free(entry);
+    glDeleteProgramPipelines(1, &key.pipeline);
+    return 0;
+  }
+  *entry = key;
+  lu_shader_stats.pipelines++;
+  return key.pipeline;
+}
+
+void lu_bind_program_pipeline(GLuint pipeline) {
+  // A program bound with glUseProgram takes priority over the pipeline, so get rid of it
+  glUseProgram(0);
+  glBindProgramPipeline(pipeline);
+}
+
+void lu_clear_program_pipelines(void) {
+  for (size_t i = 0; i < lu_pipelines.capacity; i++) {
+    if (lu_pipelines.slots[i].state != LU_SLOT_USED) continue;
+    lu_PipelineEntry *entry = (lu_PipelineEntry *)lu_pipelines.slots[i].value;
+    glDeleteProgramPipelines(1, &entry->pipeline);
+    free(entry);
+  }
+  lu_index_free(&lu_pipelines);
+}
+
+void lu_stage_program_delete(lu_StageProgram *program) {
+  if (!program || program->program == 0) return;
+  // Pipelines are looked up by program name, which GL can hand out again, so every pipeline using this program has to go with it
+  for (size_t i = 0; i < lu_pipelines.capacity; i++) {
+    if (lu_pipelines.slots[i].state != LU_SLOT_USED) continue;
+    lu_PipelineEntry *entry = (lu_PipelineEntry *)lu_pipelines.slots[i].value;
+    bool uses_program = false;
+    for (int s = 0; s < LU_MAX_STAGES; s++) uses_program |= entry->programs[s] == program->program;
+    if (!uses_program) continue;
+    glDeleteProgramPipelines(1, &entry->pipeline);
+    free(entry);
+    lu_index_remove(&lu_pipelines, &lu_pipelines.slots[i]);
+  }
+  glDeleteProgram(program->program);
+  *program = (lu_StageProgram){0};
+}
+
+lu_ShaderStats lu_get_shader_stats(void) {
+  return lu_shader_stats;
+}
+
+// Shader variants
+
+typedef struct {
+  char *key;            // Path and defines, separated by newlines
+  uint64_t key_hash;
+  uint64_t source_hash; // Hash of the preprocessed source
+  char *source;         // The preprocessed source, kept by variants that compiled so a hash match can be checked before sharing
+  size_t source_len;
+  GLenum type;
+  GLuint shader;
+  size_t requests;
+  int compiled_by;      // Index of the variant that actually compiled the shader, itself unless it was deduplicated
+  double compile_ms;
+} lu_ShaderVariant;
+
+static struct {
+  lu_ShaderVariant *variants;
+  size_t num_variants, capacity;
+  // Indexes into variants, by key and by preprocessed source
+  lu_Index by_key, by_source;
+} lu_variants;
+
+static double lu_elapsed_ms(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+GLuint lu_get_shader_variant(const char *shader_file_location, size_t num_defines, const char *const *defines) {
+  GLenum shader_type = lu_shader_type(shader_file_location);
+  if (shader_type == 0) {
+    lu_log(LU_LOG_ERROR, "(lu_get_shader_variant): Unsupported extension in %s\n", shader_file_location);
+    return 0;
+  }
+
+  // Look the variant up by its path and defines first, that needs no file access
+  lu_String key = {0};
+  lu_string_append(&key, shader_file_location, strlen(shader_file_location));
+  for (size_t i = 0; i < num_defines; i++) {
+    lu_string_append(&key, "\n", 1);
+    lu_string_append(&key, defines[i], strlen(defines[i]));
+  }
+  uint64_t key_hash = lu_hash_bytes(LU_HASH_SEED, key.data, key.len);
+  for (lu_IndexSlot *slot = lu_index_find(&lu_variants.by_key, key_hash); slot; slot = lu_index_find_next(&lu_variants.by_key, slot)) {
+    lu_ShaderVariant *v = &lu_variants.variants[slot->value];
+    if (strcmp(v->key, key.data) == 0) {
+      v->requests++;
+      free(key.data);
+      return v->shader;
+    }
+  }
+
+  // First request, preprocess it and see if some other variant already produced the same source
+  size_t src_len;
+  char *source = lu_preprocess_shader(shader_file_location, num_defines, defines, &src_len);
+  if (!source) {
+    lu_log(LU_LOG_ERROR, "(lu_get_shader_variant): Failed to preprocess %s\n", shader_file_location);
+    free(key.data);
+    return 0;
+  }
+  uint64_t source_hash = lu_hash_bytes(LU_HASH_SEED, source, src_len) ^ shader_type;
+
+  int compiled_by = -1;
+  GLuint shader = 0;
+  double compile_ms = 0;
+  for (lu_IndexSlot *slot = lu_index_find(&lu_variants.by_source, source_hash); slot; slot = lu_index_find_next(&lu_variants.by_source, slot)) {
+    lu_ShaderVariant *v = &lu_variants.variants[slot->value];
+    if (v->compiled_by == (int)slot->value && v->type == shader_type && v->source_len == src_len && memcmp(v->source, source, src_len) == 0) {
+      compiled_by = v->compiled_by;
+      shader = v->shader;
+      break;
+    }
+  }
+  if (compiled_by < 0) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    shader = lu_compile_shader_source(shader_type, source, src_len, key.data);
+    compile_ms = lu_elapsed_ms(&start);
+  } else {
+    free(source);
+    source = NULL;
+  }
+  if (shader == 0) {
+    free(source);
+    free(key.data);
+    return 0;
+  }
+
+  if (lu_variants.num_variants == lu_variants.capacity) {
+    lu_variants.capacity = lu_variants.capacity ? lu_variants.capacity * 2 : 32;
+    lu_variants.variants = realloc(lu_variants.variants, sizeof(lu_ShaderVariant) * lu_variants.capacity);
+  }
+  size_t index = lu_variants.num_variants++;
+  lu_variants.variants[index] = (lu_ShaderVariant){
+      .key = key.data,
+      .key_hash = key_hash,
+      .source_hash = source_hash,
+      .source = source,
+      .source_len = src_len,
+      .type = shader_type,
+      .shader = shader,
+      .requests = 1,
+      .compiled_by = compiled_by < 0 ? (int)index : compiled_by,
+      .compile_ms = compile_ms};
+  lu_index_insert(&lu_variants.by_key, key_hash, index);
+  lu_index_insert(&lu_variants.by_source, source_hash, index);
+  return shader;
+}
+
+GLuint lu_link_shader_program(size_t num_shaders, const GLuint *shaders) {
+  GLuint shader_program = glCreateProgram();
+  for (size_t i = 0; i < num_shaders; i++) {
+    glAttachShader(shader_program, shaders[i]);
+  }
+  glLinkProgram(shader_program);
+  lu_shader_stats.links++;
+  // Detach so the shaders can still be deleted later without the program keeping them alive
+  for (size_t i = 0; i < num_shaders; i++) {
+    glDetachShader(shader_program, shaders[i]);
+  }
+
+  // Check for linking errors
+  GLint success;
+  glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
+  if (!success) {
+    char log[1024];
+    glGetProgramInfoLog(shader_program, sizeof(log), NULL, log);
+    lu_log(LU_LOG_ERROR, "(lu_link_shader_program): Shader linking failed:\n%s", log);
+    glDeleteProgram(shader_program);
+    return 0;
+  }
+  return shader_program;
+}
+
+void lu_shader_variant_report(FILE *out) {
+  if (!out) return;
+  size_t compiled = 0;
+  double total_ms = 0;
+  for (size_t i = 0; i < lu_variants.num_variants; i++) {
+    lu_ShaderVariant *v = &lu_variants.variants[i];
+    // Print the key on one line, with the defines in brackets
+    const char *defines = strchr(v->key, '\n');
+    int path_len = defines ? (int)(defines - v->key) : (int)strlen(v->key);
+    fprintf(out, "%.*s [", path_len, v->key);
+    for (const char *c = defines ? defines + 1 : ""; *c; c++) fputc(*c == '\n' ? ' ' : *c, out);
+    if (v->compiled_by == (int)i) {
+      fprintf(out, "]: %zu requests, compiled in %.3f ms\n", v->requests, v->compile_ms);
+      compiled++;
+      total_ms += v->compile_ms;
+    } else {
+      fprintf(out, "]: %zu requests, same source as variant %d\n", v->requests, v->compiled_by);
+    }
+  }
+  fprintf(out, "%zu variants, %zu compiled in %.3f ms\n", lu_variants.num_variants, compiled, total_ms);
+}
+
+void lu_clear_shader_variants(void) {
+  for (size_t i = 0; i < lu_variants.num_variants; i++) {
+    lu_ShaderVariant *v = &lu_variants.variants[i];
+    if (v->compiled_by == (int)i) glDeleteShader(v->shader);
+    free(v->key);
+    free(v->source);
+  }
+  free(lu_variants.variants);
+  lu_index_free(&lu_variants.by_key);
+  lu_index_free(&lu_variants.by_source);
+  memset(&lu_variants, 0, sizeof(lu_variants));
+}
+
+// Compute
+
+static bool lu_has_compute(const char *caller) {
+  if (GLEW_VERSION_4_3 || GLEW_ARB_compute_shader) return true;
+  lu_log(LU_LOG_ERROR, "(%s): Compute shaders need GL 4.3 or ARB_compute_shader.\n", caller);
+  return false;
+}
+
+void lu_dispatch_compute(GLuint shader_program, GLuint groups_x, GLuint groups_y, GLuint groups_z, GLbitfield barriers) {
+  LU_INSTRUMENT_SCOPE(LU_STAT_DISPATCH_COMPUTE);
+  if (!lu_has_compute("lu_dispatch_compute")) return;
+  glUseProgram(shader_program);
+  glDispatchCompute(groups_x, groups_y, groups_z);
+  if (barriers) glMemoryBarrier(barriers);
+}
+
+void lu_dispatch_compute_items(GLuint shader_program, size_t num_items, GLbitfield barriers) {
+  if (!lu_has_compute("lu_dispatch_compute_items")) return;
+  // Round up to whole work groups, the shader has to skip gl_GlobalInvocationID.x >= num_items itself
+  GLint group_size[3] = {0};
+  glGetProgramiv(shader_program, GL_COMPUTE_WORK_GROUP_SIZE, group_size);
+  if (group_size[0] <= 0) {
+    lu_log(LU_LOG_ERROR, "(lu_dispatch_compute_items): Program %u isn't a linked compute program.\n", shader_program);
+    return;
+  }
+  size_t groups = (num_items + group_size[0] - 1) / group_size[0];
+  lu_dispatch_compute(shader_program, (GLuint)groups, 1, 1, barriers);
+}
+
+void lu_memory_barrier(GLbitfield barriers) {
+  glMemoryBarrier(barriers);
+}
+
+// Uniform buffers
+
+// std140 base alignment and size of a single (non-array) member, and how many columns it has
+static bool lu_std140_type(GLenum type, size_t *align, size_t *size, size_t *columns) {
+  *columns = 1;
+  switch (type) {
+  case GL_FLOAT:
+  case GL_INT:
+  case GL_UNSIGNED_INT:
+  case GL_BOOL:
+    *align = 4;
+    *size = 4;
+    return true;
+  case GL_FLOAT_VEC2:
+  case GL_INT_VEC2:
+  case GL_UNSIGNED_INT_VEC2:
+    *align = 8;
+    *size = 8;
+    return true;
+  case GL_FLOAT_VEC3:
+  case GL_INT_VEC3:
+  case GL_UNSIGNED_INT_VEC3:
+    *align = 16;
+    *size = 12;
+    return true;
+  case GL_FLOAT_VEC4:
+  case GL_INT_VEC4:
+  case GL_UNSIGNED_INT_VEC4:
+    *align = 16;
+    *size = 16;
+    return true;
+  // Matrices are arrays of column vectors, and array elements are always 16 byte aligned
+  case GL_FLOAT_MAT3:
+    *align = 16;
+    *size = 12;
+    *columns = 3;
+    return true;
+  case GL_FLOAT_MAT4:
+    *align = 16;
+    *size = 16;
+    *columns = 4;
+    return true;
+  default:
+    return false;
+  }
+}
+
+static size_t lu_round_up(size_t value, size_t align) {
+  return (value + align - 1) / align * align;
+}
+
+lu_UniformLayout lu_uniform_layout_create(size_t num_members, const GLenum *member_types, const size_t *array_counts) {
+  lu_UniformLayout layout = {0};
+  if (num_members > LU_MAX_UNIFORM_MEMBERS) {
+    lu_log(LU_LOG_ERROR, "(lu_uniform_layout_create): %zu members is more than LU_MAX_UNIFORM_MEMBERS (%d).\n", num_members, LU_MAX_UNIFORM_MEMBERS);
+    return layout;
+  }
+  size_t offset = 0;
+  for (size_t i = 0; i < num_members; i++) {
+    size_t align, size, columns;
+    if (!lu_std140_type(member_types[i], &align, &size, &columns)) {
+      lu_log(LU_LOG_ERROR, "(lu_uniform_layout_create): Member %zu has a type std140 layout doesn't know (0x%x).\n", i, member_types[i]);
+      return (lu_UniformLayout){0};
+    }
+    size_t count = (array_counts && array_counts[i] > 0) ? array_counts[i] : 1;
+    bool array = count > 1 || columns > 1;
+    // Arrays (and matrix columns) round every element up to a vec4
+    size_t element_stride = array ? lu_round_up(size, 16) : size;
+    if (array) align = 16;
+
+    offset = lu_round_up(offset, align);
+    layout.offsets[i] = offset;
+    layout.types[i] = member_types[i];
+    layout.counts[i] = count;
+    layout.element_sizes[i] = size;
+    layout.element_strides[i] = element_stride;
+    layout.columns[i] = columns;
+    offset += (array ? element_stride * columns * count : size);
+  }
+  layout.num_members = num_members;
+  // The block as a whole is padded out to a vec4
+  layout.size = lu_round_up(offset, 16);
+  return layout;
+}
+
+void lu_uniform_layout_write(const lu_UniformLayout *layout, void *block, size_t member, const void *value) {
+  if (!layout || !block || !value || member >= layout->num_members) return;
+  // value is tightly packed C data, spread it out to std140 positions one vector at a time
+  uint8_t *dst = (uint8_t *)block + layout->offsets[member];
+  const uint8_t *src = value;
+  size_t vectors = layout->counts[member] * layout->columns[member];
+  if (vectors == 1 || layout->element_sizes[member] == layout->element_strides[member]) {
+    memcpy(dst, src, layout->element_sizes[member] * vectors);
+    return;
+  }
+  for (size_t i = 0; i < vectors; i++) {
+    memcpy(dst + i * layout->element_strides[member], src + i * layout->element_sizes[member], layout->element_sizes[member]);
+  }
+}
+
+lu_UniformRing lu_uniform_ring_create(size_t bytes_per_frame, int frames_in_flight) {
+  lu_UniformRing ring = {0};
+  if (frames_in_flight < 1) frames_in_flight = 1;
+  if (frames_in_flight > LU_MAX_FRAMES_IN_FLIGHT) frames_in_flight = LU_MAX_FRAMES_IN_FLIGHT;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &ring.alignment);
+  if (ring.alignment < 1) ring.alignment = 256;
+
+  ring.frames_in_flight = frames_in_flight;
+  ring.frame_size = lu_round_up(bytes_per_frame, ring.alignment);
+  ring.size = ring.frame_size * frames_in_flight;
+  ring.frame = -1;
+
+  glGenBuffers(1, &ring.buffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, ring.buffer);
+  if (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) {
+    // Mapped once for the whole life of the ring, fences stop the CPU writing over a frame the GPU is still reading
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_UNIFORM_BUFFER, ring.size, NULL, flags);
+    ring.mapped = glMapBufferRange(GL_UNIFORM_BUFFER, 0, ring.size, flags);
+    ring.persistent = ring.mapped != NULL;
+  }
+  if (!ring.persistent) {
+    // No persistent mapping, write into a CPU copy and upload each block as it gets bound
+    glBufferData(GL_UNIFORM_BUFFER, ring.size, NULL, GL_STREAM_DRAW);
+    ring.mapped = malloc(ring.size);
+  }
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  return ring;
+}
+
+void lu_uniform_ring_delete(lu_UniformRing *ring) {
+  if (!ring) return;
+  for (int i = 0; i < LU_MAX_FRAMES_IN_FLIGHT; i++) {
+    if (ring->fences[i]) glDeleteSync(ring->fences[i]);
+    ring->fences[i] = 0;
+  }
+  if (ring->persistent) {
+    glBindBuffer(GL_UNIFORM_BUFFER, ring->buffer);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  } else {
+    free(ring->mapped);
+  }
+  ring->mapped = NULL;
+  glDeleteBuffers(1, &ring->buffer);
+  ring->buffer = 0;
+}
+
+void lu_uniform_ring_begin_frame(lu_UniformRing *ring) {
+  if (!ring || !ring->buffer) return;
+  ring->frame = (ring->frame + 1) % ring->frames_in_flight;
+  // Wait until the GPU is done with the last frame that used this part of the ring
+  GLsync fence = ring->fences[ring->frame];
+  if (fence) {
+    while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+    }
+    glDeleteSync(fence);
+    ring->fences[ring->frame] = 0;
+  }
+  ring->head = ring->frame * ring->frame_size;
+}
+
+void lu_uniform_ring_end_frame(lu_UniformRing *ring) {
+  if (!ring || !ring->buffer || ring->frame < 0) return;
+  ring->fences[ring->frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+lu_UniformAlloc lu_uniform_ring_alloc(lu_UniformRing *ring, size_t size) {
+  LU_INSTRUMENT_SCOPE(LU_STAT_UNIFORM_RING_ALLOC);
+  LU_INSTRUMENT_BYTES(size);
+  lu_UniformAlloc alloc = {0};
+  if (!ring || !ring->mapped || ring->frame < 0) return alloc;
+  size_t offset = lu_round_up(ring->head, ring->alignment);
+  if (offset + size > (size_t)(ring->frame + 1) * ring->frame_size) {
+    lu_log(LU_LOG_ERROR, "(lu_uniform_ring_alloc): Out of space for this frame, make the ring bigger than %zu bytes per frame.\n", ring->frame_size);
+    return alloc;
+  }
+  ring->head = offset + size;
+  alloc.data = ring->mapped + offset;
+  alloc.offset = offset;
+  alloc.size = size;
+  return alloc;
+}
+
+void lu_uniform_ring_bind(lu_UniformRing *ring, GLuint binding, lu_UniformAlloc alloc) {
+  if (!ring || !alloc.data) return;
+  if (!ring->persistent) {
+    glBindBuffer(GL_UNIFORM_BUFFER, ring->buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, alloc.offset, alloc.size, alloc.data);
+  } else if (lu_trace_active()) {
+    // GL never sees writes through the persistent mapping, so tell the tracer about them
+    lu_trace_buffer_write(ring->buffer, alloc.offset, alloc.size, alloc.data);
+  }
+  glBindBufferRange(GL_UNIFORM_BUFFER, binding, ring->buffer, alloc.offset, alloc.size);
+}
+
+void lu_bind_uniform_block(GLuint shader_program, const char *block_name, GLuint binding) {
+  GLuint index = glGetUniformBlockIndex(shader_program, block_name);
+  if (index == GL_INVALID_INDEX) {
+    lu_log(LU_LOG_ERROR, "(lu_bind_uniform_block): Program %u has no uniform block called %s.\n", shader_program, block_name);
+    return;
+  }
+  glUniformBlockBinding(shader_program, index, binding);
+}
+
+// Structured buffers
+
+lu_StructuredBuffer lu_structured_buffer_create(size_t stride, size_t count) {
+  lu_StructuredBuffer buf = {0};
+  if (!GLEW_VERSION_4_3 && !GLEW_ARB_shader_storage_buffer_object) {
+    lu_log(LU_LOG_ERROR, "(lu_structured_buffer_create): Shader storage buffers need GL 4.3 or ARB_shader_storage_buffer_object.\n");
+    return buf;
+  }
+  if (stride == 0 || count == 0) return buf;
+  buf.stride = stride;
+  buf.count = count;
+  buf.data = calloc(count, stride);
+  buf.num_pages = (stride * count + LU_STRUCTURED_PAGE_BYTES - 1) / LU_STRUCTURED_PAGE_BYTES;
+  buf.dirty = calloc((buf.num_pages + 63) / 64, sizeof(uint64_t));
+
+  glGenBuffers(1, &buf.buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buf.buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, stride * count, buf.data, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  return buf;
+}
+
+void lu_structured_buffer_delete(lu_StructuredBuffer *buf) {
+  if (!buf) return;
+  free(buf->data);
+  free(buf->dirty);
+  glDeleteBuffers(1, &buf->buffer);
+  memset(buf, 0, sizeof(lu_StructuredBuffer));
+}
+
+void lu_structured_buffer_mark_dirty(lu_StructuredBuffer *buf, size_t first, size_t count) {
+  if (!buf || !buf->data || count == 0 || first >= buf->count) return;
+  if (first + count > buf->count) count = buf->count - first;
+  size_t first_page = first * buf->stride / LU_STRUCTURED_PAGE_BYTES;
+  size_t last_page = ((first + count) * buf->stride - 1) / LU_STRUCTURED_PAGE_BYTES;
+  for (size_t p = first_page; p <= last_page; p++) buf->dirty[p / 64] |= 1ull << (p % 64);
+  buf->any_dirty = true;
+}
+
+void *lu_structured_buffer_get(lu_StructuredBuffer *buf, size_t index) {
+  if (!buf || !buf->data || index >= buf->count) return NULL;
+  lu_structured_buffer_mark_dirty(buf, index, 1);
+  return buf->data + index * buf->stride;
+}
+
+void lu_structured_buffer_set(lu_StructuredBuffer *buf, size_t index, const void *src) {
+  void *dst = lu_structured_buffer_get(buf, index);
+  if (dst && src) memcpy(dst, src, buf->stride);
+}
+
+size_t lu_structured_buffer_upload(lu_StructuredBuffer *buf) {
+  LU_INSTRUMENT_SCOPE(LU_STAT_STRUCTURED_BUFFER_UPLOAD);
+  if (!buf || !buf->any_dirty) return 0;
+  size_t uploaded = 0;
+  size_t total = buf->stride * buf->count;
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buf->buffer);
+  // One glBufferSubData per run of consecutive dirty pages
+  size_t p = 0;
+  while (p < buf->num_pages) {
+    uint64_t word = buf->dirty[p / 64] >> (p % 64);
+    if (word == 0) {
+      p = (p / 64 + 1) * 64; // Skip the rest of a clean word
+      continue;
+    }
+    if (!(word & 1)) {
+      p++;
+      continue;
+    }
+    size_t start = p;
+    while (p < buf->num_pages && (buf->dirty[p / 64] >> (p % 64) & 1)) p++;
+    size_t offset = start * LU_STRUCTURED_PAGE_BYTES;
+    size_t end = p * LU_STRUCTURED_PAGE_BYTES;
+    if (end > total) end = total;
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, end - offset, buf->data + offset);
+    uploaded += end - offset;
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  memset(buf->dirty, 0, sizeof(uint64_t) * ((buf->num_pages + 63) / 64));
+  buf->any_dirty = false;
+  LU_INSTRUMENT_BYTES(uploaded);
+  return uploaded;
+}
+
+void lu_structured_buffer_bind(lu_StructuredBuffer *buf, GLuint binding) {
+  if (!buf) return;
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buf->buffer);
+}
+
+// Vertex layouts
+
+// Every distinct layout that has been created, with the VAO its meshes share.
+// There are only ever a handful, so a list searched by hash is plenty.
+static struct {
+  lu_VertexLayout *layouts;
+  size_t num_layouts, capacity;
+} lu_layout_cache;
+
+static size_t lu_vertex_type_size(GLenum type) {
+  switch (type) {
+  case GL_BYTE:
+  case GL_UNSIGNED_BYTE:
+    return 1;
+  case GL_SHORT:
+  case GL_UNSIGNED_SHORT:
+  case GL_HALF_FLOAT:
+    return 2;
+  case GL_DOUBLE:
+    return 8;
+  default:
+    return 4;
+  }
+}
+
+// Size of one attribute in bytes
+static size_t lu_vertex_attrib_size(const lu_VertexAttrib *attrib) {
+  // Packed formats hold every component in a single 32 bit value
+  if (attrib->type == GL_INT_2_10_10_10_REV || attrib->type == GL_UNSIGNED_INT_2_10_10_10_REV || attrib->type == GL_UNSIGNED_INT_10F_11F_11F_REV) return 4;
+  return lu_vertex_type_size(attrib->type) * attrib->count;
+}
+
+static uint64_t lu_hash_layout(const lu_VertexLayout *layout) {
+  uint64_t hash = LU_HASH_SEED;
+  for (size_t i = 0; i < layout->num_attribs; i++) {
+    const lu_VertexAttrib *a = &layout->attribs[i];
+    uint32_t parts[4] = {(uint32_t)a->count, a->type, (uint32_t)layout->offsets[i], (uint32_t)a->normalized | ((uint32_t)a->integer << 1)};
+    hash = lu_hash_bytes(hash, parts, sizeof(parts));
+  }
+  return hash;
+}
+
+static bool lu_layouts_equal(const lu_VertexLayout *a, const lu_VertexLayout *b) {
+  if (a->num_attribs != b->num_attribs) return false;
+  for (size_t i = 0; i < a->num_attribs; i++) {
+    const lu_VertexAttrib *x = &a->attribs[i], *y = &b->attribs[i];
+    if (x->count != y->count || x->type != y->type || x->normalized != y->normalized || x->integer != y->integer || a->offsets[i] != b->offsets[i]) return false;
+  }
+  return true;
+}
+
+lu_VertexLayout lu_vertex_layout_create(size_t num_attribs, const lu_VertexAttrib *attribs) {
+  lu_VertexLayout layout = {0};
+  if (num_attribs > LU_MAX_VERTEX_ATTRIBS) {
+    lu_log(LU_LOG_ERROR, "(lu_vertex_layout_create): %zu attributes is more than LU_MAX_VERTEX_ATTRIBS (%d).\n", num_attribs, LU_MAX_VERTEX_ATTRIBS);
+    return layout;
+  }
+  if (!GLEW_VERSION_4_3 && !GLEW_ARB_vertex_attrib_binding) {
+    lu_log(LU_LOG_ERROR, "(lu_vertex_layout_create): Shared layouts need GL 4.3 or ARB_vertex_attrib_binding.\n");
+    return layout;
+  }
+  layout.num_attribs = num_attribs;
+  for (size_t i = 0; i < num_attribs; i++) {
+    layout.attribs[i] = attribs[i];
+    layout.offsets[i] = layout.stride;
+    layout.stride += lu_vertex_attrib_size(&attribs[i]);
+  }
+  layout.hash = lu_hash_layout(&layout);
+
+  for (size_t i = 0; i < lu_layout_cache.num_layouts; i++) {
+    lu_VertexLayout *cached = &lu_layout_cache.layouts[i];
+    if (cached->hash == layout.hash && lu_layouts_equal(cached, &layout)) return *cached;
+  }
+
+  // New layout, describe it once in a VAO with every attribute reading from binding 0
+  glGenVertexArrays(1, &layout.VAO);
+  glBindVertexArray(layout.VAO);
+  for (size_t i = 0; i < num_attribs; i++) {
+    // Integer attributes stay integers in the shader (ivec/uvec inputs), everything else is converted to float
+    if (attribs[i].integer)
+      glVertexAttribIFormat(i, attribs[i].count, attribs[i].type, layout.offsets[i]);
+    else
+      glVertexAttribFormat(i, attribs[i].count, attribs[i].type, attribs[i].normalized ? GL_TRUE : GL_FALSE, layout.offsets[i]);
+    glVertexAttribBinding(i, 0);
+    glEnableVertexAttribArray(i);
+  }
+  glBindVertexArray(0);
+
+  if (lu_layout_cache.num_layouts == lu_layout_cache.capacity) {
+    lu_layout_cache.capacity = lu_layout_cache.capacity ? lu_layout_cache.capacity * 2 : 8;
+    lu_layout_cache.layouts = realloc(lu_layout_cache.layouts, sizeof(lu_VertexLayout) * lu_layout_cache.capacity);
+  }
+  lu_layout_cache.layouts[lu_layout_cache.num_layouts++] = layout;
+  return layout;
+}
+
+lu_Mesh lu_mesh_create_shared(const lu_VertexLayout *layout) {
+  lu_Mesh mesh = {0};
+  if (!layout || layout->VAO == 0) {
+    lu_log(LU_LOG_ERROR, "(lu_mesh_create_shared): Invalid layout.\n");
+    return mesh;
+  }
+  mesh.stride = layout->stride;
+  mesh.VAO = layout->VAO;
+  mesh.shared_vao = true;
+  glGenBuffers(1, &mesh.VBO);
+  return mesh;
+}
+
+size_t lu_vertex_layout_count(void) {
+  return lu_layout_cache.num_layouts;
+}
+
+void lu_clear_vertex_layouts(void) {
+  for (size_t i = 0; i < lu_layout_cache.num_layouts; i++) {
+    glDeleteVertexArrays(1, &lu_layout_cache.layouts[i].VAO);
+  }
+  free(lu_layout_cache.layouts);
+  memset(&lu_layout_cache, 0, sizeof(lu_layout_cache));
+}
+
+// Vertex quantization
+
+void lu_octahedral_encode(const float normal[3], int16_t out[2]) {
+  // Project onto the octahedron |x| + |y| + |z| = 1, then fold the lower half over the diagonals
+  float l1 = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+  if (l1 == 0.0f) l1 = 1.0f;
+  float x = normal[0] / l1, y = normal[1] / l1;
+  if (normal[2] < 0.0f) {
+    float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    x = fx;
+    y = fy;
+  }
+  out[0] = (int16_t)lrintf(fmaxf(-1.0f, fminf(1.0f, x)) * 32767.0f);
+  out[1] = (int16_t)lrintf(fmaxf(-1.0f, fminf(1.0f, y)) * 32767.0f);
+}
+
+uint32_t lu_pack_snorm_2_10_10_10(const float value[4]) {
+  // x, y and z get 10 bits each from the bottom up, w gets the top 2
+  uint32_t out = 0;
+  for (int i = 0; i < 3; i++) {
+    int32_t v = (int32_t)lrintf(fmaxf(-1.0f, fminf(1.0f, value[i])) * 511.0f);
+    out |= ((uint32_t)v & 0x3ff) << (i * 10);
+  }
+  int32_t w = (int32_t)lrintf(fmaxf(-1.0f, fminf(1.0f, value[3])));
+  out |= ((uint32_t)w & 0x3) << 30;
+  return out;
+}
+
+void lu_quantize_vertices(const void *src, size_t num_vertices, size_t src_stride, size_t position_offset, size_t normal_offset, size_t tex_coord_offset, lu_PackedVertex *dst, lu_QuantizeInfo *info) {
+  if (!src || !dst || num_vertices == 0) return;
+  const uint8_t *bytes = src;
+
+  // Bounds of the positions, which the 16 bit positions are relative to
+  float lo[3], hi[3];
+  memcpy(lo, bytes + position_offset, sizeof(lo));
+  memcpy(hi, lo, sizeof(hi));
+  for (size_t v = 1; v < num_vertices; v++) {
+    float p[3];
+    memcpy(p, bytes + v * src_stride + position_offset, sizeof(p));
+    for (int i = 0; i < 3; i++) {
+      lo[i] = fminf(lo[i], p[i]);
+      hi[i] = fmaxf(hi[i], p[i]);
+    }
+  }
+  lu_QuantizeInfo q;
+  for (int i = 0; i < 3; i++) {
+    q.position_offset[i] = lo[i];
+    q.position_scale[i] = hi[i] - lo[i];
+  }
+
+  for (size_t v = 0; v < num_vertices; v++) {
+    const uint8_t *vertex = bytes + v * src_stride;
+    lu_PackedVertex *out = &dst[v];
+    float p[3];
+    memcpy(p, vertex + position_offset, sizeof(p));
+    for (int i = 0; i < 3; i++) {
+      float t = q.position_scale[i] > 0.0f ? (p[i] - lo[i]) / q.position_scale[i] : 0.0f;
+      out->position[i] = (uint16_t)lrintf(t * 65535.0f);
+    }
+    out->position[3] = 65535;
+
+    if (normal_offset != LU_ATTRIB_NONE) {
+      float n[3];
+      memcpy(n, vertex + normal_offset, sizeof(n));
+      lu_octahedral_encode(n, out->normal);
+    } else {
+      out->normal[0] = out->normal[1] = 0;
+    }
+
+    if (tex_coord_offset != LU_ATTRIB_NONE) {
+      float uv[2];
+      memcpy(uv, vertex + tex_coord_offset, sizeof(uv));
+      lu_float_to_half(out->tex_coord, uv, 2);
+    } else {
+      out->tex_coord[0] = out->tex_coord[1] = 0;
+    }
+  }
+  if (info) *info = q;
+}
+
+lu_VertexLayout lu_packed_vertex_layout(void) {
+  lu_VertexAttrib attribs[] = {
+      {.count = 4, .type = GL_UNSIGNED_SHORT, .normalized = GL_TRUE}, // Position in 0-1 across the bounds
+      {.count = 2, .type = GL_SHORT, .normalized = GL_TRUE},          // Octahedral normal
+      {.count = 2, .type = GL_HALF_FLOAT},                            // Texture coordinate
+  };
+  return lu_vertex_layout_create(3, attribs);
+}
+
+// Background uploads
+
+struct lu_UploadJob {
+  lu_UploadFunc func;
+  void *data;
+  void *owned; // Freed along with the job
+  GLuint result;
+  GLsync fence;
+  bool done;
+  struct lu_UploadJob *next;
+};
+
+typedef struct {
+  lu_UploadQueue *queue;
+  pthread_t thread;
+  bool started;
+  GLFWwindow *window; // Hidden window owning the worker's context, NULL for headless workers
+#ifdef LU_HEADLESS
+  EGLDisplay display;
+  EGLContext context;
+#endif
+} lu_UploadWorker;
+
+struct lu_UploadQueue {
+  pthread_mutex_t lock;
+  pthread_cond_t work;     // Signalled when jobs are queued or the queue is shutting down
+  pthread_cond_t finished; // Signalled when a job is done
+  lu_UploadJob *head, *tail;
+  bool shutdown;
+  size_t num_workers;
+  lu_UploadWorker workers[];
+};
+
+static void lu_upload_worker_make_current(lu_UploadWorker *worker) {
+  if (worker->window) {
+    glfwMakeContextCurrent(worker->window);
+    return;
+  }
+#ifdef LU_HEADLESS
+  eglMakeCurrent(worker->display, EGL_NO_SURFACE, EGL_NO_SURFACE, worker->context);
+#endif
+}
+
+static void lu_upload_worker_release_current(lu_UploadWorker *worker) {
+  if (worker->window) {
+    glfwMakeContextCurrent(NULL);
+    return;
+  }
+#ifdef LU_HEADLESS
+  eglMakeCurrent(worker->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+#endif
+}
+
+static void *lu_upload_worker(void *arg) {
+  lu_UploadWorker *worker = arg;
+  lu_UploadQueue *queue = worker->queue;
+  lu_upload_worker_make_current(worker);
+  // Debug output is per context, so workers on a debug context need it too
+  lu_debug_output_setup();
+
+  pthread_mutex_lock(&queue->lock);
+  for (;;) {
+    // Queued jobs still get run when shutting down, so nobody waits on a job forever
+    while (!queue->head && !queue->shutdown) pthread_cond_wait(&queue->work, &queue->lock);
+    lu_UploadJob *job = queue->head;
+    if (!job) break;
+    queue->head = job->next;
+    if (!queue->head) queue->tail = NULL;
+    pthread_mutex_unlock(&queue->lock);
+
+    GLuint result;
+    {
+      LU_INSTRUMENT_SCOPE(LU_STAT_UPLOAD_JOB);
+      result = job->func(job->data);
+    }
+    // The fence has to be flushed, or another context waiting on it could wait forever
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    pthread_mutex_lock(&queue->lock);
+    job->result = result;
+    job->fence = fence;
+    job->done = true;
+    pthread_cond_broadcast(&queue->finished);
+  }
+  pthread_mutex_unlock(&queue->lock);
+
+  lu_upload_worker_release_current(worker);
+  return NULL;
+}
+
+static lu_UploadQueue *lu_upload_queue_alloc(size_t num_workers, const char *caller) {
+  if (num_workers == 0) {
+    lu_log(LU_LOG_ERROR, "(%s): Need at least one worker.\n", caller);
     return NULL;
   }
-  // Create the window
-  GLFWwindow *window;
-  if (!fullscreen)
-    window = glfwCreateWindow(width, height, window_title, NULL, NULL);
+  lu_UploadQueue *queue = calloc(1, sizeof(*queue) + num_workers * sizeof(lu_UploadWorker));
+  if (!queue) {
+    lu_log(LU_LOG_ERROR, "(%s): Failed to allocate memory.\n", caller);
+    return NULL;
+  }
+  pthread_mutex_init(&queue->lock, NULL);
+  pthread_cond_init(&queue->work, NULL);
+  pthread_cond_init(&queue->finished, NULL);
+  queue->num_workers = num_workers;
+  for (size_t i = 0; i < num_workers; i++) queue->workers[i].queue = queue;
+  return queue;
+}
+
+static bool lu_upload_queue_start(lu_UploadQueue *queue, const char *caller) {
+  for (size_t i = 0; i < queue->num_workers; i++) {
+    if (pthread_create(&queue->workers[i].thread, NULL, lu_upload_worker, &queue->workers[i]) != 0) {
+      lu_log(LU_LOG_ERROR, "(%s): Failed to start worker thread.\n", caller);
+      return false;
+    }
+    queue->workers[i].started = true;
+  }
+  return true;
+}
+
+lu_UploadQueue *lu_upload_queue_create(GLFWwindow *window, size_t num_workers) {
+  if (!window) {
+    lu_log(LU_LOG_ERROR, "(lu_upload_queue_create): No window to share with.\n");
+    return NULL;
+  }
+  lu_UploadQueue *queue = lu_upload_queue_alloc(num_workers, "lu_upload_queue_create");
+  if (!queue) return NULL;
+
+  // Worker contexts are invisible windows made with the same kind of context as the main one, sharing its objects
+  glfwDefaultWindowHints();
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MAJOR));
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MINOR));
+  glfwWindowHint(GLFW_OPENGL_PROFILE, glfwGetWindowAttrib(window, GLFW_OPENGL_PROFILE));
+  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, glfwGetWindowAttrib(window, GLFW_OPENGL_FORWARD_COMPAT));
+  glfwWindowHint(GLFW_CONTEXT_NO_ERROR, glfwGetWindowAttrib(window, GLFW_CONTEXT_NO_ERROR));
+  glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, glfwGetWindowAttrib(window, GLFW_OPENGL_DEBUG_CONTEXT));
+  for (size_t i = 0; i < num_workers; i++) {
+    queue->workers[i].window = glfwCreateWindow(1, 1, "luGL upload worker", NULL, window);
+    if (!queue->workers[i].window) {
+      lu_log(LU_LOG_ERROR, "(lu_upload_queue_create): Error creating a shared context with glfwCreateWindow().\n");
+      glfwDefaultWindowHints();
+      lu_upload_queue_delete(queue);
+      return NULL;
+    }
+  }
+  glfwDefaultWindowHints();
+  // glfwCreateWindow doesn't change the current context, but make sure the main one is still current
+  glfwMakeContextCurrent(window);
+
+  if (!lu_upload_queue_start(queue, "lu_upload_queue_create")) {
+    lu_upload_queue_delete(queue);
+    return NULL;
+  }
+  return queue;
+}
+
+lu_UploadQueue *lu_upload_queue_create_headless(lu_HeadlessContext *ctx, size_t num_workers) {
+#ifndef LU_HEADLESS
+  lu_log(LU_LOG_ERROR, "(lu_upload_queue_create_headless): luGL was built without LU_HEADLESS.\n");
+  return NULL;
+#else
+  if (!ctx) {
+    lu_log(LU_LOG_ERROR, "(lu_upload_queue_create_headless): No context to share with.\n");
+    return NULL;
+  }
+  lu_UploadQueue *queue = lu_upload_queue_alloc(num_workers, "lu_upload_queue_create_headless");
+  if (!queue) return NULL;
+
+  for (size_t i = 0; i < num_workers; i++) {
+    lu_UploadWorker *worker = &queue->workers[i];
+    worker->display = ctx->display;
+    worker->context = lu_headless_share_context(ctx);
+    if (worker->context == EGL_NO_CONTEXT) {
+      lu_log(LU_LOG_ERROR, "(lu_upload_queue_create_headless): Error creating a shared context (EGL error 0x%x).\n", eglGetError());
+      lu_upload_queue_delete(queue);
+      return NULL;
+    }
+  }
+
+  if (!lu_upload_queue_start(queue, "lu_upload_queue_create_headless")) {
+    lu_upload_queue_delete(queue);
+    return NULL;
+  }
+  return queue;
+#endif
+}
+
+void lu_upload_queue_delete(lu_UploadQueue *queue) {
+  if (!queue) return;
+  pthread_mutex_lock(&queue->lock);
+  queue->shutdown = true;
+  pthread_cond_broadcast(&queue->work);
+  pthread_mutex_unlock(&queue->lock);
+
+  for (size_t i = 0; i < queue->num_workers; i++) {
+    lu_UploadWorker *worker = &queue->workers[i];
+    if (worker->started) pthread_join(worker->thread, NULL);
+    if (worker->window) glfwDestroyWindow(worker->window);
+#ifdef LU_HEADLESS
+    if (worker->context != EGL_NO_CONTEXT && worker->context != NULL) eglDestroyContext(worker->display, worker->context);
+#endif
+  }
+  pthread_cond_destroy(&queue->finished);
+  pthread_cond_destroy(&queue->work);
+  pthread_mutex_destroy(&queue->lock);
+  free(queue);
+}
+
+lu_UploadJob *lu_upload_submit(lu_UploadQueue *queue, lu_UploadFunc func, void *data) {
+  if (!queue || !func) return NULL;
+  lu_UploadJob *job = calloc(1, sizeof(*job));
+  if (!job) {
+    lu_log(LU_LOG_ERROR, "(lu_upload_submit): Failed to allocate memory.\n");
+    return NULL;
+  }
+  job->func = func;
+  job->data = data;
+
+  pthread_mutex_lock(&queue->lock);
+  if (queue->tail)
+    queue->tail->next = job;
   else
-    window = glfwCreateWindow(width, height, window_title, glfwGetPrimaryMonitor(), NULL);
-  if (window == NULL) {
-    fprintf(stderr, "(lu_create_window): Error creating window with glfwCreateWindow().\n");
+    queue->head = job;
+  queue->tail = job;
+  pthread_cond_signal(&queue->work);
+  pthread_mutex_unlock(&queue->lock);
+  return job;
+}
+
+typedef struct {
+  unsigned int flags;
+  char path[];
+} lu_TextureUpload;
+
+static GLuint lu_upload_texture_job(void *data) {
+  lu_TextureUpload *upload = data;
+  return lu_load_texture(upload->path, upload->flags);
+}
+
+lu_UploadJob *lu_upload_texture_async(lu_UploadQueue *queue, const char *texture_location, unsigned int flags) {
+  if (!queue || !texture_location) return NULL;
+  size_t len = strlen(texture_location);
+  lu_TextureUpload *upload = malloc(sizeof(*upload) + len + 1);
+  if (!upload) {
+    lu_log(LU_LOG_ERROR, "(lu_upload_texture_async): Failed to allocate memory.\n");
     return NULL;
   }
-  glfwMakeContextCurrent(window); // Set the context as current
+  upload->flags = flags;
+  memcpy(upload->path, texture_location, len + 1);
 
-  // Initialise GLEW
-  glewExperimental = GL_TRUE;
-  if (glewInit() != GLEW_OK) {
-    fprintf(stderr, "(lu_create_window): Error initialising GLEW.\n");
+  // The worker never touches owned, so it's fine to set it after the job is queued
+  lu_UploadJob *job = lu_upload_submit(queue, lu_upload_texture_job, upload);
+  if (!job) {
+    free(upload);
+    return NULL;
+  }
+  job->owned = upload;
+  return job;
+}
+
+static GLuint lu_upload_mesh_job(void *data) {
+  lu_Mesh *mesh = data;
+  // VAOs aren't shared between contexts, so only touch the buffer here
+  glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
+  glBufferData(GL_ARRAY_BUFFER, mesh->bytes_added, mesh->data, GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  return mesh->VBO;
+}
+
+lu_UploadJob *lu_upload_mesh_async(lu_UploadQueue *queue, lu_Mesh *mesh) {
+  if (!queue || !mesh || !mesh->data) return NULL;
+  if (mesh->soa) {
+    lu_log(LU_LOG_ERROR, "(lu_upload_mesh_async): Structure of arrays meshes have to be sent with lu_mesh_send.\n");
     return NULL;
   }
+  return lu_upload_submit(queue, lu_upload_mesh_job, mesh);
+}
+
+bool lu_upload_ready(lu_UploadQueue *queue, lu_UploadJob *job) {
+  if (!queue || !job) return false;
+  pthread_mutex_lock(&queue->lock);
+  bool done = job->done;
+  pthread_mutex_unlock(&queue->lock);
+  if (!done) return false;
+  if (!job->fence) return true;
+
+  // Poll without blocking, and forget the fence once it's signalled
+  GLenum status = glClientWaitSync(job->fence, 0, 0);
+  if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return false;
+  glDeleteSync(job->fence);
+  job->fence = NULL;
+  return true;
+}
+
+GLuint lu_upload_wait(lu_UploadQueue *queue, lu_UploadJob *job) {
+  if (!queue || !job) return 0;
+  pthread_mutex_lock(&queue->lock);
+  while (!job->done) pthread_cond_wait(&queue->finished, &queue->lock);
+  pthread_mutex_unlock(&queue->lock);
+
+  // Make this context's GPU queue wait for the upload, without blocking the CPU
+  if (job->fence) {
+    glWaitSync(job->fence, 0, GL_TIMEOUT_IGNORED);
+    glDeleteSync(job->fence);
+    job->fence = NULL;
+  }
+  return job->result;
+}
+
+GLuint lu_upload_result(lu_UploadJob *job) {
+  return job ? job->result : 0;
+}
+
+void lu_upload_release(lu_UploadQueue *queue, lu_UploadJob *job) {
+  if (!queue || !job) return;
+  // A job still in the queue or running can't be freed under the worker
+  lu_upload_wait(queue, job);
+  free(job->owned);
+  free(job);
+}
 
-  return window;
+// Frame pacing
+
+static double lu_now_ms(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
 }
 
-static char *lu_read_file(const char *file_name, size_t *file_len) {
-  FILE *ptr = fopen(file_name, "rb"); // Open the file for reading
-  if (ptr == NULL) {
-    fprintf(stderr, "(lu_read_file): Could not open file %s, returning NULL.\n", file_name);
-    return NULL;
+static void lu_sleep_until_ms(double when_ms) {
+  struct timespec until;
+  until.tv_sec = (time_t)(when_ms / 1e3);
+  until.tv_nsec = (long)((when_ms - until.tv_sec * 1e3) * 1e6);
+  if (until.tv_nsec >= 1000000000L) {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000L;
   }
-  fseek(ptr, 0, SEEK_END);
-  (*file_len) = ftell(ptr);
-  if ((*file_len) == 0) {
-    fclose(ptr);
-    fprintf(stderr, "(lu_read_file): Could not read file %s, file has 0 length.", file_name);
-    return NULL;
+  // Only a signal is worth trying again for, anything else (EINVAL for a bad time) would fail the same way forever
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR) {
   }
+}
 
-  // Allocate output
-  char *out = malloc(sizeof(char) * (*file_len + 1));
-
-  // Read the file
-  fseek(ptr, 0, SEEK_SET);
-  if (fread((void *)out, 1, (*file_len), ptr) != (*file_len)) {
-    fprintf(stderr, "(lu_read_file): Could not read file %s, fread() failed.\n", file_name);
-    fclose(ptr);
-    return NULL;
+// Finishes off the numbers for a frame once the GPU is done with it. Returns false if it isn't done yet (and block is false).
+static bool lu_frame_collect(lu_Frame *frame, int slot, bool block) {
+  GLsync fence = frame->fences[slot];
+  if (!fence) return true;
+  if (block) {
+    while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+    }
+  } else {
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return false;
   }
-  // Null terminate
-  out[*file_len] = '\0';
-  // Close file
-  fclose(ptr);
-  return out;
+  lu_FrameStats *stats = &frame->pending[slot];
+  stats->latency_ms = lu_now_ms() - frame->begin_ms[slot];
+  if (frame->queries[slot][0]) {
+    GLuint64 start = 0, end = 0;
+    glGetQueryObjectui64v(frame->queries[slot][0], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(frame->queries[slot][1], GL_QUERY_RESULT, &end);
+    stats->gpu_ms = end > start ? (end - start) / 1e6 : 0.0;
+  }
+  frame->stats = *stats;
+  glDeleteSync(fence);
+  frame->fences[slot] = 0;
+  return true;
 }
 
-static GLuint lu_compile_shader(const char *shader_file_location) {
-  // Detect the shader type based on file extension
-  size_t name_len = strlen(shader_file_location);
-  const char *ext = shader_file_location + name_len - 5;
-
-  GLenum shader_type;
-  if (strcmp(ext, ".vert") == 0)
-    shader_type = GL_VERTEX_SHADER;
-  else if (strcmp(ext, ".frag") == 0)
-    shader_type = GL_FRAGMENT_SHADER;
-  else {
-    fprintf(stderr, "(lu_compile_shader): Unsupported extension in %s (use .vert or .frag)\n", shader_file_location);
-    return 0;
+lu_Frame lu_frame_create(GLFWwindow *window, int frames_in_flight) {
+  lu_Frame frame = {0};
+  if (frames_in_flight < 1) frames_in_flight = 1;
+  if (frames_in_flight > LU_MAX_FRAMES_IN_FLIGHT) frames_in_flight = LU_MAX_FRAMES_IN_FLIGHT;
+  frame.window = window;
+  frame.frames_in_flight = frames_in_flight;
+  frame.slot = -1;
+  // Timestamps rather than GL_TIME_ELAPSED, which some drivers (llvmpipe) get wrong
+  if (GLEW_VERSION_3_3 || GLEW_ARB_timer_query) glGenQueries(frames_in_flight * 2, &frame.queries[0][0]);
+  return frame;
+}
+
+void lu_frame_delete(lu_Frame *frame) {
+  if (!frame) return;
+  for (int i = 0; i < frame->frames_in_flight; i++) {
+    if (frame->fences[i]) glDeleteSync(frame->fences[i]);
+    frame->fences[i] = 0;
   }
+  if (frame->queries[0][0]) glDeleteQueries(frame->frames_in_flight * 2, &frame->queries[0][0]);
+  memset(frame->queries, 0, sizeof(frame->queries));
+}
 
-  // Read the shader file's contents into a string
-  size_t src_len;
-  char *source = lu_read_file(shader_file_location, &src_len);
+void lu_frame_set_limit(lu_Frame *frame, double max_fps) {
+  if (!frame) return;
+  frame->min_frame_ms = max_fps > 0.0 ? 1e3 / max_fps : 0.0;
+  frame->next_begin_ms = 0.0;
+}
 
-  if (!source) {
-    fprintf(stderr, "(lu_compile_shader): Failed to read %s\n", shader_file_location);
-    return 0;
+void lu_frame_set_latch(lu_Frame *frame, void (*latch)(void *data), void *data) {
+  if (!frame) return;
+  frame->latch = latch;
+  frame->latch_data = data;
+}
+
+void lu_frame_begin(lu_Frame *frame) {
+  if (!frame || frame->frames_in_flight == 0) return;
+  double start = lu_now_ms();
+
+  // Sleep off whatever is left of the frame limit. If we're running late, start counting again from now instead of rushing to catch up.
+  if (frame->min_frame_ms > 0.0) {
+    if (frame->next_begin_ms > start) lu_sleep_until_ms(frame->next_begin_ms);
+    double now = lu_now_ms();
+    frame->next_begin_ms = (frame->next_begin_ms > now - frame->min_frame_ms ? frame->next_begin_ms : now) + frame->min_frame_ms;
   }
 
-  // Create and compile the shader
-  GLuint shader = glCreateShader(shader_type);
-  const GLchar *src = source;
-  GLint len = (GLint)src_len;
-  glShaderSource(shader, 1, &src, &len);
-  free(source);
+  // Wait until the GPU is done with the frame that last used this slot, which is what keeps frames_in_flight frames queued at most
+  frame->slot = (frame->slot + 1) % frame->frames_in_flight;
+  lu_frame_collect(frame, frame->slot, true);
 
-  glCompileShader(shader);
+  if (lu_gpu_profiling) lu_gpu_profiler_frame();
+  if (lu_pipeline_stats_on) lu_pipeline_stats_frame();
 
-  // Check for compilation errors
-  GLint success;
-  glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-  if (!success) {
-    char log[1024];
-    glGetShaderInfoLog(shader, sizeof(log), NULL, log);
-    fprintf(stderr, "(lu_compile_shader): Compilation failed for %s:\n%s", shader_file_location, log);
-    glDeleteShader(shader);
-    return 0;
+  double now = lu_now_ms();
+  frame->begin_ms[frame->slot] = now;
+  frame->pending[frame->slot] = (lu_FrameStats){.frame = frame->frame_number, .wait_ms = now - start};
+  if (frame->queries[frame->slot][0]) glQueryCounter(frame->queries[frame->slot][0], GL_TIMESTAMP);
+}
+
+void lu_frame_end(lu_Frame *frame) {
+  if (!frame || frame->slot < 0) return;
+  int slot = frame->slot;
+
+  // Last chance to update anything the frame's commands read from mapped memory before they're submitted
+  if (frame->latch) frame->latch(frame->latch_data);
+  frame->pending[slot].cpu_ms = lu_now_ms() - frame->begin_ms[slot];
+
+  if (frame->window)
+    glfwSwapBuffers(frame->window);
+  else
+    glFlush();
+  lu_trace_frame();
+  // The end timestamp goes after the swap so GPU time includes it (and so deferred renderers have actually drawn the frame by then)
+  if (frame->queries[slot][1]) glQueryCounter(frame->queries[slot][1], GL_TIMESTAMP);
+  frame->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  // Pick up any frames that have finished, oldest first (ending with this one), so latency isn't only noticed when lu_frame_begin has to wait
+  for (int i = 1; i <= frame->frames_in_flight; i++) {
+    if (!lu_frame_collect(frame, (slot + i) % frame->frames_in_flight, false)) break;
   }
+  frame->frame_number++;
+}
 
-  return shader;
+// Query frame rings. The GPU profiler and the pipeline statistics keep a few frames of queries in flight and read each frame back when
+// its slot comes round again, rather than waiting on the frame that just ended.
+
+// Frames of queries in a ring, results are read back this many frames after they're recorded
+#define LU_QUERY_RING_FRAMES 4
+
+typedef struct {
+  int slot; // Frame being recorded, -1 before the first frame
+  bool recorded[LU_QUERY_RING_FRAMES];
+  uint64_t dropped_frames; // Frames that still weren't ready when their slot came round again
+} lu_QueryRing;
+
+// Moves on to the next frame, reading back what was recorded in its slot with resolve first. Returns the slot.
+static int lu_query_ring_advance(lu_QueryRing *ring, bool (*resolve)(int slot)) {
+  // The slot we're about to reuse was recorded LU_QUERY_RING_FRAMES - 1 frames ago, so it's usually done by now
+  int slot = (ring->slot + 1) % LU_QUERY_RING_FRAMES;
+  if (ring->recorded[slot] && !resolve(slot)) ring->dropped_frames++;
+  ring->recorded[slot] = true;
+  ring->slot = slot;
+  return slot;
 }
 
-GLuint lu_create_shader_program(size_t num_shaders, ...) {
-  va_list args;
-  va_start(args, num_shaders);
+// Forgets the recorded frames without reading them back
+static void lu_query_ring_reset(lu_QueryRing *ring) {
+  memset(ring->recorded, 0, sizeof(ring->recorded));
+  ring->dropped_frames = 0;
+}
 
-  GLuint *shaders = malloc(sizeof(unsigned int) * num_shaders);
-  for (int i = 0; i < num_shaders; i++) {
-    // Create and compile each shader
-    char *shader_file_name = va_arg(args, char *);
-    GLuint shader = lu_compile_shader(shader_file_name);
-    // Check for compilation error
-    if (shader == 0) {
-      fprintf(stderr, "(lu_create_shader_program): Couldn't create shader program, compilation of shader %s failed.\n", shader_file_name);
-      // Delete all other shaders on failure to compile
-      for (int j = 0; j < i; j++) {
-        glDeleteShader(shaders[j]);
-      }
-      free(shaders);
-      return 0;
+static bool lu_query_ready(GLuint query) {
+  GLuint available = 0;
+  glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+  return available;
+}
+
+// GPU profiler
+
+typedef struct {
+  const char *name;
+  int parent; // Index of the enclosing scope in the same frame, -1 for none
+} lu_GpuScopeRecord;
+
+typedef struct {
+  const char *name;
+  double start_us, duration_us;
+  int depth;
+} lu_GpuTraceEvent;
+
+// Scopes recorded in one frame
+typedef struct {
+  GLuint queries[LU_GPU_MAX_SCOPES * 2]; // Start and end timestamp of each scope
+  lu_GpuScopeRecord scopes[LU_GPU_MAX_SCOPES];
+  size_t num_scopes;
+  int last_query; // Index of the timestamp issued last, which is the one to poll since timestamps finish in order
+} lu_GpuProfilerFrame;
+
+bool lu_gpu_profiling = false;
+
+static struct {
+  bool initialised;
+  lu_QueryRing ring;
+  lu_GpuProfilerFrame frames[LU_QUERY_RING_FRAMES];
+  int stack[LU_GPU_MAX_DEPTH]; // Open scopes, -1 for ones that were dropped
+  int depth;
+  lu_GpuScopeStats nodes[LU_GPU_MAX_SCOPES];
+  size_t num_nodes;
+  uint64_t dropped_scopes;
+  // Chrome trace capture
+  bool capturing;
+  lu_GpuTraceEvent *events;
+  size_t num_events, events_alloced;
+  GLuint64 trace_origin;
+} lu_gpu_profiler = {.ring = {.slot = -1}};
+
+void lu_gpu_profiler_enable(bool enabled) {
+  if (enabled && !lu_gpu_profiler.initialised) {
+    if (!(GLEW_VERSION_3_3 || GLEW_ARB_timer_query)) {
+      lu_log(LU_LOG_ERROR, "(lu_gpu_profiler_enable): Timer queries need OpenGL 3.3 or ARB_timer_query.\n");
+      return;
     }
+    for (int i = 0; i < LU_QUERY_RING_FRAMES; i++) glGenQueries(LU_GPU_MAX_SCOPES * 2, lu_gpu_profiler.frames[i].queries);
+    lu_gpu_profiler.initialised = true;
+  }
+  lu_gpu_profiling = enabled;
+}
 
-    shaders[i] = shader;
+// Finds the tree node for a scope called name under parent, adding it if it's new
+static int lu_gpu_profiler_node(int parent, const char *name) {
+  for (size_t i = 0; i < lu_gpu_profiler.num_nodes; i++) {
+    lu_GpuScopeStats *node = &lu_gpu_profiler.nodes[i];
+    if (node->parent == parent && (node->name == name || strcmp(node->name, name) == 0)) return (int)i;
   }
-  va_end(args);
+  if (lu_gpu_profiler.num_nodes == LU_GPU_MAX_SCOPES) return -1;
+  lu_GpuScopeStats *node = &lu_gpu_profiler.nodes[lu_gpu_profiler.num_nodes];
+  memset(node, 0, sizeof(*node));
+  node->name = name;
+  node->parent = parent;
+  node->depth = parent < 0 ? 0 : lu_gpu_profiler.nodes[parent].depth + 1;
+  return (int)lu_gpu_profiler.num_nodes++;
+}
 
-  // Create the program
-  GLuint shader_program = glCreateProgram();
-  for (int i = 0; i < num_shaders; i++) {
-    glAttachShader(shader_program, shaders[i]);
+static void lu_gpu_profiler_add_event(const char *name, GLuint64 start, GLuint64 end, int depth) {
+  if (lu_gpu_profiler.num_events == lu_gpu_profiler.events_alloced) {
+    size_t alloced = lu_gpu_profiler.events_alloced ? lu_gpu_profiler.events_alloced * 2 : 1024;
+    lu_GpuTraceEvent *events = realloc(lu_gpu_profiler.events, alloced * sizeof(*events));
+    if (!events) return;
+    lu_gpu_profiler.events = events;
+    lu_gpu_profiler.events_alloced = alloced;
   }
+  if (lu_gpu_profiler.num_events == 0) lu_gpu_profiler.trace_origin = start;
+  lu_GpuTraceEvent *event = &lu_gpu_profiler.events[lu_gpu_profiler.num_events++];
+  event->name = name;
+  event->start_us = (double)(int64_t)(start - lu_gpu_profiler.trace_origin) / 1e3;
+  event->duration_us = (double)(end - start) / 1e3;
+  event->depth = depth;
+}
 
-  glLinkProgram(shader_program);
-  // Delete all shaders now, stack overflow says i can do it lol
-  for (int i = 0; i < num_shaders; i++) {
-    glDeleteShader(shaders[i]);
+// Reads back a recorded frame and folds it into the tree. Returns false if the GPU isn't done with it yet.
+static bool lu_gpu_profiler_resolve(int slot) {
+  lu_GpuProfilerFrame *frame = &lu_gpu_profiler.frames[slot];
+  if (frame->num_scopes == 0) return true;
+  // Timestamps finish in order, so if the last one issued is there they all are. That's not the last scope's end when scopes nest,
+  // the enclosing scope ends after it.
+  if (!lu_query_ready(frame->queries[frame->last_query])) return false;
+
+  int nodes[LU_GPU_MAX_SCOPES];
+  double frame_ms[LU_GPU_MAX_SCOPES];
+  bool seen[LU_GPU_MAX_SCOPES] = {0};
+  for (size_t i = 0; i < frame->num_scopes; i++) {
+    lu_GpuScopeRecord *record = &frame->scopes[i];
+    int parent = record->parent < 0 ? -1 : nodes[record->parent];
+    nodes[i] = record->parent >= 0 && parent < 0 ? -1 : lu_gpu_profiler_node(parent, record->name);
+    if (nodes[i] < 0) continue;
+
+    GLuint64 start = 0, end = 0;
+    glGetQueryObjectui64v(frame->queries[i * 2], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(frame->queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+    double ms = end > start ? (end - start) / 1e6 : 0.0;
+    // A scope that runs more than once a frame is counted as its total for the frame
+    if (!seen[nodes[i]]) frame_ms[nodes[i]] = 0.0;
+    frame_ms[nodes[i]] += ms;
+    seen[nodes[i]] = true;
+    lu_gpu_profiler.nodes[nodes[i]].calls++;
+    if (lu_gpu_profiler.capturing) lu_gpu_profiler_add_event(record->name, start, end > start ? end : start, lu_gpu_profiler.nodes[nodes[i]].depth);
   }
-  free(shaders);
 
-  // Check for linking errors
-  GLint success;
-  glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
-  if (!success) {
-    char log[1024];
-    glGetProgramInfoLog(shader_program, sizeof(log), NULL, log);
-    fprintf(stderr, "(lu_create_shader_program): Shader linking failed:\n%s", log);
-    glDeleteProgram(shader_program);
-    return 0;
+  for (size_t i = 0; i < lu_gpu_profiler.num_nodes; i++) {
+    if (!seen[i]) continue;
+    lu_GpuScopeStats *node = &lu_gpu_profiler.nodes[i];
+    double ms = frame_ms[i];
+    node->last_ms = ms;
+    node->min_ms = node->frames == 0 || ms < node->min_ms ? ms : node->min_ms;
+    node->max_ms = ms > node->max_ms ? ms : node->max_ms;
+    node->total_ms += ms;
+    node->frames++;
+    node->avg_ms = node->total_ms / node->frames;
   }
+  return true;
+}
 
-  return shader_program;
+void lu_gpu_profiler_frame(void) {
+  if (!lu_gpu_profiler.initialised) return;
+  if (lu_gpu_profiler.depth != 0) {
+    lu_log(LU_LOG_WARNING, "(lu_gpu_profiler_frame): %d GPU scopes were left open at the end of the frame.\n", lu_gpu_profiler.depth);
+    // Close them so the timestamps still make sense
+    while (lu_gpu_profiler.depth > 0) lu_gpu_scope_end();
+  }
+
+  int slot = lu_query_ring_advance(&lu_gpu_profiler.ring, lu_gpu_profiler_resolve);
+  lu_gpu_profiler.frames[slot].num_scopes = 0;
 }
 
-void lu_define_layout(GLuint *VAO, GLuint *VBO, size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types) {
-  // Clear whatever might exist in the VAO and VBO
-  glDeleteVertexArrays(1, VBO);
-  glGenBuffers(1, VBO);
-  glBindBuffer(GL_ARRAY_BUFFER, *VBO);
+bool lu_gpu_scope_begin(const char *name) {
+  if (!lu_gpu_profiler.initialised) return false;
+  if (lu_gpu_profiler.ring.slot < 0) lu_gpu_profiler_frame();
+  if (lu_gpu_profiler.depth == LU_GPU_MAX_DEPTH) {
+    lu_gpu_profiler.dropped_scopes++;
+    return false;
+  }
+  lu_GpuProfilerFrame *frame = &lu_gpu_profiler.frames[lu_gpu_profiler.ring.slot];
+  int parent = lu_gpu_profiler.depth > 0 ? lu_gpu_profiler.stack[lu_gpu_profiler.depth - 1] : -1;
+  // Out of queries for this frame (or inside a scope that was), the scope still has to be pushed so lu_gpu_scope_end matches up
+  if (frame->num_scopes == LU_GPU_MAX_SCOPES || (lu_gpu_profiler.depth > 0 && parent < 0)) {
+    lu_gpu_profiler.dropped_scopes++;
+    lu_gpu_profiler.stack[lu_gpu_profiler.depth++] = -1;
+    return true;
+  }
+  int index = (int)frame->num_scopes++;
+  frame->scopes[index].name = name;
+  frame->scopes[index].parent = parent;
+  glQueryCounter(frame->queries[index * 2], GL_TIMESTAMP);
+  frame->last_query = index * 2;
+  lu_gpu_profiler.stack[lu_gpu_profiler.depth++] = index;
+  return true;
+}
 
-  glDeleteVertexArrays(1, VAO);
-  glGenVertexArrays(1, VAO);
-  glBindVertexArray(*VAO);
+bool lu_gpu_scope_end(void) {
+  if (lu_gpu_profiler.depth == 0) return false;
+  int index = lu_gpu_profiler.stack[--lu_gpu_profiler.depth];
+  if (index >= 0) {
+    lu_GpuProfilerFrame *frame = &lu_gpu_profiler.frames[lu_gpu_profiler.ring.slot];
+    glQueryCounter(frame->queries[index * 2 + 1], GL_TIMESTAMP);
+    frame->last_query = index * 2 + 1;
+  }
+  return true;
+}
 
-  // Calculate stride
-  int stride = 0;
-  for (int i = 0; i < num_components; i++) {
-    stride += component_sizes[i] * component_counts[i];
+size_t lu_gpu_profiler_get_scopes(const lu_GpuScopeStats **scopes) {
+  if (scopes) *scopes = lu_gpu_profiler.nodes;
+  return lu_gpu_profiler.num_nodes;
+}
+
+// Prints node and everything under it
+static void lu_gpu_profiler_print_node(FILE *out, int node) {
+  lu_GpuScopeStats *stats = &lu_gpu_profiler.nodes[node];
+  fprintf(out, "%*s%-*s %9.3f %9.3f %9.3f %9.3f\n", stats->depth * 2, "", 32 - stats->depth * 2, stats->name, stats->last_ms, stats->min_ms, stats->avg_ms, stats->max_ms);
+  for (size_t i = 0; i < lu_gpu_profiler.num_nodes; i++) {
+    if (lu_gpu_profiler.nodes[i].parent == node) lu_gpu_profiler_print_node(out, (int)i);
   }
-  // Attrib pointer to each component
-  int offset = 0;
-  for (int i = 0; i < num_components; i++) {
-    glVertexAttribPointer(i, component_counts[i], component_types[i], GL_FALSE, stride, (GLvoid *)(intptr_t)offset);
-    glEnableVertexAttribArray(i);
-    offset += component_sizes[i] * component_counts[i];
+}
+
+void lu_gpu_profiler_print(FILE *out) {
+  if (!out) out = stdout;
+  fprintf(out, "%-32s %9s %9s %9s %9s (ms per frame)\n", "GPU scope", "last", "min", "avg", "max");
+  for (size_t i = 0; i < lu_gpu_profiler.num_nodes; i++) {
+    if (lu_gpu_profiler.nodes[i].parent < 0) lu_gpu_profiler_print_node(out, (int)i);
   }
+  if (lu_gpu_profiler.ring.dropped_frames || lu_gpu_profiler.dropped_scopes)
+    fprintf(out, "(%llu frames not ready in time, %llu scopes over the limits)\n", (unsigned long long)lu_gpu_profiler.ring.dropped_frames, (unsigned long long)lu_gpu_profiler.dropped_scopes);
 }
 
-unsigned int lu_send_uniform_texture(char *texture_location, GLuint shader_program, char *texture_uniform_name) {
-  unsigned int texture = 0;
+void lu_gpu_profiler_capture(bool capturing) {
+  if (capturing && !lu_gpu_profiler.capturing) lu_gpu_profiler.num_events = 0;
+  lu_gpu_profiler.capturing = capturing;
+}
 
-  int image_width, image_height, comp; // No idea what comp is
-  stbi_set_flip_vertically_on_load(1);
-  char *image = (char *)stbi_load(texture_location, &image_width, &image_height, &comp, STBI_rgb_alpha);
+bool lu_gpu_profiler_write_trace(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    lu_log(LU_LOG_ERROR, "(lu_gpu_profiler_write_trace): Could not open file %s.\n", path);
+    return false;
+  }
+  // Chrome's trace event format, complete ("X") events on one thread nest by time, so depth doesn't need writing out
+  fprintf(file, "{\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"GPU\"}}");
+  for (size_t i = 0; i < lu_gpu_profiler.num_events; i++) {
+    lu_GpuTraceEvent *event = &lu_gpu_profiler.events[i];
+    fprintf(file, ",\n{\"name\":\"");
+    for (const char *c = event->name; *c; c++) {
+      if (*c == '"' || *c == '\\') fputc('\\', file);
+      if ((unsigned char)*c >= 0x20) fputc(*c, file);
+    }
+    fprintf(file, "\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}", event->start_us, event->duration_us);
+  }
+  fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  bool ok = !ferror(file);
+  fclose(file);
+  return ok;
+}
 
-  if (image == NULL) {
-    fprintf(stderr, "(lu_send_uniform_texture): Error loading image file, stbi_load returned NULL.\n");
-    return 0;
+void lu_gpu_profiler_reset(void) {
+  lu_gpu_profiler.num_nodes = 0;
+  lu_gpu_profiler.num_events = 0;
+  lu_gpu_profiler.dropped_scopes = 0;
+  // Recorded frames would point at nodes that are gone
+  lu_query_ring_reset(&lu_gpu_profiler.ring);
+}
+
+void lu_gpu_profiler_delete(void) {
+  lu_gpu_profiling = false;
+  if (lu_gpu_profiler.initialised) {
+    for (int i = 0; i < LU_QUERY_RING_FRAMES; i++) glDeleteQueries(LU_GPU_MAX_SCOPES * 2, lu_gpu_profiler.frames[i].queries);
   }
-  // Create and bind the texture
-  glGenTextures(1, &texture);
-  glBindTexture(GL_TEXTURE_2D, texture);
+  free(lu_gpu_profiler.events);
+  memset(&lu_gpu_profiler, 0, sizeof(lu_gpu_profiler));
+  lu_gpu_profiler.ring.slot = -1;
+}
 
-  // Set parameters
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+// Pipeline statistics
 
-  // Not quite sure what this does
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image_width, image_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
+// Queries per segment of draws, with pipeline statistics queries
+#define LU_PIPELINE_QUERIES 6
 
-  // Send the texture as a uniform
-  glUseProgram(shader_program);
-  glUniform1i(glGetUniformLocation(shader_program, texture_uniform_name), 0);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, texture);
+// Samples passed first, so it's the only one used without pipeline statistics queries
+static const GLenum lu_pipeline_targets[LU_PIPELINE_QUERIES] = {
+    GL_SAMPLES_PASSED,
+    GL_VERTICES_SUBMITTED_ARB,
+    GL_PRIMITIVES_SUBMITTED_ARB,
+    GL_VERTEX_SHADER_INVOCATIONS_ARB,
+    GL_CLIPPING_OUTPUT_PRIMITIVES_ARB,
+    GL_FRAGMENT_SHADER_INVOCATIONS_ARB,
+};
 
-  // Free image
-  stbi_image_free(image);
+// A run of draws counted by one set of queries
+typedef struct {
+  int pass; // Index of the pass it's in, -1 for none
+  int mesh; // Index of the mesh it drew, -1 for none
+} lu_PipelineSegment;
 
-  // Unbind texture
-  glBindTexture(GL_TEXTURE_2D, 0);
+// Segments recorded in one frame
+typedef struct {
+  GLuint *queries; // num_queries per segment
+  lu_PipelineSegment *segments;
+  size_t num_segments, capacity;
+  uint32_t pass_calls[LU_PIPELINE_MAX_PASSES];
+} lu_PipelineFrame;
 
-  return texture;
+bool lu_pipeline_stats_on = false;
+
+// Guards the passes, since lu_stats_snapshot copies them from whatever thread it's called on
+static pthread_mutex_t lu_pipeline_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+  bool initialised, per_mesh;
+  int num_queries; // LU_PIPELINE_QUERIES, or just the occlusion query without pipeline statistics
+  lu_QueryRing ring;
+  lu_PipelineFrame frames[LU_QUERY_RING_FRAMES];
+  bool pass_open;
+  int pass;      // Open pass, -1 if there were too many passes to keep it
+  bool counting; // A segment's queries are running
+  lu_PipelineStats passes[LU_PIPELINE_MAX_PASSES];
+  size_t num_passes;
+  lu_PipelineStats *meshes;
+  uint64_t *mesh_resolved; // Frame each mesh was last read back in, so its last counters start again once per frame
+  size_t num_meshes, meshes_alloced;
+  lu_Index mesh_index; // Mesh indices by VBO
+  uint64_t resolved_frames, dropped_passes;
+} lu_pipeline_stats = {.ring = {.slot = -1}, .pass = -1};
+
+// Finds the stats for a pass called name, adding them if it's new
+static int lu_pipeline_pass_index(const char *name) {
+  for (size_t i = 0; i < lu_pipeline_stats.num_passes; i++) {
+    const char *pass_name = lu_pipeline_stats.passes[i].name;
+    if (pass_name == name || strcmp(pass_name, name) == 0) return (int)i;
+  }
+  if (lu_pipeline_stats.num_passes == LU_PIPELINE_MAX_PASSES) return -1;
+  pthread_mutex_lock(&lu_pipeline_stats_lock);
+  lu_PipelineStats *pass = &lu_pipeline_stats.passes[lu_pipeline_stats.num_passes];
+  memset(pass, 0, sizeof(*pass));
+  pass->name = name;
+  int index = (int)lu_pipeline_stats.num_passes++;
+  pthread_mutex_unlock(&lu_pipeline_stats_lock);
+  return index;
 }
 
-lu_Mesh lu_mesh_create(size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types) {
-  lu_Mesh mesh = {0};
-  mesh.data = NULL;
-  mesh.bytes_alloced = 0;
-  mesh.bytes_added = 0;
-  mesh.stride = 0;
-  for (int i = 0; i < num_components; i++) {
-    mesh.stride += component_sizes[i] * component_counts[i];
+// Finds the stats for the mesh using vbo, adding them if it's new. Meshes are passed around by value, so they go by their buffer.
+static int lu_pipeline_mesh_index(GLuint vbo) {
+  uint64_t hash = lu_hash_u32(vbo);
+  lu_Index *mesh_index = &lu_pipeline_stats.mesh_index;
+  for (lu_IndexSlot *slot = lu_index_find(mesh_index, hash); slot; slot = lu_index_find_next(mesh_index, slot)) {
+    if (lu_pipeline_stats.meshes[slot->value].mesh == vbo) return (int)slot->value;
   }
 
-  lu_define_layout(&mesh.VAO, &mesh.VBO, num_components, component_sizes, component_counts, component_types);
-  return mesh;
+  if (lu_pipeline_stats.num_meshes == lu_pipeline_stats.meshes_alloced) {
+    size_t alloced = lu_pipeline_stats.meshes_alloced ? lu_pipeline_stats.meshes_alloced * 2 : 64;
+    lu_PipelineStats *meshes = realloc(lu_pipeline_stats.meshes, alloced * sizeof(*meshes));
+    if (!meshes) return -1;
+    lu_pipeline_stats.meshes = meshes;
+    uint64_t *resolved = realloc(lu_pipeline_stats.mesh_resolved, alloced * sizeof(*resolved));
+    if (!resolved) return -1;
+    lu_pipeline_stats.mesh_resolved = resolved;
+    lu_pipeline_stats.meshes_alloced = alloced;
+  }
+  int index = (int)lu_pipeline_stats.num_meshes;
+  if (!lu_index_insert(mesh_index, hash, index)) return -1;
+  lu_pipeline_stats.num_meshes++;
+  memset(&lu_pipeline_stats.meshes[index], 0, sizeof(lu_PipelineStats));
+  lu_pipeline_stats.meshes[index].mesh = vbo;
+  lu_pipeline_stats.mesh_resolved[index] = 0;
+  return index;
 }
 
-void lu_mesh_add_bytes(lu_Mesh *mesh, void *src, size_t n_bytes) {
-  if (n_bytes == 0) return;
-  if (!src) return;
-  if (!mesh) return;
+// Drops the stats for the mesh using vbo, moving the last mesh into its place
+static void lu_pipeline_mesh_forget(GLuint vbo) {
+  lu_Index *mesh_index = &lu_pipeline_stats.mesh_index;
+  lu_IndexSlot *slot = lu_index_find(mesh_index, lu_hash_u32(vbo));
+  while (slot && lu_pipeline_stats.meshes[slot->value].mesh != vbo) slot = lu_index_find_next(mesh_index, slot);
+  if (!slot) return;
+  int index = (int)slot->value;
+  lu_index_remove(mesh_index, slot);
 
-  if (!mesh->data) {
-    mesh->bytes_alloced = 64;
-    mesh->data = malloc(sizeof(uint8_t) * mesh->bytes_alloced);
-    mesh->bytes_added = 0;
+  // Segments still waiting to be read back would count for whatever mesh ends up at their index
+  int last = (int)--lu_pipeline_stats.num_meshes;
+  for (int i = 0; i < LU_QUERY_RING_FRAMES; i++) {
+    lu_PipelineFrame *frame = &lu_pipeline_stats.frames[i];
+    for (size_t j = 0; j < frame->num_segments; j++) {
+      if (frame->segments[j].mesh == index) frame->segments[j].mesh = -1;
+      else if (frame->segments[j].mesh == last) frame->segments[j].mesh = index;
+    }
   }
+  if (index == last) return;
+  lu_pipeline_stats.meshes[index] = lu_pipeline_stats.meshes[last];
+  lu_pipeline_stats.mesh_resolved[index] = lu_pipeline_stats.mesh_resolved[last];
+  lu_index_find_value(mesh_index, lu_hash_u32(lu_pipeline_stats.meshes[index].mesh), last)->value = index;
+}
 
-  if (mesh->bytes_added + n_bytes > mesh->bytes_alloced) {
-    while (mesh->bytes_added + n_bytes > mesh->bytes_alloced) {
-      mesh->bytes_alloced *= 2;
+// Starts the queries for a new segment in the current frame
+static void lu_pipeline_segment_begin(int pass, int mesh) {
+  lu_PipelineFrame *frame = &lu_pipeline_stats.frames[lu_pipeline_stats.ring.slot];
+  int num_queries = lu_pipeline_stats.num_queries;
+  if (frame->num_segments == frame->capacity) {
+    size_t capacity = frame->capacity ? frame->capacity * 2 : 64;
+    GLuint *queries = realloc(frame->queries, capacity * num_queries * sizeof(GLuint));
+    if (!queries) return;
+    frame->queries = queries;
+    lu_PipelineSegment *segments = realloc(frame->segments, capacity * sizeof(*segments));
+    if (!segments) return;
+    frame->segments = segments;
+    glGenQueries((GLsizei)((capacity - frame->capacity) * num_queries), frame->queries + frame->capacity * num_queries);
+    frame->capacity = capacity;
+  }
+  size_t index = frame->num_segments++;
+  frame->segments[index].pass = pass;
+  frame->segments[index].mesh = mesh;
+  for (int i = 0; i < num_queries; i++) glBeginQuery(lu_pipeline_targets[i], frame->queries[index * num_queries + i]);
+  lu_pipeline_stats.counting = true;
+}
+
+static void lu_pipeline_segment_end(void) {
+  if (!lu_pipeline_stats.counting) return;
+  for (int i = 0; i < lu_pipeline_stats.num_queries; i++) glEndQuery(lu_pipeline_targets[i]);
+  lu_pipeline_stats.counting = false;
+}
+
+static void lu_pipeline_counters_add(lu_PipelineCounters *to, const lu_PipelineCounters *from) {
+  to->vertices += from->vertices;
+  to->primitives += from->primitives;
+  to->vertex_invocations += from->vertex_invocations;
+  to->clipped_primitives += from->clipped_primitives;
+  to->fragment_invocations += from->fragment_invocations;
+  to->samples_passed += from->samples_passed;
+}
+
+// Reads back a recorded frame and adds it to the passes and meshes. Returns false if the GPU isn't done with it yet.
+static bool lu_pipeline_stats_resolve(int slot) {
+  lu_PipelineFrame *frame = &lu_pipeline_stats.frames[slot];
+  int num_queries = lu_pipeline_stats.num_queries;
+  // Queries finish in order, so if the last segment's are there they all are
+  if (frame->num_segments > 0) {
+    for (int i = 0; i < num_queries; i++) {
+      if (!lu_query_ready(frame->queries[(frame->num_segments - 1) * num_queries + i])) return false;
     }
-    mesh->data = realloc(mesh->data, mesh->bytes_alloced * sizeof(uint8_t));
   }
+  uint64_t resolved = ++lu_pipeline_stats.resolved_frames;
 
-  memcpy(mesh->data + mesh->bytes_added, src, n_bytes);
-  mesh->bytes_added += n_bytes;
+  lu_PipelineCounters pass_counters[LU_PIPELINE_MAX_PASSES] = {0};
+  for (size_t i = 0; i < frame->num_segments; i++) {
+    GLuint64 results[LU_PIPELINE_QUERIES] = {0};
+    for (int j = 0; j < num_queries; j++) glGetQueryObjectui64v(frame->queries[i * num_queries + j], GL_QUERY_RESULT, &results[j]);
+    lu_PipelineCounters counters = {
+        .vertices = results[1],
+        .primitives = results[2],
+        .vertex_invocations = results[3],
+        .clipped_primitives = results[4],
+        .fragment_invocations = results[5],
+        .samples_passed = results[0],
+    };
+
+    lu_PipelineSegment *segment = &frame->segments[i];
+    if (segment->pass >= 0) lu_pipeline_counters_add(&pass_counters[segment->pass], &counters);
+    if (segment->mesh >= 0) {
+      lu_PipelineStats *mesh = &lu_pipeline_stats.meshes[segment->mesh];
+      // A mesh drawn more than once a frame is counted as its total for the frame
+      if (lu_pipeline_stats.mesh_resolved[segment->mesh] != resolved) {
+        memset(&mesh->last, 0, sizeof(mesh->last));
+        mesh->frames++;
+        lu_pipeline_stats.mesh_resolved[segment->mesh] = resolved;
+      }
+      mesh->calls++;
+      lu_pipeline_counters_add(&mesh->last, &counters);
+      lu_pipeline_counters_add(&mesh->total, &counters);
+    }
+  }
+
+  pthread_mutex_lock(&lu_pipeline_stats_lock);
+  for (size_t i = 0; i < lu_pipeline_stats.num_passes; i++) {
+    if (frame->pass_calls[i] == 0) continue;
+    lu_PipelineStats *pass = &lu_pipeline_stats.passes[i];
+    pass->last = pass_counters[i];
+    lu_pipeline_counters_add(&pass->total, &pass_counters[i]);
+    pass->calls += frame->pass_calls[i];
+    pass->frames++;
+  }
+  pthread_mutex_unlock(&lu_pipeline_stats_lock);
+  return true;
 }
 
-void lu_mesh_free(lu_Mesh *mesh) {
-  if (!mesh) return;
-  if (mesh->data) free(mesh->data);
-  mesh->data = NULL;
-  mesh->bytes_alloced = 0;
-  // dont reset mesh->bytes_added, lu_mesh_add_bytes will do that for us
+void lu_pipeline_stats_enable(bool enabled, bool per_mesh) {
+  if (enabled && !lu_pipeline_stats.initialised) {
+    // Occlusion queries work everywhere, the rest need GL 4.6 or ARB_pipeline_statistics_query
+    lu_pipeline_stats.num_queries = GLEW_VERSION_4_6 || GLEW_ARB_pipeline_statistics_query ? LU_PIPELINE_QUERIES : 1;
+    lu_pipeline_stats.initialised = true;
+  }
+  // Switching modes in the middle of a pass would leave its queries running
+  lu_pipeline_segment_end();
+  lu_pipeline_stats.pass_open = false;
+  lu_pipeline_stats.pass = -1;
+  lu_pipeline_stats.per_mesh = per_mesh;
+  lu_pipeline_stats_on = enabled;
 }
 
-void lu_mesh_delete(lu_Mesh *mesh) {
-  if (!mesh) return;
-  lu_mesh_free(mesh);
-  glDeleteVertexArrays(1, &(mesh->VAO));
-  glDeleteBuffers(1, &(mesh->VBO));
+void lu_pipeline_stats_frame(void) {
+  if (!lu_pipeline_stats.initialised) return;
+  if (lu_pipeline_stats.pass_open) {
+    lu_log(LU_LOG_WARNING, "(lu_pipeline_stats_frame): A pass was left open at the end of the frame.\n");
+    lu_pipeline_pass_end();
+  }
+  lu_pipeline_segment_end();
+
+  lu_PipelineFrame *frame = &lu_pipeline_stats.frames[lu_query_ring_advance(&lu_pipeline_stats.ring, lu_pipeline_stats_resolve)];
+  frame->num_segments = 0;
+  memset(frame->pass_calls, 0, sizeof(frame->pass_calls));
 }
 
-static void lu_mesh_bind(lu_Mesh *mesh) {
-  glBindVertexArray(mesh->VAO);
-  if (!mesh) return;
-  glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
+bool lu_pipeline_pass_begin(const char *name) {
+  if (!lu_pipeline_stats.initialised || lu_pipeline_stats.pass_open) return false;
+  if (lu_pipeline_stats.ring.slot < 0) lu_pipeline_stats_frame();
+  int pass = lu_pipeline_pass_index(name);
+  if (pass < 0) lu_pipeline_stats.dropped_passes++;
+  else lu_pipeline_stats.frames[lu_pipeline_stats.ring.slot].pass_calls[pass]++;
+  lu_pipeline_stats.pass_open = true;
+  lu_pipeline_stats.pass = pass;
+  // With per mesh stats the draws inside get queries of their own instead
+  if (!lu_pipeline_stats.per_mesh && pass >= 0) lu_pipeline_segment_begin(pass, -1);
+  return true;
 }
 
-static void lu_mesh_unbind() {
-  glBindVertexArray(0);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
+bool lu_pipeline_pass_end(void) {
+  if (!lu_pipeline_stats.pass_open) return false;
+  if (!lu_pipeline_stats.per_mesh) lu_pipeline_segment_end();
+  lu_pipeline_stats.pass_open = false;
+  lu_pipeline_stats.pass = -1;
+  return true;
 }
 
-void lu_mesh_send(lu_Mesh *mesh) {
-  if (!mesh) return;
-  if (!mesh->data) return;
-  lu_mesh_bind(mesh);
-  glBufferData(GL_ARRAY_BUFFER, mesh->bytes_added, mesh->data, GL_STATIC_DRAW);
-  lu_mesh_unbind();
+static bool lu_pipeline_mesh_begin(const lu_Mesh *mesh) {
+  if (!lu_pipeline_stats.per_mesh || !mesh) return false;
+  if (lu_pipeline_stats.ring.slot < 0) lu_pipeline_stats_frame();
+  lu_pipeline_segment_begin(lu_pipeline_stats.pass, lu_pipeline_mesh_index(mesh->VBO));
+  return lu_pipeline_stats.counting;
 }
 
-void lu_mesh_render(lu_Mesh *mesh, GLenum render_mode) {
-  lu_mesh_bind(mesh);
-  glDrawArrays(render_mode, 0, mesh->bytes_added / mesh->stride);
-  lu_mesh_unbind();
+static void lu_pipeline_mesh_end(void) {
+  lu_pipeline_segment_end();
+}
+
+static void lu_pipeline_stats_copy_passes(lu_Stats *stats) {
+  pthread_mutex_lock(&lu_pipeline_stats_lock);
+  stats->num_passes = lu_pipeline_stats.num_passes;
+  memcpy(stats->passes, lu_pipeline_stats.passes, lu_pipeline_stats.num_passes * sizeof(lu_PipelineStats));
+  pthread_mutex_unlock(&lu_pipeline_stats_lock);
+}
+
+size_t lu_pipeline_stats_get_passes(const lu_PipelineStats **passes) {
+  if (passes) *passes = lu_pipeline_stats.passes;
+  return lu_pipeline_stats.num_passes;
+}
+
+size_t lu_pipeline_stats_get_meshes(const lu_PipelineStats **meshes) {
+  if (meshes) *meshes = lu_pipeline_stats.meshes;
+  return lu_pipeline_stats.num_meshes;
+}
+
+static void lu_pipeline_stats_print_row(FILE *out, const char *name, const lu_PipelineCounters *c) {
+  fprintf(out, "%-32s %12llu %12llu %12llu %12llu %12llu %12llu\n", name, (unsigned long long)c->vertices, (unsigned long long)c->primitives, (unsigned long long)c->vertex_invocations,
+          (unsigned long long)c->clipped_primitives, (unsigned long long)c->fragment_invocations, (unsigned long long)c->samples_passed);
+}
+
+void lu_pipeline_stats_print(FILE *out) {
+  if (!out) out = stdout;
+  fprintf(out, "%-32s %12s %12s %12s %12s %12s %12s (latest frame)\n", "Pass / mesh", "vertices", "primitives", "VS runs", "clipped", "FS runs", "samples");
+  for (size_t i = 0; i < lu_pipeline_stats.num_passes; i++) lu_pipeline_stats_print_row(out, lu_pipeline_stats.passes[i].name, &lu_pipeline_stats.passes[i].last);
+  for (size_t i = 0; i < lu_pipeline_stats.num_meshes; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "  mesh %u", lu_pipeline_stats.meshes[i].mesh);
+    lu_pipeline_stats_print_row(out, name, &lu_pipeline_stats.meshes[i].last);
+  }
+  if (lu_pipeline_stats.num_queries == 1) fprintf(out, "(no pipeline statistics queries, only samples are counted)\n");
+  if (lu_pipeline_stats.ring.dropped_frames || lu_pipeline_stats.dropped_passes)
+    fprintf(out, "(%llu frames not ready in time, %llu passes over the limit)\n", (unsigned long long)lu_pipeline_stats.ring.dropped_frames, (unsigned long long)lu_pipeline_stats.dropped_passes);
+}
+
+void lu_pipeline_stats_reset(void) {
+  pthread_mutex_lock(&lu_pipeline_stats_lock);
+  lu_pipeline_stats.num_passes = 0;
+  pthread_mutex_unlock(&lu_pipeline_stats_lock);
+  lu_pipeline_stats.num_meshes = 0;
+  lu_index_clear(&lu_pipeline_stats.mesh_index);
+  lu_pipeline_stats.pass = -1;
+  lu_pipeline_stats.dropped_passes = 0;
+  // Recorded frames would point at passes and meshes that are gone
+  lu_query_ring_reset(&lu_pipeline_stats.ring);
+}
+
+void lu_pipeline_stats_delete(void) {
+  lu_pipeline_stats_on = false;
+  lu_pipeline_segment_end();
+  for (int i = 0; i < LU_QUERY_RING_FRAMES; i++) {
+    lu_PipelineFrame *frame = &lu_pipeline_stats.frames[i];
+    if (frame->capacity) glDeleteQueries((GLsizei)(frame->capacity * lu_pipeline_stats.num_queries), frame->queries);
+    free(frame->queries);
+    free(frame->segments);
+  }
+  free(lu_pipeline_stats.meshes);
+  free(lu_pipeline_stats.mesh_resolved);
+  lu_index_free(&lu_pipeline_stats.mesh_index);
+  pthread_mutex_lock(&lu_pipeline_stats_lock);
+  memset(&lu_pipeline_stats, 0, sizeof(lu_pipeline_stats));
+  pthread_mutex_unlock(&lu_pipeline_stats_lock);
+  lu_pipeline_stats.ring.slot = -1;
+  lu_pipeline_stats.pass = -1;
 }
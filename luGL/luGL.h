@@ -20,15 +20,420 @@ typedef struct {
   size_t bytes_added;
   size_t stride;
   unsigned int VAO, VBO;
+  bool shared_vao; // VAO comes from a lu_VertexLayout and is shared with other meshes
+  struct lu_MeshStreams *soa; // Non NULL for meshes made with lu_mesh_create_soa
 } lu_Mesh;
 
+// Most attributes a lu_VertexLayout can have
+#define LU_MAX_VERTEX_ATTRIBS 16
+
+// One vertex attribute, count components of type (GL_FLOAT, GL_HALF_FLOAT, GL_SHORT, GL_INT_2_10_10_10_REV, ...)
+typedef struct {
+  GLint count;
+  GLenum type;
+  GLboolean normalized; // Integer types are mapped to 0-1 (unsigned) or -1-1 (signed) floats instead of converted directly
+  bool integer;         // Integer types are read as ivec/uvec in the shader instead of converted to float
+} lu_VertexAttrib;
+
+// A 16 byte vertex made by lu_quantize_vertices, half the size of the usual float position, normal and tex coord
+typedef struct {
+  uint16_t position[4]; // Position in 0-65535 across the mesh bounds (w is always 65535)
+  int16_t normal[2];    // Octahedral encoded normal
+  uint16_t tex_coord[2]; // Half floats
+} lu_PackedVertex;
+
+// How to get real positions back from a lu_PackedVertex: position = packed * scale + offset (with packed read as normalized 0-1)
+typedef struct {
+  float position_scale[3];
+  float position_offset[3];
+} lu_QuantizeInfo;
+
+// Offset to pass to lu_quantize_vertices for attributes a vertex doesn't have
+#define LU_ATTRIB_NONE ((size_t)-1)
+
+// A vertex format shared by every mesh created with it, see lu_vertex_layout_create
+typedef struct {
+  size_t num_attribs;
+  lu_VertexAttrib attribs[LU_MAX_VERTEX_ATTRIBS];
+  size_t offsets[LU_MAX_VERTEX_ATTRIBS];
+  size_t stride;
+  uint64_t hash;
+  GLuint VAO;
+} lu_VertexLayout;
+
+// A huge image streamed in as fixed size tiles, see lu_vt_open
+typedef struct lu_VirtualTexture lu_VirtualTexture;
+
+// Tile streaming counters for a lu_VirtualTexture, the first six are reset by lu_vt_begin_frame
+typedef struct {
+  size_t requests, hits, misses; // Tile requests this frame, and how many were already resident
+  size_t uploads, upload_bytes;  // Tiles uploaded to the cache this frame, and bytes uploaded counting the page table too
+  size_t evictions;              // Tiles kicked out of the cache this frame
+  size_t total_requests, total_hits, total_upload_bytes;
+} lu_VTStats;
+
+// Hands lu_vt_build_rows num_rows rows of the source image starting at row y, as tightly packed RGBA8. Returns false to give up.
+typedef bool (*lu_VTRowReader)(void *user, uint32_t y, uint32_t num_rows, uint8_t *rows);
+
+// A decoded image, pixels are tightly packed rows of channels values of type
+// GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT (16 bit images) or GL_HALF_FLOAT (HDR images)
+typedef struct {
+  void *pixels;
+  int width, height, channels;
+  GLenum type;
+} lu_Image;
+
+// Keeps textures under a GPU memory budget, see lu_texture_manager_create
+typedef struct lu_TextureManager lu_TextureManager;
+
+// Residency numbers for a lu_TextureManager
+typedef struct {
+  size_t budget_bytes, resident_bytes; // GPU memory allowed and used, including mip levels
+  size_t cache_bytes;                  // CPU memory used by decoded copies
+  size_t num_textures;                 // Loaded textures, split into:
+  size_t num_resident, num_reduced, num_evicted; // full resolution, missing top mip levels, and not on the GPU at all
+  size_t reductions, evictions, reloads;         // Running totals
+} lu_TextureManagerStats;
+
+// Counters for lu_texture_acquire/lu_texture_release
+typedef struct {
+  size_t acquires;                 // Calls to lu_texture_acquire
+  size_t loads;                    // Acquires that actually had to decode and upload the file
+  size_t duplicates;               // Acquires that got an already loaded texture instead
+  size_t bytes_saved;              // GPU bytes those duplicates would have cost
+  size_t live_textures, live_bytes; // Textures currently held
+} lu_TextureRegistryStats;
+
+// Textures at or below this size (in both dimensions) are evicted instead of losing more mip levels
+#define LU_TEXTURE_MANAGER_MIN_SIZE 32
+
+// A program linked from a single shader stage with GL_PROGRAM_SEPARABLE, see lu_create_stage_program
+typedef struct {
+  GLuint program;
+  GLbitfield stages; // GL_VERTEX_SHADER_BIT, GL_FRAGMENT_SHADER_BIT, ...
+} lu_StageProgram;
+
+// How deep #includes can nest before luGL assumes there's a cycle
+#define LU_MAX_INCLUDE_DEPTH 32
+
+// Number of stage bits a program pipeline can have
+#define LU_MAX_STAGES 6
+
+// Running totals of shader work
+typedef struct {
+  size_t compiles;         // Shaders compiled
+  size_t links;            // Programs linked, monolithic or separable
+  size_t spirv_shaders;    // SPIR-V modules loaded (these don't count as compiles)
+  size_t pipelines;        // Program pipelines created
+  size_t pipeline_lookups; // Calls to lu_get_program_pipeline
+} lu_ShaderStats;
+
+// Most members a lu_UniformLayout can have
+#define LU_MAX_UNIFORM_MEMBERS 32
+// Most frames a lu_UniformRing can keep in flight
+#define LU_MAX_FRAMES_IN_FLIGHT 4
+
+// Where each member of a uniform block lives under std140 rules, see lu_uniform_layout_create
+typedef struct {
+  size_t num_members;
+  size_t size; // Size of the whole block in bytes
+  size_t offsets[LU_MAX_UNIFORM_MEMBERS];
+  GLenum types[LU_MAX_UNIFORM_MEMBERS];
+  size_t counts[LU_MAX_UNIFORM_MEMBERS];          // Array length, 1 for non arrays
+  size_t columns[LU_MAX_UNIFORM_MEMBERS];         // 3 or 4 for matrices, 1 otherwise
+  size_t element_sizes[LU_MAX_UNIFORM_MEMBERS];   // Size of one vector in C
+  size_t element_strides[LU_MAX_UNIFORM_MEMBERS]; // Distance between vectors in the block
+} lu_UniformLayout;
+
+// A piece of a lu_UniformRing handed out for one draw
+typedef struct {
+  uint8_t *data; // Write the block here, NULL if the allocation failed
+  GLintptr offset;
+  GLsizeiptr size;
+} lu_UniformAlloc;
+
+// A big uniform buffer split into one region per frame in flight, see lu_uniform_ring_create
+typedef struct {
+  GLuint buffer;
+  uint8_t *mapped;
+  bool persistent;
+  GLint alignment; // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+  size_t size, frame_size, head;
+  int frames_in_flight, frame;
+  GLsync fences[LU_MAX_FRAMES_IN_FLIGHT];
+} lu_UniformRing;
+
+// Timings for one frame from a lu_Frame, filled in once the GPU has finished it
+typedef struct {
+  uint64_t frame;    // Which frame these are for, counting from 0
+  double cpu_ms;     // lu_frame_begin to lu_frame_end, not counting the swap or time spent waiting
+  double gpu_ms;     // GPU time for the frame's commands (0 without timer queries)
+  double wait_ms;    // Time lu_frame_begin spent in the frame limiter and waiting for older frames
+  double latency_ms; // lu_frame_begin until the CPU saw the GPU finish the frame and its swap
+} lu_FrameStats;
+
+// Paces a render loop, see lu_frame_create
+typedef struct {
+  GLFWwindow *window; // Swapped by lu_frame_end, NULL to just flush (headless)
+  int frames_in_flight;
+  int slot; // Slot of the frame being recorded, -1 before the first lu_frame_begin
+  uint64_t frame_number;
+  double min_frame_ms;  // From lu_frame_set_limit, 0 for no limit
+  double next_begin_ms; // When the limiter lets the next frame begin
+  void (*latch)(void *data);
+  void *latch_data;
+  GLsync fences[LU_MAX_FRAMES_IN_FLIGHT];
+  GLuint queries[LU_MAX_FRAMES_IN_FLIGHT][2]; // Timestamps at the start and end of each frame
+  double begin_ms[LU_MAX_FRAMES_IN_FLIGHT];
+  lu_FrameStats pending[LU_MAX_FRAMES_IN_FLIGHT]; // Numbers for frames still in flight
+  lu_FrameStats stats;                            // The latest frame the GPU has finished
+} lu_Frame;
+
+// Most GPU scopes the profiler records per frame, and the most distinct scopes it keeps stats for
+#define LU_GPU_MAX_SCOPES 256
+// Deepest GPU scopes can nest
+#define LU_GPU_MAX_DEPTH 32
+
+// GPU time for one scope in the profiler's tree. Times are per frame, adding up every time the scope ran that frame.
+typedef struct {
+  const char *name;
+  int parent; // Index of the enclosing scope, -1 for top level scopes
+  int depth;
+  uint64_t frames; // Frames the scope showed up in
+  uint64_t calls;
+  double last_ms, min_ms, avg_ms, max_ms, total_ms;
+} lu_GpuScopeStats;
+
+// Structured buffers track dirty data in pages of this many bytes
+#define LU_STRUCTURED_PAGE_BYTES 4096
+
+// An array of C structs mirrored in a shader storage buffer, see lu_structured_buffer_create
+typedef struct {
+  GLuint buffer;
+  uint8_t *data; // CPU copy, count * stride bytes
+  size_t stride, count;
+  uint64_t *dirty; // One bit per page that changed since the last upload
+  size_t num_pages;
+  bool any_dirty;
+} lu_StructuredBuffer;
+
+// Flags for lu_load_texture
+#define LU_TEXTURE_FLIP_Y (1u << 0)  // Flip the image vertically on load, so the first row is the bottom like OpenGL expects
+#define LU_TEXTURE_SRGB (1u << 1)    // The image's colour channels are sRGB encoded (RGB and RGBA images only)
+#define LU_TEXTURE_MIPMAPS (1u << 2) // Generate mipmaps after uploading
+
+// Swap intervals for lu_ContextOptions
+typedef enum {
+  LU_VSYNC_DEFAULT,  // Whatever the driver does
+  LU_VSYNC_OFF,      // Swap straight away
+  LU_VSYNC_ON,       // Wait for the vertical blank
+  LU_VSYNC_ADAPTIVE, // Wait for the vertical blank unless the frame is late
+} lu_Vsync;
+
+// How to create a context, see lu_create_window_ex. All zeros gives the driver's default context, like lu_create_window.
+typedef struct {
+  int gl_major, gl_minor; // OpenGL version to ask for, 0 for the default
+  bool core_profile;      // Core profile (forward compatible, so it works on macOS too), needs 3.2+ and asks for 3.3 if gl_major is 0
+  bool debug;             // Debug context, for KHR_debug output
+  bool no_error;          // KHR_no_error context: errors are undefined behaviour instead of being checked. Can't be combined with debug.
+  bool srgb;              // sRGB capable framebuffer, and GL_FRAMEBUFFER_SRGB enabled
+  int samples;            // MSAA samples for the default framebuffer, 0 for none
+  lu_Vsync vsync;
+} lu_ContextOptions;
+
+// How serious a log message is
+typedef enum {
+  LU_LOG_INFO,
+  LU_LOG_WARNING,
+  LU_LOG_PERFORMANCE, // The driver doing something slow behind your back (buffer migrations, shader recompiles, stalls)
+  LU_LOG_ERROR,
+} lu_LogSeverity;
+
+// Gets every message luGL logs, and the driver's KHR_debug errors and performance warnings on debug contexts. message has no trailing
+// newline. Can be called from any thread that uses luGL, including upload workers and the driver's own threads.
+typedef void (*lu_LogCallback)(lu_LogSeverity severity, const char *message, void *user);
+
+// An OpenGL context with no window, rendering into its own framebuffer, see lu_create_headless_context
+typedef struct lu_HeadlessContext lu_HeadlessContext;
+
+// Worker threads with their own shared contexts that run upload jobs, see lu_upload_queue_create
+typedef struct lu_UploadQueue lu_UploadQueue;
+// One job given to a lu_UploadQueue
+typedef struct lu_UploadJob lu_UploadJob;
+// An upload job, run on a worker thread with a context that shares objects with the main one. Returns whatever object it made (or 0).
+typedef GLuint (*lu_UploadFunc)(void *data);
+
+// Kinds of GL object counted by the LU_DEBUG_OBJECTS tracker
+typedef enum {
+  LU_OBJECT_BUFFER,
+  LU_OBJECT_VERTEX_ARRAY,
+  LU_OBJECT_TEXTURE,
+  LU_OBJECT_FRAMEBUFFER,
+  LU_OBJECT_RENDERBUFFER,
+  LU_OBJECT_QUERY,
+  LU_OBJECT_PIPELINE,
+  LU_OBJECT_SHADER,
+  LU_OBJECT_PROGRAM,
+  LU_OBJECT_SYNC,
+  LU_OBJECT_TYPE_COUNT
+} lu_ObjectType;
+
+// Per type object counts from the LU_DEBUG_OBJECTS tracker
+typedef struct {
+  size_t created[LU_OBJECT_TYPE_COUNT];
+  size_t deleted[LU_OBJECT_TYPE_COUNT];
+  size_t live[LU_OBJECT_TYPE_COUNT];
+  size_t bad_deletes[LU_OBJECT_TYPE_COUNT]; // Deletes of names luGL never made (or already deleted)
+} lu_ObjectStats;
+
+// luGL calls counted by the LU_INSTRUMENT counters
+typedef enum {
+  LU_STAT_CREATE_SHADER_PROGRAM,
+  LU_STAT_COMPILE_SHADER,
+  LU_STAT_MESH_ADD_BYTES,
+  LU_STAT_MESH_SEND,
+  LU_STAT_MESH_RENDER, // lu_mesh_render, lu_mesh_render_instanced and lu_mesh_render_many
+  LU_STAT_IMAGE_LOAD,
+  LU_STAT_TEXTURE_FROM_IMAGE,
+  LU_STAT_LOAD_TEXTURE,
+  LU_STAT_UNIFORM_RING_ALLOC,
+  LU_STAT_STRUCTURED_BUFFER_UPLOAD,
+  LU_STAT_VT_UPDATE,
+  LU_STAT_DISPATCH_COMPUTE,
+  LU_STAT_UPLOAD_JOB, // Jobs run by lu_UploadQueue workers
+  LU_STAT_READ_PIXELS,
+  LU_STAT_COUNT
+} lu_StatId;
+
+// Totals for one luGL call
+typedef struct {
+  uint64_t calls;
+  uint64_t bytes; // Data the call loaded, copied or uploaded
+  uint64_t ns;    // Wall clock time spent inside the call (CPU side, GPU work isn't waited for)
+} lu_StatCounter;
+
+// Most named passes the pipeline statistics keep numbers for
+#define LU_PIPELINE_MAX_PASSES 32
+
+// What the GPU did, from ARB_pipeline_statistics_query and occlusion queries. Without pipeline statistics queries (before GL 4.6), only
+// samples_passed is filled in.
+typedef struct {
+  uint64_t vertices;             // Vertices submitted
+  uint64_t primitives;           // Primitives submitted
+  uint64_t vertex_invocations;   // Vertex shader runs, fewer than vertices when the post transform cache hits
+  uint64_t clipped_primitives;   // Primitives left after clipping (back faces are culled after this)
+  uint64_t fragment_invocations; // Fragment shader runs
+  uint64_t samples_passed;       // Samples that passed the depth and stencil tests
+} lu_PipelineCounters;
+
+// Pipeline statistics for one named pass or one mesh, see lu_pipeline_stats_enable
+typedef struct {
+  const char *name;          // Pass name, NULL for meshes
+  GLuint mesh;               // Mesh's VBO, 0 for passes
+  uint64_t frames;           // Frames it showed up in
+  uint64_t calls;            // Times the pass ran or the mesh was drawn
+  lu_PipelineCounters last;  // The latest frame that was read back, added up over every time it ran that frame
+  lu_PipelineCounters total; // Everything since the stats were enabled or reset
+} lu_PipelineStats;
+
+// Snapshot of the LU_INSTRUMENT counters summed over every thread, and of the pipeline statistics, see lu_stats_snapshot
+typedef struct {
+  double time;    // CLOCK_MONOTONIC seconds when the snapshot was taken
+  size_t threads; // Threads that have made a counted call
+  lu_StatCounter counters[LU_STAT_COUNT];
+  size_t num_passes; // Passes the pipeline statistics have seen
+  lu_PipelineStats passes[LU_PIPELINE_MAX_PASSES];
+} lu_Stats;
+
+// GL functions the LU_TRACE tracer records that GLEW loads through function pointers, which lu_trace_start swaps for its own
+#define LU_TRACE_GLEW_CALLS(X)                                                                                                             \
+  X(ActiveTexture) X(AttachShader) X(BeginQuery) X(BindBuffer) X(BindBufferBase) X(BindBufferRange) X(BindFramebuffer)                    \
+  X(BindProgramPipeline) X(BindRenderbuffer) X(BindVertexArray) X(BindVertexBuffer) X(BufferData) X(BufferStorage) X(BufferSubData)       \
+  X(CheckFramebufferStatus) X(ClientWaitSync) X(CompileShader) X(CopyImageSubData) X(CreateProgram) X(CreateShader) X(DeleteBuffers)      \
+  X(DeleteFramebuffers) X(DeleteProgram) X(DeleteProgramPipelines) X(DeleteQueries) X(DeleteRenderbuffers) X(DeleteShader) X(DeleteSync)  \
+  X(DeleteVertexArrays) X(DetachShader) X(DisableVertexAttribArray) X(DispatchCompute) X(DrawArraysInstanced) X(EnableVertexAttribArray)  \
+  X(EndQuery) X(FenceSync) X(FramebufferRenderbuffer) X(GenBuffers) X(GenFramebuffers) X(GenProgramPipelines) X(GenQueries)               \
+  X(GenRenderbuffers) X(GenVertexArrays) X(GenerateMipmap) X(GetProgramInfoLog) X(GetProgramPipelineInfoLog) X(GetProgramPipelineiv)      \
+  X(GetProgramiv) X(GetQueryObjectui64v) X(GetQueryObjectuiv) X(GetShaderInfoLog) X(GetShaderiv) X(GetUniformBlockIndex)                  \
+  X(GetUniformLocation) X(IsBuffer) X(IsVertexArray) X(LinkProgram) X(MapBufferRange) X(MemoryBarrier) X(ProgramParameteri)               \
+  X(QueryCounter) X(RenderbufferStorage) X(ShaderBinary) X(ShaderSource) X(SpecializeShader) X(SpecializeShaderARB) X(Uniform1f)          \
+  X(Uniform1i) X(Uniform2f) X(Uniform3f) X(Uniform4f) X(UniformBlockBinding) X(UniformMatrix4fv) X(UnmapBuffer) X(UseProgram)             \
+  X(UseProgramStages) X(ValidateProgramPipeline) X(VertexAttribBinding) X(VertexAttribFormat) X(VertexAttribIFormat)                      \
+  X(VertexAttribPointer) X(WaitSync)
+
+// GL 1.1 functions the tracer records. GLEW doesn't load these, so luGL.h redirects them to wrappers instead (see the end of this file).
+#define LU_TRACE_GL11_CALLS(X)                                                                                                             \
+  X(BindTexture) X(BlendFunc) X(Clear) X(ClearColor) X(CullFace) X(DeleteTextures) X(DepthFunc) X(DepthMask) X(Disable) X(DrawArrays)    \
+  X(DrawElements) X(Enable) X(Finish) X(Flush) X(GenTextures) X(GetIntegerv) X(PixelStorei) X(ReadPixels) X(Scissor) X(TexImage2D)       \
+  X(TexParameteri) X(TexParameteriv) X(TexSubImage2D) X(Viewport)
+
+// Everything a trace record can be. New calls go on the end so older traces still replay.
+typedef enum {
+#define LU_TRACE_ENUM(name) LU_TRACE_gl##name,
+  LU_TRACE_GLEW_CALLS(LU_TRACE_ENUM) LU_TRACE_GL11_CALLS(LU_TRACE_ENUM)
+#undef LU_TRACE_ENUM
+  LU_TRACE_FRAME,        // lu_trace_frame, no arguments
+  LU_TRACE_BUFFER_WRITE, // lu_trace_buffer_write: buffer, offset, size and the bytes as payload
+  LU_TRACE_CALL_COUNT
+} lu_TraceCall;
+
+// Trace files start with these 8 bytes, then hold chunks, each a lu_TraceChunk followed by bytes of records. Every record is a
+// lu_TraceRecord, num_args 64 bit arguments (floats are stored as their bits, results of calls that return something come last) and the
+// payload (buffer data, pixels, shader source, generated names), padded to 8 bytes.
+#define LU_TRACE_MAGIC "luGLtrc2"
+
+typedef struct {
+  uint32_t thread; // Which thread wrote the chunk, records from one thread are in order
+  uint32_t bytes;
+} lu_TraceChunk;
+
+typedef struct {
+  uint16_t call; // lu_TraceCall
+  uint16_t num_args;
+  uint32_t payload_bytes;
+  uint64_t seq; // Order the call was made in across threads. Equal numbers all come from one thread, in the order they're in the file.
+} lu_TraceRecord;
+
 // Function prototypes
 
 // Creates and returns a pointer to a GLFWwindow
 GLFWwindow *lu_create_window(const char *window_title, int width, int height, bool fullscreen);
+// Like lu_create_window, with control over the context that's made (options can be NULL for the defaults).
+// GLFW is terminated again if anything fails, so it's safe to retry with different options.
+// For example, a 4.5 core context without error checking or vsync:
+//   lu_ContextOptions options = {.gl_major = 4, .gl_minor = 5, .core_profile = true, .no_error = true, .vsync = LU_VSYNC_OFF};
+//   GLFWwindow *window = lu_create_window_ex("Window", 800, 600, false, &options);
+GLFWwindow *lu_create_window_ex(const char *window_title, int width, int height, bool fullscreen, const lu_ContextOptions *options);
+// Creates an OpenGL context without a window or display, for servers and CI machines (e.g. Mesa's llvmpipe). Uses EGL's surfaceless
+// platform, so luGL.c has to be built with -DLU_HEADLESS and linked with -lEGL. A width x height RGBA8 framebuffer with depth and stencil
+// is made and left bound in place of the default framebuffer, and the rest of luGL works as usual. Returns NULL on failure.
+lu_HeadlessContext *lu_create_headless_context(int width, int height);
+// Like lu_create_headless_context with the version, profile, debug and no error settings from options. Without a version the newest
+// core context is used. srgb, samples and vsync don't apply to headless contexts.
+lu_HeadlessContext *lu_create_headless_context_ex(int width, int height, const lu_ContextOptions *options);
+// Creates another headless context sharing buffers, textures, shaders and syncs with share, e.g. one per thread making GL calls.
+// It isn't made current and has no framebuffer of its own, since framebuffers and vertex arrays aren't shared. Delete it before share.
+lu_HeadlessContext *lu_create_shared_headless_context(lu_HeadlessContext *share);
+// Makes a headless context current on the calling thread, false if EGL wouldn't
+bool lu_headless_make_current(lu_HeadlessContext *ctx);
+// Deletes a headless context and its framebuffer
+void lu_headless_context_delete(lu_HeadlessContext *ctx);
+// The framebuffer a headless context draws into, bind this wherever you'd bind 0 with a window
+GLuint lu_headless_framebuffer(lu_HeadlessContext *ctx);
+// Reads back an area of the bound read framebuffer as an RGBA8 image, top row first. Free it with lu_image_free.
+lu_Image lu_read_pixels(int x, int y, int width, int height);
+// Sends luGL's messages to callback instead of stderr, NULL goes back to printing them to stderr. On debug contexts (see
+// lu_ContextOptions) with GL 4.3 or KHR_debug, the driver's errors and performance warnings come through here too (high severity errors as
+// LU_LOG_ERROR, lower ones as warnings or info), and shaders, programs and textures loaded from files are labelled with their paths so
+// they show up by name in those messages and in tools like RenderDoc. That's per context, decided when luGL makes one current.
+// Set it before starting any other threads that use luGL.
+void lu_set_log_callback(lu_LogCallback callback, void *user);
 
 // Creates and returns a shader program given a number of shaders, and the locations of all those shaders as variadic args.
 // Fragment shaders must have the extension .frag, and .vert for vertex shaders.
+// Geometry shaders use .geom, tessellation control and evaluation shaders .tesc and .tese, and compute shaders .comp.
+// Precompiled SPIR-V modules are loaded when the name ends in .spv after the stage, e.g. "shaders/frag.frag.spv" (see lu_compile_spirv_shader).
+// Shaders can pull in other files with #include "file", relative to the including file.
 // For example, create_shader_program(2, "source/shaders/vertex_shader.vert", "source/shaders/fragment_shader.frag") would compile both vertex_shader.vert and fragment_shader.frag, and link them to
 // the shader program that is returned.
 GLuint lu_create_shader_program(size_t num_shaders, ...);
@@ -43,8 +448,27 @@ GLuint lu_create_shader_program(size_t num_shaders, ...);
 //	components_sizes should be {sizeof(float), sizeof(float)};
 //	component_counts should be {2, 3}
 //	and component_types should be {GL_FLOAT, GL_FLOAT}
+// Integer types are always converted to float without normalizing, use lu_vertex_layout_create for normalized, integer or packed attributes.
+// VAO and VBO should be 0 the first time. After that the same names are reused, so a VAO can be laid out again without leaking anything.
 void lu_define_layout(GLuint *VAO, GLuint *VBO, size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types);
 
+// Loads an image file into a new texture using stb_image.h, keeping the file's own channel count.
+// 8 bit grey images are stored as GL_R8, grey+alpha as GL_RG8, RGB as GL_RGB8 and RGBA as GL_RGBA8 (or the sRGB versions with LU_TEXTURE_SRGB).
+// 16 bit PNGs are stored as GL_R16 through GL_RGBA16, and HDR images are converted to half floats and stored as GL_R16F, GL_RG16F,
+// GL_R11F_G11F_B10F (no alpha) or GL_RGBA16F.
+// Grey images are swizzled so shaders still read (grey, grey, grey, alpha). flags is a combination of the LU_TEXTURE_* flags.
+// Returns 0 on failure.
+GLuint lu_load_texture(const char *texture_location, unsigned int flags);
+// Decodes an image file the same way lu_load_texture does, without uploading it. Only LU_TEXTURE_FLIP_Y matters here.
+bool lu_image_load(const char *image_location, unsigned int flags, lu_Image *image);
+// Frees the pixels of an image loaded with lu_image_load
+void lu_image_free(lu_Image *image);
+// Size of an image's pixel data in bytes
+size_t lu_image_bytes(const lu_Image *image);
+// Creates a texture from a decoded image, see lu_load_texture for the formats used
+GLuint lu_texture_from_image(const lu_Image *image, unsigned int flags);
+// Converts count floats to half floats, using F16C instructions when the CPU has them
+void lu_float_to_half(uint16_t *dst, const float *src, size_t count);
 // Loads a texture image into memory using stb_image.h, and sends it as a uniform to a shader program with the name in texture_uniform_name.
 unsigned int lu_send_uniform_texture(char *texture_location, GLuint shader_program, char *texture_uniform_name);
 // Create a mesh with the specified vertex layout
@@ -57,7 +481,507 @@ void lu_mesh_free(lu_Mesh *mesh);
 void lu_mesh_delete(lu_Mesh *mesh);
 // Render a mesh
 void lu_mesh_render(lu_Mesh *mesh, GLenum render_mode);
+// Render a list of meshes, only rebinding the VAO when it changes (meshes sharing a layout just swap vertex buffers)
+void lu_mesh_render_many(lu_Mesh *meshes, size_t num_meshes, GLenum render_mode);
+// Render instance_count copies of a mesh, shaders can tell them apart with gl_InstanceID
+void lu_mesh_render_instanced(lu_Mesh *mesh, GLenum render_mode, size_t instance_count);
 // Send a mesh to the GPU
 void lu_mesh_send(lu_Mesh *mesh);
+// Allocates n_bytes of uninitialised GPU storage for a mesh, for a compute shader to fill in. lu_mesh_render will draw n_bytes / stride vertices.
+void lu_mesh_allocate(lu_Mesh *mesh, size_t n_bytes);
+// Binds a mesh's vertex buffer as a shader storage buffer, so compute shaders can read and write its vertices.
+// The buffer block has to match the vertex layout under std430 rules (watch out for vec3, which is aligned to 16 bytes).
+void lu_mesh_bind_storage(lu_Mesh *mesh, GLuint binding);
+// Changes the vertex layout of a mesh in place, keeping its VAO and VBO. Data already sent is read with the new layout until the next
+// lu_mesh_send. SoA meshes lose their CPU copy, since its streams were split for the old layout. Meshes with a shared layout can't be relaid out.
+void lu_mesh_relayout(lu_Mesh *mesh, size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types);
+
+// Structure of arrays meshes. lu_mesh_create_soa takes the same arguments as lu_mesh_create, and lu_mesh_add_bytes still takes whole
+// interleaved vertices, but each component is kept in its own tightly packed stream, on the CPU and in the VBO. Passes that only touch
+// one component (bounds, skinning, depth only) then read just that stream. Shaders don't need to change.
+lu_Mesh lu_mesh_create_soa(size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types);
+// Returns the CPU copy of one component's stream of a SoA mesh (NULL for interleaved meshes or after lu_mesh_free), and how many vertices it has
+void *lu_mesh_stream(lu_Mesh *mesh, size_t component, size_t *num_vertices);
+// Like lu_define_layout, but for num_vertices vertices stored as one stream per component, one after another in the VBO.
+// VAO and VBO are made if they're 0, and reused otherwise.
+void lu_define_soa_layout(GLuint *VAO, GLuint *VBO, size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types, size_t num_vertices);
+// Splits num_vertices interleaved vertices into one stream per component, written one after another to dst.
+// component_bytes holds the size of each component in a vertex (size * count).
+void lu_aos_to_soa(const void *src, size_t num_vertices, size_t num_components, const size_t *component_bytes, void *dst);
+// Interleaves streams made by lu_aos_to_soa back into whole vertices
+void lu_soa_to_aos(const void *src, size_t num_vertices, size_t num_components, const size_t *component_bytes, void *dst);
+
+// Virtual textures, for images bigger than GL_MAX_TEXTURE_SIZE.
+// The image is cut offline into a pyramid of tile_size x tile_size RGBA8 tiles (lu_vt_build). At runtime only the tiles that get requested are
+// read from disk by a background thread and uploaded into a fixed size cache texture, and a page table texture maps virtual tiles to cache slots.
+// Tiles that aren't resident yet fall back to the nearest resident coarser tile. The shader side looks something like:
+//   uniform sampler2D lu_vt_page_table, lu_vt_cache;
+//   uniform vec4 lu_vt_params; // (pyramid tiles per side, cache tiles per side, uv scale x, uv scale y)
+//   vec4 lu_vt_sample(vec2 uv, float lod) {
+//     vec2 vuv = uv * lu_vt_params.zw;
+//     vec4 e = textureLod(lu_vt_page_table, vuv, lod) * 255.0;
+//     vec2 in_tile = fract(vuv * (lu_vt_params.x / exp2(e.z)));
+//     return textureLod(lu_vt_cache, (e.xy + in_tile) / lu_vt_params.y, 0.0);
+//   }
+// Tiles have no filtering border, so bilinear filtering will bleed across tile edges.
+
+// Cuts the image at image_location into a tile pyramid and writes it to vt_location. stb_image decodes the whole image at once, so it has to
+// fit in memory and its RGBA8 size has to stay under 2 GiB (about 23000 x 23000), bigger images need lu_vt_build_rows.
+bool lu_vt_build(const char *image_location, const char *vt_location, int tile_size);
+// Like lu_vt_build, but for a width x height image read a strip at a time through read_rows, so only about
+// 2 * width * tile_size * 4 bytes are held in memory whatever the height. Sizes up to 2^24 tiles across work.
+bool lu_vt_build_rows(const char *vt_location, uint32_t width, uint32_t height, int tile_size, lu_VTRowReader read_rows, void *user);
+// Opens a tile file made with lu_vt_build, with a cache of cache_tiles_per_side x cache_tiles_per_side tiles. Returns NULL on failure.
+lu_VirtualTexture *lu_vt_open(const char *vt_location, int cache_tiles_per_side);
+// Stops the loader thread and deletes all textures
+void lu_vt_delete(lu_VirtualTexture *vt);
+// Starts a new frame, tiles used in the current frame are never evicted
+void lu_vt_begin_frame(lu_VirtualTexture *vt);
+// Asks for a single tile, if it isn't resident it is queued for loading
+void lu_vt_request_tile(lu_VirtualTexture *vt, int level, int x, int y);
+// Asks for every tile of a level covering the image space rectangle (u0, v0)-(u1, v1)
+void lu_vt_request_region(lu_VirtualTexture *vt, float u0, float v0, float u1, float v1, int level);
+// Asks for tiles read back from a feedback pass, one RGBA8 pixel per request:
+// R = x & 0xff, G = y & 0xff, B = (x >> 8) | ((y >> 8) << 4), A = level + 1 (0 for no request)
+void lu_vt_request_feedback(lu_VirtualTexture *vt, const uint8_t *feedback, size_t num_pixels);
+// Uploads tiles the loader has finished (at most max_uploads, 0 for no limit, the rest wait for the next update) and refreshes the page table
+void lu_vt_update(lu_VirtualTexture *vt, size_t max_uploads);
+// Binds the page table and cache to the given texture units and sets the lu_vt_* uniforms of shader_program
+void lu_vt_bind(lu_VirtualTexture *vt, GLuint shader_program, GLuint page_table_unit, GLuint cache_unit);
+// Returns the streaming counters
+lu_VTStats lu_vt_get_stats(const lu_VirtualTexture *vt);
+
+// Texture manager. Loaded textures are counted by their size on the GPU (including mips), and when the total goes over budget the least
+// recently used ones first lose their top mip levels (GL 4.3+) and then get evicted completely. A decoded copy of every image is kept in
+// memory, so using a shrunk or evicted texture again reuploads it without going back to the file.
+// Textures used since the last lu_texture_manager_begin_frame are never touched, so their GL names stay valid for the frame.
+
+// Creates a texture manager with a budget in bytes
+lu_TextureManager *lu_texture_manager_create(size_t budget_bytes);
+// Deletes every texture and decoded copy
+void lu_texture_manager_delete(lu_TextureManager *manager);
+// Loads an image (see lu_load_texture, LU_TEXTURE_MIPMAPS is always added) and returns a handle to it, or -1 on failure
+int lu_texture_manager_load(lu_TextureManager *manager, const char *texture_location, unsigned int flags);
+// Deletes a texture and its decoded copy, the handle can be reused by a later load
+void lu_texture_manager_unload(lu_TextureManager *manager, int handle);
+// Marks a texture as used, bringing it back to full resolution if needed, and returns its GL name.
+// The name can change between frames, so call this every frame rather than keeping it.
+GLuint lu_texture_manager_use(lu_TextureManager *manager, int handle);
+// Starts a new frame
+void lu_texture_manager_begin_frame(lu_TextureManager *manager);
+// Changes the budget, shrinking or evicting textures straight away if needed
+void lu_texture_manager_set_budget(lu_TextureManager *manager, size_t budget_bytes);
+// Returns the current residency numbers
+lu_TextureManagerStats lu_texture_manager_get_stats(const lu_TextureManager *manager);
+
+// Texture registry. Textures are shared by canonical path and load flags, so loading the same file twice only decodes and uploads it once.
+// Lookups of a path string that has been seen before are a single hash table probe (relative ones are keyed together with the working
+// directory, so they still find the right file after a chdir), cheap enough to do every frame.
+// Not thread safe, only use it from the thread that owns the GL context.
+
+// Returns the texture for texture_location loaded with flags (see lu_load_texture), loading it the first time and adding a reference otherwise.
+// Returns 0 on failure.
+GLuint lu_texture_acquire(const char *texture_location, unsigned int flags);
+// Drops a reference to a texture from lu_texture_acquire, deleting it when nothing holds it anymore
+void lu_texture_release(GLuint texture);
+// Returns the registry counters, bytes_saved is how much duplicate loads would have cost
+lu_TextureRegistryStats lu_texture_registry_get_stats(void);
+
+// SPIR-V. Needs GL 4.6 or ARB_gl_spirv, the module's entry point must be called main.
+// When the driver can't take SPIR-V, the GLSL file with the .spv taken off the name is compiled instead, with each specialization constant
+// passed in as a "#define LU_CONSTANT_<id> <value>".
+
+// Returns true if the current context can load SPIR-V modules
+bool lu_spirv_supported(void);
+// Loads a SPIR-V module (e.g. "light.frag.spv") into a new shader object, setting num_constants specialization constants.
+// Returns 0 on failure.
+GLuint lu_compile_spirv_shader(const char *shader_file_location, size_t num_constants, const GLuint *constant_ids, const GLuint *constant_values);
+
+// Separable programs. Instead of linking a program for every vertex/fragment combination, each stage is compiled and linked once on its own,
+// and combinations are put together at bind time with program pipeline objects. Needs GL 4.1 or ARB_separate_shader_objects.
+// Uniforms of separable programs are set with glProgramUniform*, since the pipeline isn't a program glUniform* can target.
+
+// Compiles a single shader (same extensions as lu_create_shader_program) into a separable program. program is 0 on failure.
+lu_StageProgram lu_create_stage_program(const char *shader_file_location);
+// Returns the stage bit for a shader type, e.g. GL_VERTEX_SHADER_BIT for GL_VERTEX_SHADER
+GLbitfield lu_shader_stage_bit(GLenum shader_type);
+// Returns a program pipeline using the given stage programs, creating it the first time a combination is asked for.
+// Returns 0 if the combination doesn't validate.
+GLuint lu_get_program_pipeline(size_t num_programs, const lu_StageProgram *programs);
+// Binds a program pipeline, unbinding any program from glUseProgram so the pipeline is actually used
+void lu_bind_program_pipeline(GLuint pipeline);
+// Deletes every cached pipeline, the stage programs themselves are left alone
+void lu_clear_program_pipelines(void);
+// Deletes a stage program along with every cached pipeline that uses it. Use this rather than glDeleteProgram, since pipelines are
+// cached by program name and a later program given the same name would otherwise get the stale pipeline.
+void lu_stage_program_delete(lu_StageProgram *program);
+// Returns the running totals of compiles, links and pipelines
+lu_ShaderStats lu_get_shader_stats(void);
+
+// Shader variants. One shader file can be compiled with different sets of #defines, which are added after its #version line.
+// Variants are only compiled the first time they're asked for, and variants whose preprocessed source comes out identical share one shader.
+
+// Returns the shader for a file compiled with the given defines ("NAME" or "NAME=VALUE"), compiling it on first use. Returns 0 on failure.
+// The shader belongs to the variant cache, don't delete it.
+GLuint lu_get_shader_variant(const char *shader_file_location, size_t num_defines, const char *const *defines);
+// Links a program from already compiled shaders, without deleting them. Returns 0 on failure.
+GLuint lu_link_shader_program(size_t num_shaders, const GLuint *shaders);
+// Prints every variant with how often it was requested and how long it took to compile
+void lu_shader_variant_report(FILE *out);
+// Deletes every cached variant
+void lu_clear_shader_variants(void);
+
+// Compute. These need GL 4.3 or ARB_compute_shader.
+// After a compute shader writes vertices that lu_mesh_render will draw, pass GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT as the barrier.
+
+// Runs a compute program with the given number of work groups, then issues glMemoryBarrier(barriers) if barriers isn't 0
+void lu_dispatch_compute(GLuint shader_program, GLuint groups_x, GLuint groups_y, GLuint groups_z, GLbitfield barriers);
+// Runs a 1D compute program over num_items items, rounding up to whole work groups of the program's local_size_x
+void lu_dispatch_compute_items(GLuint shader_program, size_t num_items, GLbitfield barriers);
+// Makes writes from shaders visible to later commands of the types in barriers (GL_*_BARRIER_BIT)
+void lu_memory_barrier(GLbitfield barriers);
+
+// Uniform buffers. Instead of a pile of glUniform calls per draw, each draw's uniforms are written as one std140 block into a ring buffer and
+// bound with glBindBufferRange. The ring is mapped persistently (GL 4.4 or ARB_buffer_storage) and split into one region per frame in flight,
+// with a fence per region so the CPU never overwrites uniforms the GPU hasn't read yet.
+// For example, for this block:
+//   layout(std140) uniform Object { mat4 model; vec3 colour; float lights[4]; };
+// member_types should be {GL_FLOAT_MAT4, GL_FLOAT_VEC3, GL_FLOAT}
+// and array_counts should be {1, 1, 4} (or NULL if nothing is an array)
+
+// Works out std140 offsets for a block with the given member types (GL_FLOAT, GL_FLOAT_VEC3, GL_FLOAT_MAT4, ...).
+// Returns a layout with num_members 0 on failure.
+lu_UniformLayout lu_uniform_layout_create(size_t num_members, const GLenum *member_types, const size_t *array_counts);
+// Copies a member's value from tightly packed C data (e.g. float[4] for a float[4] member) into its std140 position in block
+void lu_uniform_layout_write(const lu_UniformLayout *layout, void *block, size_t member, const void *value);
+// Creates a uniform ring with bytes_per_frame of space for each of frames_in_flight frames
+lu_UniformRing lu_uniform_ring_create(size_t bytes_per_frame, int frames_in_flight);
+// Deletes the ring's buffer and fences
+void lu_uniform_ring_delete(lu_UniformRing *ring);
+// Moves on to the next frame's region, waiting for the GPU if it's still using it
+void lu_uniform_ring_begin_frame(lu_UniformRing *ring);
+// Fences the current frame's region, call after the frame's last draw
+void lu_uniform_ring_end_frame(lu_UniformRing *ring);
+// Hands out size bytes of the current frame's region, aligned to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+lu_UniformAlloc lu_uniform_ring_alloc(lu_UniformRing *ring, size_t size);
+// Binds an allocation to a uniform buffer binding point
+void lu_uniform_ring_bind(lu_UniformRing *ring, GLuint binding, lu_UniformAlloc alloc);
+// Points a program's uniform block at a binding point
+void lu_bind_uniform_block(GLuint shader_program, const char *block_name, GLuint binding);
+
+// Structured buffers, for per object data too big for uniform buffers. Needs GL 4.3 or ARB_shader_storage_buffer_object.
+// The C struct has to match the shader's std430 layout, e.g. for
+//   struct Object { mat4 model; vec4 colour; };
+//   layout(std430, binding = 0) readonly buffer Objects { Object objects[]; };
+// a C struct of float model[16] and float colour[4] lines up, while a vec3 would need a float of padding after it.
+// Shaders index it with gl_InstanceID when drawn with lu_mesh_render_instanced.
+
+// Creates a structured buffer of count elements of stride bytes, all zeroed
+lu_StructuredBuffer lu_structured_buffer_create(size_t stride, size_t count);
+// Frees the CPU copy and deletes the buffer
+void lu_structured_buffer_delete(lu_StructuredBuffer *buf);
+// Returns a pointer to an element for writing, marking it dirty. NULL if index is out of range.
+void *lu_structured_buffer_get(lu_StructuredBuffer *buf, size_t index);
+// Copies stride bytes from src into an element, marking it dirty
+void lu_structured_buffer_set(lu_StructuredBuffer *buf, size_t index, const void *src);
+// Marks count elements starting at first as dirty, for when the data was written through buf->data directly
+void lu_structured_buffer_mark_dirty(lu_StructuredBuffer *buf, size_t first, size_t count);
+// Uploads the dirty pages, one glBufferSubData per run of them, and returns how many bytes went up
+size_t lu_structured_buffer_upload(lu_StructuredBuffer *buf);
+// Binds the buffer to a shader storage binding point
+void lu_structured_buffer_bind(lu_StructuredBuffer *buf, GLuint binding);
+
+// Shared vertex layouts. lu_define_layout bakes the VBO into each mesh's VAO, so every mesh needs its own. A lu_VertexLayout describes the
+// format once with glVertexAttribFormat/glVertexAttribBinding, identical layouts share one VAO, and meshes just bind their buffer to it.
+// Needs GL 4.3 or ARB_vertex_attrib_binding. For example, for the Vertex struct in lu_define_layout's comment:
+//   lu_VertexAttrib attribs[] = {{3, GL_FLOAT}, {2, GL_FLOAT}};
+//   lu_VertexLayout layout = lu_vertex_layout_create(2, attribs);
+//   lu_Mesh mesh = lu_mesh_create_shared(&layout);
+
+// Returns the layout for a list of attributes, making its VAO the first time the layout is seen. VAO is 0 on failure.
+lu_VertexLayout lu_vertex_layout_create(size_t num_attribs, const lu_VertexAttrib *attribs);
+// Creates a mesh that uses a layout's shared VAO, use it like any other mesh
+lu_Mesh lu_mesh_create_shared(const lu_VertexLayout *layout);
+// Number of distinct layouts (and so shared VAOs) created so far
+size_t lu_vertex_layout_count(void);
+// Deletes every shared VAO, meshes using them can't be drawn afterwards
+void lu_clear_vertex_layouts(void);
+
+// Vertex quantization. lu_quantize_vertices shrinks a float vertex with a position, normal and tex coord (32 bytes) to a 16 byte
+// lu_PackedVertex, to be drawn with lu_packed_vertex_layout. The shader undoes it like this:
+//   layout(location = 0) in vec4 aPosition; // Normalized, 0-1 across the bounds
+//   layout(location = 1) in vec2 aNormal;   // Normalized, octahedral
+//   layout(location = 2) in vec2 aTexCoord;
+//   uniform vec3 uScale, uOffset;           // From lu_QuantizeInfo
+//   vec3 position = aPosition.xyz * uScale + uOffset;
+//   vec3 normal = vec3(aNormal, 1.0 - abs(aNormal.x) - abs(aNormal.y));
+//   if (normal.z < 0.0) normal.xy = (1.0 - abs(normal.yx)) * vec2(normal.x >= 0.0 ? 1.0 : -1.0, normal.y >= 0.0 ? 1.0 : -1.0);
+//   normal = normalize(normal);
+
+// Packs num_vertices vertices from src (each src_stride bytes apart, with float[3] positions, float[3] normals and float[2] tex coords at the
+// given offsets, LU_ATTRIB_NONE for missing ones) into dst, and fills in info with how to undo the position quantization
+void lu_quantize_vertices(const void *src, size_t num_vertices, size_t src_stride, size_t position_offset, size_t normal_offset, size_t tex_coord_offset, lu_PackedVertex *dst, lu_QuantizeInfo *info);
+// Returns the shared layout for lu_PackedVertex
+lu_VertexLayout lu_packed_vertex_layout(void);
+// Encodes a unit normal as two signed 16 bit octahedral coordinates
+void lu_octahedral_encode(const float normal[3], int16_t out[2]);
+// Packs a vector in -1-1 into GL_INT_2_10_10_10_REV, e.g. for tangents with the handedness in w
+uint32_t lu_pack_snorm_2_10_10_10(const float value[4]);
+
+// Background uploads. A lu_UploadQueue runs jobs on worker threads, each with a hidden context sharing objects with the main one, so
+// loading and uploading doesn't hold up rendering. Each finished job leaves a fence behind, and the render thread only uses what a job
+// made once lu_upload_ready or lu_upload_wait says so. Buffers, textures, shaders, programs and syncs are shared between contexts, but
+// VAOs, framebuffers and program pipelines aren't, so jobs shouldn't make those.
+// For example:
+//   lu_UploadQueue *queue = lu_upload_queue_create(window, 2);
+//   lu_UploadJob *job = lu_upload_texture_async(queue, "textures/big.png", LU_TEXTURE_MIPMAPS);
+//   ... keep rendering frames ...
+//   if (lu_upload_ready(queue, job)) {
+//     texture = lu_upload_result(job);
+//     lu_upload_release(queue, job);
+//   }
+
+// Starts num_workers upload threads, each with an invisible GLFW window sharing window's context. Call from the main thread.
+lu_UploadQueue *lu_upload_queue_create(GLFWwindow *window, size_t num_workers);
+// Same as lu_upload_queue_create, for a headless context (needs LU_HEADLESS)
+lu_UploadQueue *lu_upload_queue_create_headless(lu_HeadlessContext *ctx, size_t num_workers);
+// Runs any jobs still queued, then stops the workers and deletes their contexts. Jobs still have to be released.
+void lu_upload_queue_delete(lu_UploadQueue *queue);
+// Queues func(data) to run on a worker. data has to stay valid until the job is done.
+lu_UploadJob *lu_upload_submit(lu_UploadQueue *queue, lu_UploadFunc func, void *data);
+// Queues lu_load_texture(texture_location, flags) to run on a worker
+lu_UploadJob *lu_upload_texture_async(lu_UploadQueue *queue, const char *texture_location, unsigned int flags);
+// Queues sending a mesh's data to its VBO on a worker (like lu_mesh_send). The mesh's data has to stay around until the job is done.
+lu_UploadJob *lu_upload_mesh_async(lu_UploadQueue *queue, lu_Mesh *mesh);
+// Returns true once a job is done and the GPU has finished its commands, without blocking
+bool lu_upload_ready(lu_UploadQueue *queue, lu_UploadJob *job);
+// Blocks until a job is done, then makes the current context's GPU commands wait for it (glWaitSync), and returns its result
+GLuint lu_upload_wait(lu_UploadQueue *queue, lu_UploadJob *job);
+// What a finished job returned
+GLuint lu_upload_result(lu_UploadJob *job);
+// Frees a job, waiting for it first if it isn't done
+void lu_upload_release(lu_UploadQueue *queue, lu_UploadJob *job);
+
+// Frame pacing. A lu_Frame wraps each frame of a render loop in lu_frame_begin/lu_frame_end, keeping at most frames_in_flight frames
+// queued on the GPU (1 for the lowest latency, more to keep the GPU busy), optionally capping the frame rate, and timing each frame.
+// For example:
+//   lu_Frame frame = lu_frame_create(window, 2);
+//   lu_frame_set_limit(&frame, 120.0);
+//   while (!glfwWindowShouldClose(window)) {
+//     glfwPollEvents();
+//     lu_frame_begin(&frame);
+//     ... draw ...
+//     lu_frame_end(&frame); // Swaps buffers
+//     printf("%.2f ms cpu, %.2f ms gpu, %.2f ms latency\n", frame.stats.cpu_ms, frame.stats.gpu_ms, frame.stats.latency_ms);
+//   }
+
+// Creates a frame pacer for window (NULL for a headless context) with frames_in_flight between 1 and LU_MAX_FRAMES_IN_FLIGHT
+lu_Frame lu_frame_create(GLFWwindow *window, int frames_in_flight);
+// Deletes a frame pacer's fences and queries
+void lu_frame_delete(lu_Frame *frame);
+// Caps the frame rate by sleeping in lu_frame_begin, 0 for no cap
+void lu_frame_set_limit(lu_Frame *frame, double max_fps);
+// Sets a function for lu_frame_end to call just before the frame is submitted, for late latching input. Only writes to memory the GPU
+// reads when the commands run (like a persistently mapped lu_UniformRing allocation) make it into the frame.
+void lu_frame_set_latch(lu_Frame *frame, void (*latch)(void *data), void *data);
+// Starts a frame, waiting for the limiter and for the GPU to finish the frame frames_in_flight frames ago
+void lu_frame_begin(lu_Frame *frame);
+// Ends a frame: runs the latch function, swaps buffers (or flushes), and collects timings for frames the GPU has finished into frame->stats
+void lu_frame_end(lu_Frame *frame);
+
+// GPU profiler. Wrap GPU work in LU_GPU_SCOPE("name") { ... } to time it with GL_TIMESTAMP queries. Scopes nest into a tree, and
+// the queries go round a ring of frames so results are read a few frames later without waiting on the GPU. While the profiler is
+// off, a scope costs one check of lu_gpu_profiling. Don't break or return out of a scope, or it won't be closed until the end of the frame.
+// For example:
+//   lu_gpu_profiler_enable(true);
+//   while (...) {
+//     lu_gpu_profiler_frame(); // Or let lu_frame_begin do it
+//     LU_GPU_SCOPE("shadows") { ... }
+//     LU_GPU_SCOPE("main") {
+//       LU_GPU_SCOPE("opaque") lu_mesh_render_many(meshes, n, GL_TRIANGLES);
+//     }
+//   }
+//   lu_gpu_profiler_print(stdout);
+
+// Set by lu_gpu_profiler_enable, read by LU_GPU_SCOPE
+extern bool lu_gpu_profiling;
+#define LU_GPU_SCOPE(name)                                                                                                                 \
+  for (bool lu_gpu_scope_open_ = lu_gpu_profiling && lu_gpu_scope_begin(name), lu_gpu_scope_once_ = true; lu_gpu_scope_once_;             \
+       lu_gpu_scope_once_ = false, lu_gpu_scope_open_ && lu_gpu_scope_end())
+
+// Turns the GPU profiler on or off. Makes its queries the first time, so the context has to be current.
+void lu_gpu_profiler_enable(bool enabled);
+// Ends the profiler's current frame and starts the next, reading back the oldest frame in the ring. Call once a frame.
+void lu_gpu_profiler_frame(void);
+// Starts a scope by hand, name has to stay around as long as the profiler (a string literal is best)
+bool lu_gpu_scope_begin(const char *name);
+// Ends the latest scope started with lu_gpu_scope_begin
+bool lu_gpu_scope_end(void);
+// Sets scopes to the profiler's tree (parents come before their children) and returns how many scopes there are
+size_t lu_gpu_profiler_get_scopes(const lu_GpuScopeStats **scopes);
+// Prints the tree with last/min/avg/max times to out (stdout if NULL)
+void lu_gpu_profiler_print(FILE *out);
+// Starts or stops recording every scope for a trace. Starting throws away what was recorded before.
+void lu_gpu_profiler_capture(bool capturing);
+// Writes the recorded scopes as Chrome trace JSON (open it in chrome://tracing or Perfetto). Returns false if it couldn't be written.
+bool lu_gpu_profiler_write_trace(const char *path);
+// Clears the tree and trace
+void lu_gpu_profiler_reset(void);
+// Turns the profiler off and deletes its queries
+void lu_gpu_profiler_delete(void);
+
+// Pipeline statistics. Counts the vertices, primitives, shader invocations and samples each named pass generates, and optionally each mesh
+// drawn with lu_mesh_render*, to find overdraw and wasted geometry. Like the GPU profiler, the queries go round a ring of frames and are
+// read back a few frames later without waiting on the GPU. While they're off, a pass costs one check of lu_pipeline_stats_on and a mesh
+// render one more. Passes don't nest: one started inside another is counted as part of the outer one.
+// For example:
+//   lu_pipeline_stats_enable(true, false);
+//   while (...) {
+//     lu_pipeline_stats_frame(); // Or let lu_frame_begin do it
+//     LU_PIPELINE_PASS("shadows") { ... }
+//     LU_PIPELINE_PASS("opaque") lu_mesh_render_many(meshes, n, GL_TRIANGLES);
+//   }
+//   lu_pipeline_stats_print(stdout);
+// samples_passed over the pass's pixel count is its overdraw, and fragment_invocations well above samples_passed means fragments are being
+// shaded and then failing the depth test.
+
+// Set by lu_pipeline_stats_enable, read by LU_PIPELINE_PASS and lu_mesh_render*
+extern bool lu_pipeline_stats_on;
+#define LU_PIPELINE_PASS(name)                                                                                                             \
+  for (bool lu_pipeline_pass_open_ = lu_pipeline_stats_on && lu_pipeline_pass_begin(name), lu_pipeline_pass_once_ = true;                 \
+       lu_pipeline_pass_once_; lu_pipeline_pass_once_ = false, lu_pipeline_pass_open_ && lu_pipeline_pass_end())
+
+// Turns the pipeline statistics on or off. With per_mesh, every lu_mesh_render* draw gets its own queries, so meshes get numbers of their
+// own and passes only count what was drawn through lu_mesh_render*. Call it with the context current.
+void lu_pipeline_stats_enable(bool enabled, bool per_mesh);
+// Ends the current frame and starts the next, reading back the oldest frame in the ring. Call once a frame.
+void lu_pipeline_stats_frame(void);
+// Starts a pass by hand, name has to stay around as long as the stats (a string literal is best). False inside another pass.
+bool lu_pipeline_pass_begin(const char *name);
+// Ends the pass started with lu_pipeline_pass_begin
+bool lu_pipeline_pass_end(void);
+// Sets passes to the stats for each pass and returns how many there are
+size_t lu_pipeline_stats_get_passes(const lu_PipelineStats **passes);
+// Same for meshes, which only get stats with per_mesh on. lu_mesh_delete drops a mesh, moving the last one into its place.
+size_t lu_pipeline_stats_get_meshes(const lu_PipelineStats **meshes);
+// Prints the latest frame's numbers for every pass and mesh to out (stdout if NULL)
+void lu_pipeline_stats_print(FILE *out);
+// Clears the numbers for every pass and mesh
+void lu_pipeline_stats_reset(void);
+// Turns the stats off and deletes their queries
+void lu_pipeline_stats_delete(void);
+
+// Debug object tracking. Build luGL.c with -DLU_DEBUG_OBJECTS and every GL object luGL creates or deletes is recorded, so leaks show up as
+// live counts that keep growing. Without it these still exist but report nothing.
+
+// Fills in stats with the tracker's counts (all zeros without LU_DEBUG_OBJECTS)
+void lu_debug_object_stats(lu_ObjectStats *stats);
+// Logs the live object counts (see lu_set_log_callback) and returns the total, e.g. to call just before exiting
+size_t lu_debug_report_objects(void);
+
+// Instrumentation counters. Build luGL.c with -DLU_INSTRUMENT and the main entry points count their calls, bytes and time, each thread
+// into its own counters, so it's cheap enough to leave on in a profiling build. Without it the counters aren't compiled in at all.
+// e.g.
+// lu_stats_start_dump(stderr, 5.0, false); // Print a table every 5 seconds
+// ...
+// lu_Stats stats;
+// lu_stats_snapshot(&stats);
+// printf("%llu draws\n", (unsigned long long)stats.counters[LU_STAT_MESH_RENDER].calls);
+
+// Sums every thread's counters into stats (all zeros without LU_INSTRUMENT) and copies the pipeline statistics' passes. Counters only go
+// up, subtract two snapshots for a rate.
+void lu_stats_snapshot(lu_Stats *stats);
+// Name of the call a counter belongs to
+const char *lu_stat_name(lu_StatId id);
+// Writes stats to out as a table, or as one line of JSON
+void lu_stats_write(FILE *out, const lu_Stats *stats, bool json);
+// Starts a thread that writes a snapshot to out every interval_seconds, replacing any dump already running
+bool lu_stats_start_dump(FILE *out, double interval_seconds, bool json);
+// Stops the dump thread started by lu_stats_start_dump
+void lu_stats_stop_dump(void);
+
+// GL call tracing. Build luGL.c (and any code whose GL calls should be traced) with -DLU_TRACE, and everything between lu_trace_start and
+// lu_trace_stop is written to a trace file: calls, arguments and the data they upload. Replay it with tools/replay.
+// e.g.
+// lu_HeadlessContext *ctx = lu_create_headless_context(1280, 720);
+// lu_trace_start("scene.lutrace"); // Before anything is created, so the replay has every object
+// ...
+// lu_trace_stop();
+// Each thread records into its own buffer without locking, the file is only locked when a full buffer is written out. Start and stop
+// while other threads aren't making GL calls, since lu_trace_start swaps GLEW's function pointers for everyone. Payloads over 4 GiB
+// can't be recorded, those calls are logged as errors and left out.
+
+// Starts writing a trace to path, false if it couldn't be opened or luGL was built without LU_TRACE
+bool lu_trace_start(const char *path);
+// Writes out every thread's buffer and closes the trace
+void lu_trace_stop(void);
+// Whether a trace is being written
+bool lu_trace_active(void);
+// Marks the end of a frame, so the replay can time frames. lu_frame_end calls it for you.
+void lu_trace_frame(void);
+// Records that size bytes at offset in buffer were written through a persistent mapping, which GL never sees. lu_uniform_ring_bind does
+// this for the uniform ring.
+void lu_trace_buffer_write(GLuint buffer, size_t offset, size_t size, const void *data);
+// Name of a traced call, e.g. "glBufferData"
+const char *lu_trace_call_name(lu_TraceCall call);
+
+#ifdef LU_TRACE
+void GLAPIENTRY lu_traced_glBindTexture(GLenum target, GLuint texture);
+void GLAPIENTRY lu_traced_glBlendFunc(GLenum sfactor, GLenum dfactor);
+void GLAPIENTRY lu_traced_glClear(GLbitfield mask);
+void GLAPIENTRY lu_traced_glClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+void GLAPIENTRY lu_traced_glCullFace(GLenum mode);
+void GLAPIENTRY lu_traced_glDeleteTextures(GLsizei n, const GLuint *textures);
+void GLAPIENTRY lu_traced_glDepthFunc(GLenum func);
+void GLAPIENTRY lu_traced_glDepthMask(GLboolean flag);
+void GLAPIENTRY lu_traced_glDisable(GLenum cap);
+void GLAPIENTRY lu_traced_glDrawArrays(GLenum mode, GLint first, GLsizei count);
+void GLAPIENTRY lu_traced_glDrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices);
+void GLAPIENTRY lu_traced_glEnable(GLenum cap);
+void GLAPIENTRY lu_traced_glFinish(void);
+void GLAPIENTRY lu_traced_glFlush(void);
+void GLAPIENTRY lu_traced_glGenTextures(GLsizei n, GLuint *textures);
+void GLAPIENTRY lu_traced_glGetIntegerv(GLenum pname, GLint *data);
+void GLAPIENTRY lu_traced_glPixelStorei(GLenum pname, GLint param);
+void GLAPIENTRY lu_traced_glReadPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, void *pixels);
+void GLAPIENTRY lu_traced_glScissor(GLint x, GLint y, GLsizei width, GLsizei height);
+void GLAPIENTRY lu_traced_glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format,
+                                       GLenum type, const void *pixels);
+void GLAPIENTRY lu_traced_glTexParameteri(GLenum target, GLenum pname, GLint param);
+void GLAPIENTRY lu_traced_glTexParameteriv(GLenum target, GLenum pname, const GLint *params);
+void GLAPIENTRY lu_traced_glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format,
+                                          GLenum type, const void *pixels);
+void GLAPIENTRY lu_traced_glViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+#endif
 
 #endif // luGL.h
+
+// The GL 1.1 redirects for LU_TRACE. They're outside the include guard so luGL.c can include this again once its wrappers (which call
+// the real functions) are defined.
+#if defined(LU_TRACE) && !defined(LU_TRACE_NO_REDIRECTS) && !defined(LU_TRACE_REDIRECTS)
+#define LU_TRACE_REDIRECTS
+#define glBindTexture lu_traced_glBindTexture
+#define glBlendFunc lu_traced_glBlendFunc
+#define glClear lu_traced_glClear
+#define glClearColor lu_traced_glClearColor
+#define glCullFace lu_traced_glCullFace
+#define glDeleteTextures lu_traced_glDeleteTextures
+#define glDepthFunc lu_traced_glDepthFunc
+#define glDepthMask lu_traced_glDepthMask
+#define glDisable lu_traced_glDisable
+#define glDrawArrays lu_traced_glDrawArrays
+#define glDrawElements lu_traced_glDrawElements
+#define glEnable lu_traced_glEnable
+#define glFinish lu_traced_glFinish
+#define glFlush lu_traced_glFlush
+#define glGenTextures lu_traced_glGenTextures
+#define glGetIntegerv lu_traced_glGetIntegerv
+#define glPixelStorei lu_traced_glPixelStorei
+#define glReadPixels lu_traced_glReadPixels
+#define glScissor lu_traced_glScissor
+#define glTexImage2D lu_traced_glTexImage2D
+#define glTexParameteri lu_traced_glTexParameteri
+#define glTexParameteriv lu_traced_glTexParameteriv
+#define glTexSubImage2D lu_traced_glTexSubImage2D
+#define glViewport lu_traced_glViewport
+#endif
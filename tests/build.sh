@@ -0,0 +1,14 @@
+mkdir -p build
+
+# Runs headless (EGL), so no window or display is needed, e.g. on Mesa llvmpipe:
+#   LIBGL_ALWAYS_SOFTWARE=1 ./build/tests
+# Built with LU_DEBUG_OBJECTS so checks can see the objects luGL has alive.
+gcc \
+-O2 \
+-DLU_HEADLESS \
+-DLU_DEBUG_OBJECTS \
+core/main.c \
+../luGL/luGL.c \
+-o build/tests \
+-lGLEW -lGL -lEGL -lglfw -lm -lpthread \
+-I../luGL
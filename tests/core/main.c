@@ -0,0 +1,339 @@
+#include <GL/glew.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "luGL.h"
+
+// End to end checks for luGL, run on a headless context so they work without a display (and on Mesa llvmpipe in CI). Each check does
+// the real thing on the GL, reads back what it made and fails if it isn't what it should be. The exit code is the number of failures.
+//   ./build/tests                  Run every check
+//   ./build/tests relayout_soak    Only run the checks named
+
+#define RELAYOUT_ITERATIONS 1000000 // Times relayout_soak lays the same meshes out again
+#define RELAYOUT_WARMUP 10000       // Iterations before memory use is measured, so the driver's caches are warm
+#define RELAYOUT_GROWTH_KIB 1024    // How much resident memory may grow over the rest of the soak
+
+#define FRAMEBUFFER_SIZE 1024     // Width and height of the headless framebuffer, big enough for a pixel per object
+#define OBJECTS 1000000           // Objects drawn from a structured buffer by structured_buffer_objects
+#define OBJECTS_UPDATE_EVERY 1000 // Objects changed between the two draws are more than a page apart, so only some pages go up
+
+#define GRID_POINTS 4000 // Vertices written by shaders/grid.comp, not a whole number of work groups
+#define GRID_COLUMNS 64
+#define GRID_SPACING 16 // Pixels between the points
+
+typedef struct {
+  const char *name;
+  bool (*run)(void); // Logs what went wrong and returns false on failure
+} Check;
+
+static double now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+// Resident memory of the process in KiB, 0 if it can't be read
+static size_t resident_kib(void) {
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (!f) return 0;
+  unsigned long size = 0, resident = 0;
+  if (fscanf(f, "%lu %lu", &size, &resident) != 2) resident = 0;
+  fclose(f);
+  return resident * (size_t)sysconf(_SC_PAGESIZE) / 1024;
+}
+
+static size_t live_objects(void) {
+  lu_ObjectStats stats;
+  lu_debug_object_stats(&stats);
+  size_t total = 0;
+  for (int i = 0; i < LU_OBJECT_TYPE_COUNT; i++) total += stats.live[i];
+  return total;
+}
+
+// Lays an interleaved and a structure of arrays mesh out again a million times, switching between two layouts, and fails if any GL
+// objects or memory leak along the way
+static bool check_relayout_soak(void) {
+  size_t sizes_a[] = {sizeof(float), sizeof(float)}, counts_a[] = {2, 2};
+  size_t sizes_b[] = {sizeof(float), sizeof(float), sizeof(uint8_t)}, counts_b[] = {3, 2, 4};
+  GLenum types_a[] = {GL_FLOAT, GL_FLOAT}, types_b[] = {GL_FLOAT, GL_FLOAT, GL_UNSIGNED_BYTE};
+  lu_Mesh mesh = lu_mesh_create(2, sizes_a, counts_a, types_a);
+  lu_Mesh soa = lu_mesh_create_soa(2, sizes_a, counts_a, types_a);
+  if (!mesh.VAO || !soa.VAO) {
+    fprintf(stderr, "relayout_soak: Could not create the meshes.\n");
+    return false;
+  }
+
+  // Names deleted behind the mesh's back get made again instead of being bound
+  glDeleteBuffers(1, &soa.VBO);
+  glDeleteVertexArrays(1, &soa.VAO);
+  lu_mesh_relayout(&soa, 3, sizes_b, counts_b, types_b);
+  bool ok = glIsBuffer(soa.VBO) && glIsVertexArray(soa.VAO);
+  if (!ok) fprintf(stderr, "relayout_soak: Relaying out a structure of arrays mesh kept its deleted names.\n");
+  GLenum error = glGetError();
+  if (error != GL_NO_ERROR) {
+    fprintf(stderr, "relayout_soak: GL error 0x%x relaying out a mesh with deleted names.\n", error);
+    ok = false;
+  }
+
+  size_t objects = 0, resident = 0;
+  for (size_t i = 0; i < RELAYOUT_ITERATIONS && ok; i++) {
+    bool wide = i & 1;
+    lu_mesh_relayout(&mesh, wide ? 3 : 2, wide ? sizes_b : sizes_a, wide ? counts_b : counts_a, wide ? types_b : types_a);
+    lu_mesh_relayout(&soa, wide ? 3 : 2, wide ? sizes_b : sizes_a, wide ? counts_b : counts_a, wide ? types_b : types_a);
+    if (i == RELAYOUT_WARMUP) {
+      objects = live_objects();
+      resident = resident_kib();
+    }
+  }
+  if (ok && live_objects() != objects) {
+    fprintf(stderr, "relayout_soak: %zu GL objects alive after the warm up, %zu at the end.\n", objects, live_objects());
+    ok = false;
+  }
+  size_t resident_end = resident_kib();
+  if (ok && resident_end > resident + RELAYOUT_GROWTH_KIB) {
+    fprintf(stderr, "relayout_soak: Resident memory grew from %zu KiB to %zu KiB.\n", resident, resident_end);
+    ok = false;
+  }
+  if (ok && (error = glGetError()) != GL_NO_ERROR) {
+    fprintf(stderr, "relayout_soak: GL error 0x%x.\n", error);
+    ok = false;
+  }
+
+  lu_mesh_delete(&mesh);
+  lu_mesh_delete(&soa);
+  return ok;
+}
+
+// One object per pixel, as laid out in the std430 buffer of shaders/objects.vert
+typedef struct {
+  float offset[2];
+  uint32_t colour; // RGBA8, red in the low byte
+  uint32_t pad;
+} Object;
+
+static uint32_t object_colour(size_t i, uint32_t frame) {
+  uint32_t x = (uint32_t)i * 2654435761u + frame * 40503u;
+  return (x ^ x >> 15) | 0xff000000u;
+}
+
+// Draws the objects and checks every pixel of the framebuffer against the colour its object should have
+static bool objects_drawn(GLuint program, lu_Mesh *point, lu_StructuredBuffer *objects) {
+  glClearColor(0, 0, 0, 0);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glUseProgram(program);
+  lu_structured_buffer_bind(objects, 0);
+  lu_mesh_render_instanced(point, GL_POINTS, objects->count);
+  lu_Image image = lu_read_pixels(0, 0, FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE);
+  if (!image.pixels) return false;
+
+  size_t mismatches = 0;
+  const uint8_t *pixels = image.pixels;
+  for (size_t y = 0; y < FRAMEBUFFER_SIZE; y++) {
+    for (size_t x = 0; x < FRAMEBUFFER_SIZE; x++) {
+      // lu_read_pixels puts the top row first, objects go from the bottom up
+      size_t i = (FRAMEBUFFER_SIZE - 1 - y) * FRAMEBUFFER_SIZE + x;
+      uint32_t expected = i < objects->count ? ((const Object *)objects->data)[i].colour : 0;
+      uint32_t actual;
+      memcpy(&actual, pixels + (y * FRAMEBUFFER_SIZE + x) * 4, 4);
+      if (actual == expected) continue;
+      if (mismatches++ < 5) fprintf(stderr, "structured_buffer_objects: Object %zu is 0x%08x, should be 0x%08x.\n", i, actual, expected);
+    }
+  }
+  lu_image_free(&image);
+  if (mismatches) fprintf(stderr, "structured_buffer_objects: %zu pixels are wrong.\n", mismatches);
+  return mismatches == 0;
+}
+
+// Draws a million instances that each look up their position and colour in a structured buffer by gl_InstanceID, then changes some of
+// them and checks only their pages are uploaded and the framebuffer matches again
+static bool check_structured_buffer_objects(void) {
+  GLuint program = lu_create_shader_program(2, "shaders/objects.vert", "shaders/objects.frag");
+  size_t sizes[] = {sizeof(float)}, counts[] = {2};
+  GLenum types[] = {GL_FLOAT};
+  lu_Mesh point = lu_mesh_create(1, sizes, counts, types);
+  float origin[2] = {0, 0};
+  lu_mesh_add_bytes(&point, origin, sizeof(origin));
+  lu_mesh_send(&point);
+  lu_StructuredBuffer objects = lu_structured_buffer_create(sizeof(Object), OBJECTS);
+  bool ok = program && objects.buffer;
+  if (!ok) fprintf(stderr, "structured_buffer_objects: Could not create the program or buffer.\n");
+
+  for (size_t i = 0; i < OBJECTS && ok; i++) {
+    // The middle of the pixel the object is drawn on
+    Object object = {{(i % FRAMEBUFFER_SIZE + 0.5f) * 2.f / FRAMEBUFFER_SIZE - 1.f, (i / FRAMEBUFFER_SIZE + 0.5f) * 2.f / FRAMEBUFFER_SIZE - 1.f},
+                     object_colour(i, 0)};
+    lu_structured_buffer_set(&objects, i, &object);
+  }
+  if (ok && lu_structured_buffer_upload(&objects) != sizeof(Object) * OBJECTS) {
+    fprintf(stderr, "structured_buffer_objects: The first upload didn't send the whole buffer.\n");
+    ok = false;
+  }
+  ok = ok && objects_drawn(program, &point, &objects);
+
+  size_t changed = 0;
+  for (size_t i = 0; i < OBJECTS && ok; i += OBJECTS_UPDATE_EVERY) {
+    Object *object = lu_structured_buffer_get(&objects, i);
+    object->colour = object_colour(i, 1);
+    changed++;
+  }
+  size_t uploaded = ok ? lu_structured_buffer_upload(&objects) : 0;
+  if (ok && (uploaded == 0 || uploaded > changed * LU_STRUCTURED_PAGE_BYTES)) {
+    fprintf(stderr, "structured_buffer_objects: Changing %zu objects uploaded %zu bytes.\n", changed, uploaded);
+    ok = false;
+  }
+  ok = ok && objects_drawn(program, &point, &objects);
+
+  GLenum error = glGetError();
+  if (ok && error != GL_NO_ERROR) {
+    fprintf(stderr, "structured_buffer_objects: GL error 0x%x.\n", error);
+    ok = false;
+  }
+  lu_structured_buffer_delete(&objects);
+  lu_mesh_delete(&point);
+  glDeleteProgram(program);
+  return ok;
+}
+
+// Mirrors the std430 Vertex in shaders/grid.comp, and the mesh's vertex layout
+typedef struct {
+  float position[4];
+  float colour[4];
+} GridVertex;
+
+// What shaders/grid.comp should write for vertex i
+static GridVertex grid_vertex(size_t i) {
+  size_t x = i % GRID_COLUMNS, y = i / GRID_COLUMNS;
+  GridVertex v = {{(x * GRID_SPACING + 0.5f) * 2.f / FRAMEBUFFER_SIZE - 1.f, (y * GRID_SPACING + 0.5f) * 2.f / FRAMEBUFFER_SIZE - 1.f, 0, 1},
+                  {(float)x / GRID_COLUMNS, (float)y / GRID_COLUMNS, 0.5f, 1}};
+  return v;
+}
+
+// Has a compute shader write a mesh's vertices through lu_mesh_bind_storage, reads the buffer back to check every vertex, then draws the
+// mesh straight from what the GPU wrote and checks the points landed where they should
+static bool check_compute_mesh_storage(void) {
+  GLuint compute = lu_create_shader_program(1, "shaders/grid.comp");
+  GLuint draw = lu_create_shader_program(2, "shaders/points.vert", "shaders/objects.frag");
+  size_t sizes[] = {sizeof(float), sizeof(float)}, counts[] = {4, 4};
+  GLenum types[] = {GL_FLOAT, GL_FLOAT};
+  lu_Mesh mesh = lu_mesh_create(2, sizes, counts, types);
+  if (!compute || !draw || !mesh.VAO) {
+    fprintf(stderr, "compute_mesh_storage: Could not create the programs or mesh.\n");
+    return false;
+  }
+
+  lu_mesh_allocate(&mesh, sizeof(GridVertex) * GRID_POINTS);
+  lu_mesh_bind_storage(&mesh, 0);
+  glProgramUniform1ui(compute, glGetUniformLocation(compute, "count"), GRID_POINTS);
+  glProgramUniform1ui(compute, glGetUniformLocation(compute, "spacing"), GRID_SPACING);
+  glProgramUniform1ui(compute, glGetUniformLocation(compute, "columns"), GRID_COLUMNS);
+  glProgramUniform1f(compute, glGetUniformLocation(compute, "pixel_size"), 2.f / FRAMEBUFFER_SIZE);
+  lu_dispatch_compute_items(compute, GRID_POINTS, GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+  bool ok = true;
+  GridVertex *vertices = malloc(sizeof(GridVertex) * GRID_POINTS);
+  if (vertices) {
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.VBO);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GridVertex) * GRID_POINTS, vertices);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    size_t mismatches = 0;
+    for (size_t i = 0; i < GRID_POINTS; i++) {
+      GridVertex expected = grid_vertex(i);
+      const float *a = vertices[i].position, *b = expected.position;
+      bool same = true;
+      // The colours are divided on the GPU, which GLSL only promises to a couple of ulp
+      for (int j = 0; j < 8; j++) same &= fabsf(a[j] - b[j]) <= 1e-6f;
+      if (same) continue;
+      if (mismatches++ < 5)
+        fprintf(stderr, "compute_mesh_storage: Vertex %zu is (%g, %g), should be (%g, %g).\n", i, a[0], a[1], b[0], b[1]);
+    }
+    if (mismatches) fprintf(stderr, "compute_mesh_storage: %zu vertices are wrong.\n", mismatches);
+    ok = mismatches == 0;
+    free(vertices);
+  } else {
+    ok = false;
+  }
+
+  glClearColor(0, 0, 0, 0);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glUseProgram(draw);
+  lu_mesh_render(&mesh, GL_POINTS);
+  lu_Image image = lu_read_pixels(0, 0, FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE);
+  size_t lit = 0, stray = 0;
+  for (size_t y = 0; y < FRAMEBUFFER_SIZE && image.pixels; y++) {
+    for (size_t x = 0; x < FRAMEBUFFER_SIZE; x++) {
+      // Only the alpha is checked, the colours' rounding to 8 bits is up to the driver
+      bool on = ((const uint8_t *)image.pixels)[(y * FRAMEBUFFER_SIZE + x) * 4 + 3] != 0;
+      size_t row = FRAMEBUFFER_SIZE - 1 - y;
+      bool point = x % GRID_SPACING == 0 && row % GRID_SPACING == 0 && x / GRID_SPACING < GRID_COLUMNS &&
+                   row / GRID_SPACING * GRID_COLUMNS + x / GRID_SPACING < GRID_POINTS;
+      lit += on && point;
+      stray += on && !point;
+    }
+  }
+  lu_image_free(&image);
+  if (ok && (lit != GRID_POINTS || stray != 0)) {
+    fprintf(stderr, "compute_mesh_storage: Drawing the mesh lit %zu of %d points and %zu other pixels.\n", lit, GRID_POINTS, stray);
+    ok = false;
+  }
+
+  GLenum error = glGetError();
+  if (ok && error != GL_NO_ERROR) {
+    fprintf(stderr, "compute_mesh_storage: GL error 0x%x.\n", error);
+    ok = false;
+  }
+  lu_mesh_delete(&mesh);
+  glDeleteProgram(compute);
+  glDeleteProgram(draw);
+  return ok;
+}
+
+static Check checks[] = {
+    {"relayout_soak", check_relayout_soak},
+    {"structured_buffer_objects", check_structured_buffer_objects},
+    {"compute_mesh_storage", check_compute_mesh_storage},
+};
+#define NUM_CHECKS (sizeof(checks) / sizeof(checks[0]))
+
+static bool selected(const Check *check, int argc, char **argv) {
+  if (argc < 2) return true;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], check->name)) return true;
+  }
+  return false;
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    bool known = false;
+    for (size_t j = 0; j < NUM_CHECKS; j++) known |= !strcmp(argv[i], checks[j].name);
+    if (!known) {
+      fprintf(stderr, "Usage: %s [check...]\nChecks:", argv[0]);
+      for (size_t j = 0; j < NUM_CHECKS; j++) fprintf(stderr, " %s", checks[j].name);
+      fprintf(stderr, "\n");
+      return 2;
+    }
+  }
+
+  lu_HeadlessContext *ctx = lu_create_headless_context(FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE);
+  if (!ctx) return 1;
+
+  int failures = 0;
+  for (size_t i = 0; i < NUM_CHECKS; i++) {
+    if (!selected(&checks[i], argc, argv)) continue;
+    double start = now_ns();
+    bool ok = checks[i].run();
+    printf("%-24s %s (%.0f ms)\n", checks[i].name, ok ? "ok" : "FAILED", (now_ns() - start) / 1e6);
+    // A check that fails half way can leave errors behind, don't blame them on the next one
+    while (glGetError() != GL_NO_ERROR) {}
+    if (!ok) failures++;
+  }
+
+  lu_headless_context_delete(ctx);
+  return failures;
+}
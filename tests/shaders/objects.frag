@@ -0,0 +1,9 @@
+#version 430 core
+
+flat in vec4 colour;
+
+out vec4 fragColor;
+
+void main() {
+	fragColor = colour;
+}
@@ -0,0 +1,20 @@
+#version 430 core
+
+layout(location = 0) in vec2 aPosition;
+
+struct Object {
+	vec2 offset;
+	uint colour;
+	uint pad;
+};
+layout(std430, binding = 0) readonly buffer Objects {
+	Object objects[];
+};
+
+flat out vec4 colour;
+
+void main() {
+	Object object = objects[gl_InstanceID];
+	colour = unpackUnorm4x8(object.colour);
+	gl_Position = vec4(aPosition + object.offset, 0.0, 1.0);
+}
@@ -0,0 +1,11 @@
+#version 430 core
+
+layout(location = 0) in vec4 aPosition;
+layout(location = 1) in vec4 aColour;
+
+flat out vec4 colour;
+
+void main() {
+	colour = aColour;
+	gl_Position = aPosition;
+}
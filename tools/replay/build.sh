@@ -0,0 +1,11 @@
+mkdir -p build
+
+# Replays traces from a luGL built with -DLU_TRACE, headless (EGL), so no display is needed
+gcc \
+-O2 \
+-DLU_HEADLESS \
+core/main.c \
+../../luGL/luGL.c \
+-o build/replay \
+-lGLEW -lGL -lEGL -lglfw -lm -lpthread \
+-I../../luGL
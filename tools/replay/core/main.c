@@ -0,0 +1,589 @@
+#include <GL/glew.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "luGL.h"
+
+// Replays a trace written by a luGL built with LU_TRACE on a headless context, and reports how long each kind of call took.
+//   ./build/replay scene.lutrace               Replay it and print per call and per frame timings
+//   ./build/replay scene.lutrace -f            glFinish after every call, so GPU work is counted against the call that caused it
+//   ./build/replay scene.lutrace -c            Check for GL errors after every call (not timed), to see if the replay went wrong
+//   ./build/replay scene.lutrace -s 1920x1080  Size of the framebuffer that stands in for the window's (1280x720 by default)
+//   ./build/replay scene.lutrace -n 20         Only list the 20 calls that took longest in total
+//   ./build/replay scene.lutrace -o last.ppm   Save what the framebuffer ends up showing, to check the replay looks right
+// Uniform locations are used as they were traced, so replay on the same driver the trace came from. Each traced thread's calls are
+// made on a context of their own sharing objects with the others, so a worker's bindings don't land on the render thread's context.
+
+typedef struct {
+  const lu_TraceRecord *record;
+  const uint64_t *args;
+  const uint8_t *payload;
+  uint32_t thread;
+} Call;
+
+typedef struct {
+  uint64_t count;
+  double total_ns, max_ns;
+} CallStats;
+
+// Objects get new names when they're made again, so every name in the trace goes through one of these
+typedef enum {
+  MAP_BUFFER,
+  MAP_TEXTURE,
+  MAP_VERTEX_ARRAY,
+  MAP_FRAMEBUFFER,
+  MAP_RENDERBUFFER,
+  MAP_QUERY,
+  MAP_PIPELINE,
+  MAP_PROGRAM, // Shaders and programs share names
+  MAP_COUNT
+} MapKind;
+
+typedef struct {
+  GLuint *names;
+  size_t capacity;
+} NameMap;
+
+typedef struct {
+  uint64_t traced;
+  GLsync sync;
+} SyncEntry;
+
+// A buffer the trace has mapped, so writes recorded with lu_trace_buffer_write can go straight into it
+typedef struct {
+  uint64_t traced;
+  GLenum target;
+  uint8_t *base; // Pointer returned by glMapBufferRange, minus the offset mapped
+} Mapping;
+
+#define MAX_SYNCS 256
+#define MAX_MAPPINGS 32
+
+static NameMap maps[MAP_COUNT];
+static SyncEntry syncs[MAX_SYNCS];
+static Mapping mappings[MAX_MAPPINGS];
+static GLuint default_framebuffer;
+static uint8_t *scratch;
+static size_t scratch_size;
+
+static double now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static GLuint map_get(MapKind kind, uint64_t traced) {
+  if (kind == MAP_FRAMEBUFFER && traced == 0) return default_framebuffer;
+  NameMap *map = &maps[kind];
+  // Names made before the trace started are passed through as they are
+  if (traced < map->capacity && map->names[traced]) return map->names[traced];
+  return (GLuint)traced;
+}
+
+static void map_set(MapKind kind, uint64_t traced, GLuint name) {
+  NameMap *map = &maps[kind];
+  if (traced >= map->capacity) {
+    size_t capacity = map->capacity ? map->capacity : 256;
+    while (capacity <= traced) capacity *= 2;
+    GLuint *names = realloc(map->names, capacity * sizeof(GLuint));
+    if (!names) return;
+    memset(names + map->capacity, 0, (capacity - map->capacity) * sizeof(GLuint));
+    map->names = names;
+    map->capacity = capacity;
+  }
+  map->names[traced] = name;
+}
+
+static GLsync sync_get(uint64_t traced) {
+  for (int i = 0; i < MAX_SYNCS; i++) {
+    if (syncs[i].sync && syncs[i].traced == traced) return syncs[i].sync;
+  }
+  return NULL;
+}
+
+static void sync_set(uint64_t traced, GLsync sync) {
+  for (int i = 0; i < MAX_SYNCS; i++) {
+    if (syncs[i].sync && syncs[i].traced != traced) continue;
+    syncs[i].traced = traced;
+    syncs[i].sync = sync;
+    return;
+  }
+  fprintf(stderr, "More than %d fences alive at once, dropping one.\n", MAX_SYNCS);
+}
+
+static void *scratch_get(size_t size) {
+  if (size > scratch_size) {
+    uint8_t *bigger = realloc(scratch, size);
+    if (!bigger) return NULL;
+    scratch = bigger;
+    scratch_size = size;
+  }
+  return scratch;
+}
+
+static float to_float(uint64_t bits) {
+  uint32_t low = (uint32_t)bits;
+  float f;
+  memcpy(&f, &low, sizeof(f));
+  return f;
+}
+
+// glGen*: make as many new names and map the traced ones to them
+static void replay_gen(void (*gen)(GLsizei, GLuint *), MapKind kind, const Call *call) {
+  GLsizei n = (GLsizei)call->args[0];
+  const GLuint *traced = (const GLuint *)call->payload;
+  GLuint *names = scratch_get(n * sizeof(GLuint));
+  if (!names || n <= 0) return;
+  gen(n, names);
+  for (GLsizei i = 0; i < n; i++) map_set(kind, traced[i], names[i]);
+}
+
+static void replay_delete(void (*del)(GLsizei, const GLuint *), MapKind kind, const Call *call) {
+  GLsizei n = (GLsizei)call->args[0];
+  const GLuint *traced = (const GLuint *)call->payload;
+  GLuint *names = scratch_get(n * sizeof(GLuint));
+  if (!names || n <= 0) return;
+  for (GLsizei i = 0; i < n; i++) names[i] = map_get(kind, traced[i]);
+  del(n, names);
+  for (GLsizei i = 0; i < n; i++) map_set(kind, traced[i], 0);
+}
+
+// GLEW's functions are macros for pointers, these give glGen*/glDelete* something to point at
+static void gen_buffers(GLsizei n, GLuint *names) { glGenBuffers(n, names); }
+static void gen_textures(GLsizei n, GLuint *names) { glGenTextures(n, names); }
+static void gen_vertex_arrays(GLsizei n, GLuint *names) { glGenVertexArrays(n, names); }
+static void gen_framebuffers(GLsizei n, GLuint *names) { glGenFramebuffers(n, names); }
+static void gen_renderbuffers(GLsizei n, GLuint *names) { glGenRenderbuffers(n, names); }
+static void gen_queries(GLsizei n, GLuint *names) { glGenQueries(n, names); }
+static void gen_program_pipelines(GLsizei n, GLuint *names) { glGenProgramPipelines(n, names); }
+static void delete_buffers(GLsizei n, const GLuint *names) { glDeleteBuffers(n, names); }
+static void delete_textures(GLsizei n, const GLuint *names) { glDeleteTextures(n, names); }
+static void delete_vertex_arrays(GLsizei n, const GLuint *names) { glDeleteVertexArrays(n, names); }
+static void delete_framebuffers(GLsizei n, const GLuint *names) { glDeleteFramebuffers(n, names); }
+static void delete_renderbuffers(GLsizei n, const GLuint *names) { glDeleteRenderbuffers(n, names); }
+static void delete_queries(GLsizei n, const GLuint *names) { glDeleteQueries(n, names); }
+static void delete_program_pipelines(GLsizei n, const GLuint *names) { glDeleteProgramPipelines(n, names); }
+
+static MapKind image_kind(GLenum target) {
+  return target == GL_RENDERBUFFER ? MAP_RENDERBUFFER : MAP_TEXTURE;
+}
+
+static void replay_buffer_write(const Call *call) {
+  uint64_t traced = call->args[0];
+  size_t offset = call->args[1], size = call->args[2];
+  for (int i = 0; i < MAX_MAPPINGS; i++) {
+    if (mappings[i].base && mappings[i].traced == traced) {
+      memcpy(mappings[i].base + offset, call->payload, size);
+      return;
+    }
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, map_get(MAP_BUFFER, traced));
+  glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, call->payload);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+// Makes one traced call again
+static void replay(const Call *call) {
+  const uint64_t *a = call->args;
+  const void *payload = call->payload;
+  uint32_t payload_bytes = call->record->payload_bytes;
+#define I(i) ((GLint)a[i])
+#define U(i) ((GLuint)a[i])
+#define E(i) ((GLenum)a[i])
+#define S(i) ((GLsizei)a[i])
+#define F(i) to_float(a[i])
+#define P(i) ((const void *)(uintptr_t)a[i])
+#define NAME(kind, i) map_get(kind, a[i])
+  switch ((lu_TraceCall)call->record->call) {
+  case LU_TRACE_glActiveTexture: glActiveTexture(E(0)); break;
+  case LU_TRACE_glAttachShader: glAttachShader(NAME(MAP_PROGRAM, 0), NAME(MAP_PROGRAM, 1)); break;
+  case LU_TRACE_glBeginQuery: glBeginQuery(E(0), NAME(MAP_QUERY, 1)); break;
+  case LU_TRACE_glBindBuffer: glBindBuffer(E(0), NAME(MAP_BUFFER, 1)); break;
+  case LU_TRACE_glBindBufferBase: glBindBufferBase(E(0), U(1), NAME(MAP_BUFFER, 2)); break;
+  case LU_TRACE_glBindBufferRange: glBindBufferRange(E(0), U(1), NAME(MAP_BUFFER, 2), (GLintptr)a[3], (GLsizeiptr)a[4]); break;
+  case LU_TRACE_glBindFramebuffer: glBindFramebuffer(E(0), NAME(MAP_FRAMEBUFFER, 1)); break;
+  case LU_TRACE_glBindProgramPipeline: glBindProgramPipeline(NAME(MAP_PIPELINE, 0)); break;
+  case LU_TRACE_glBindRenderbuffer: glBindRenderbuffer(E(0), NAME(MAP_RENDERBUFFER, 1)); break;
+  case LU_TRACE_glBindVertexArray: glBindVertexArray(NAME(MAP_VERTEX_ARRAY, 0)); break;
+  case LU_TRACE_glBindVertexBuffer: glBindVertexBuffer(U(0), NAME(MAP_BUFFER, 1), (GLintptr)a[2], S(3)); break;
+  case LU_TRACE_glBufferData: glBufferData(E(0), (GLsizeiptr)a[1], payload_bytes ? payload : NULL, E(2)); break;
+  case LU_TRACE_glBufferStorage: glBufferStorage(E(0), (GLsizeiptr)a[1], payload_bytes ? payload : NULL, (GLbitfield)a[2]); break;
+  case LU_TRACE_glBufferSubData: glBufferSubData(E(0), (GLintptr)a[1], (GLsizeiptr)a[2], payload); break;
+  case LU_TRACE_glCheckFramebufferStatus: glCheckFramebufferStatus(E(0)); break;
+  case LU_TRACE_glClientWaitSync: glClientWaitSync(sync_get(a[0]), (GLbitfield)a[1], a[2]); break;
+  case LU_TRACE_glCompileShader: glCompileShader(NAME(MAP_PROGRAM, 0)); break;
+  case LU_TRACE_glCopyImageSubData:
+    glCopyImageSubData(NAME(image_kind(E(1)), 0), E(1), I(2), I(3), I(4), I(5), NAME(image_kind(E(7)), 6), E(7), I(8), I(9), I(10), I(11), S(12), S(13), S(14));
+    break;
+  case LU_TRACE_glCreateProgram: map_set(MAP_PROGRAM, a[0], glCreateProgram()); break;
+  case LU_TRACE_glCreateShader: map_set(MAP_PROGRAM, a[1], glCreateShader(E(0))); break;
+  case LU_TRACE_glDeleteBuffers: replay_delete(delete_buffers, MAP_BUFFER, call); break;
+  case LU_TRACE_glDeleteFramebuffers: replay_delete(delete_framebuffers, MAP_FRAMEBUFFER, call); break;
+  case LU_TRACE_glDeleteProgram: glDeleteProgram(NAME(MAP_PROGRAM, 0)); break;
+  case LU_TRACE_glDeleteProgramPipelines: replay_delete(delete_program_pipelines, MAP_PIPELINE, call); break;
+  case LU_TRACE_glDeleteQueries: replay_delete(delete_queries, MAP_QUERY, call); break;
+  case LU_TRACE_glDeleteRenderbuffers: replay_delete(delete_renderbuffers, MAP_RENDERBUFFER, call); break;
+  case LU_TRACE_glDeleteShader: glDeleteShader(NAME(MAP_PROGRAM, 0)); break;
+  case LU_TRACE_glDeleteSync:
+    glDeleteSync(sync_get(a[0]));
+    sync_set(a[0], NULL);
+    break;
+  case LU_TRACE_glDeleteVertexArrays: replay_delete(delete_vertex_arrays, MAP_VERTEX_ARRAY, call); break;
+  case LU_TRACE_glDetachShader: glDetachShader(NAME(MAP_PROGRAM, 0), NAME(MAP_PROGRAM, 1)); break;
+  case LU_TRACE_glDisableVertexAttribArray: glDisableVertexAttribArray(U(0)); break;
+  case LU_TRACE_glDispatchCompute: glDispatchCompute(U(0), U(1), U(2)); break;
+  case LU_TRACE_glDrawArraysInstanced: glDrawArraysInstanced(E(0), I(1), S(2), S(3)); break;
+  case LU_TRACE_glEnableVertexAttribArray: glEnableVertexAttribArray(U(0)); break;
+  case LU_TRACE_glEndQuery: glEndQuery(E(0)); break;
+  case LU_TRACE_glFenceSync: sync_set(a[2], glFenceSync(E(0), (GLbitfield)a[1])); break;
+  case LU_TRACE_glFramebufferRenderbuffer: glFramebufferRenderbuffer(E(0), E(1), E(2), NAME(MAP_RENDERBUFFER, 3)); break;
+  case LU_TRACE_glGenBuffers: replay_gen(gen_buffers, MAP_BUFFER, call); break;
+  case LU_TRACE_glGenFramebuffers: replay_gen(gen_framebuffers, MAP_FRAMEBUFFER, call); break;
+  case LU_TRACE_glGenProgramPipelines: replay_gen(gen_program_pipelines, MAP_PIPELINE, call); break;
+  case LU_TRACE_glGenQueries: replay_gen(gen_queries, MAP_QUERY, call); break;
+  case LU_TRACE_glGenRenderbuffers: replay_gen(gen_renderbuffers, MAP_RENDERBUFFER, call); break;
+  case LU_TRACE_glGenVertexArrays: replay_gen(gen_vertex_arrays, MAP_VERTEX_ARRAY, call); break;
+  case LU_TRACE_glGenerateMipmap: glGenerateMipmap(E(0)); break;
+  case LU_TRACE_glGetProgramInfoLog: glGetProgramInfoLog(NAME(MAP_PROGRAM, 0), S(1), NULL, scratch_get(S(1) + 1)); break;
+  case LU_TRACE_glGetProgramiv: glGetProgramiv(NAME(MAP_PROGRAM, 0), E(1), scratch_get(64)); break;
+  case LU_TRACE_glGetProgramPipelineInfoLog: glGetProgramPipelineInfoLog(NAME(MAP_PIPELINE, 0), S(1), NULL, scratch_get(S(1) + 1)); break;
+  case LU_TRACE_glGetProgramPipelineiv: glGetProgramPipelineiv(NAME(MAP_PIPELINE, 0), E(1), scratch_get(64)); break;
+  case LU_TRACE_glGetQueryObjectui64v: glGetQueryObjectui64v(NAME(MAP_QUERY, 0), E(1), scratch_get(64)); break;
+  case LU_TRACE_glGetQueryObjectuiv: glGetQueryObjectuiv(NAME(MAP_QUERY, 0), E(1), scratch_get(64)); break;
+  case LU_TRACE_glGetShaderInfoLog: glGetShaderInfoLog(NAME(MAP_PROGRAM, 0), S(1), NULL, scratch_get(S(1) + 1)); break;
+  case LU_TRACE_glGetShaderiv: glGetShaderiv(NAME(MAP_PROGRAM, 0), E(1), scratch_get(64)); break;
+  case LU_TRACE_glGetUniformBlockIndex: glGetUniformBlockIndex(NAME(MAP_PROGRAM, 0), payload); break;
+  case LU_TRACE_glGetUniformLocation: glGetUniformLocation(NAME(MAP_PROGRAM, 0), payload); break;
+  case LU_TRACE_glIsBuffer: glIsBuffer(NAME(MAP_BUFFER, 0)); break;
+  case LU_TRACE_glIsVertexArray: glIsVertexArray(NAME(MAP_VERTEX_ARRAY, 0)); break;
+  case LU_TRACE_glLinkProgram: glLinkProgram(NAME(MAP_PROGRAM, 0)); break;
+  case LU_TRACE_glMapBufferRange: {
+    uint8_t *data = glMapBufferRange(E(0), (GLintptr)a[1], (GLsizeiptr)a[2], (GLbitfield)a[3]);
+    if (!data) break;
+    for (int i = 0; i < MAX_MAPPINGS; i++) {
+      if (mappings[i].base && mappings[i].traced != a[4]) continue;
+      mappings[i] = (Mapping){a[4], E(0), data - a[1]};
+      break;
+    }
+    break;
+  }
+  case LU_TRACE_glMemoryBarrier: glMemoryBarrier((GLbitfield)a[0]); break;
+  case LU_TRACE_glProgramParameteri: glProgramParameteri(NAME(MAP_PROGRAM, 0), E(1), I(2)); break;
+  case LU_TRACE_glQueryCounter: glQueryCounter(NAME(MAP_QUERY, 0), E(1)); break;
+  case LU_TRACE_glRenderbufferStorage: glRenderbufferStorage(E(0), E(1), S(2), S(3)); break;
+  case LU_TRACE_glShaderBinary: {
+    GLsizei count = S(0);
+    GLuint *shaders = scratch_get(count * sizeof(GLuint));
+    if (!shaders) break;
+    for (GLsizei i = 0; i < count; i++) shaders[i] = map_get(MAP_PROGRAM, ((const GLuint *)payload)[i]);
+    glShaderBinary(count, shaders, E(1), (const uint8_t *)payload + count * sizeof(GLuint), S(2));
+    break;
+  }
+  case LU_TRACE_glShaderSource: {
+    const GLchar *source = payload;
+    glShaderSource(NAME(MAP_PROGRAM, 0), 1, &source, NULL);
+    break;
+  }
+  case LU_TRACE_glSpecializeShader:
+  case LU_TRACE_glSpecializeShaderARB: {
+    GLuint n = U(1);
+    const GLuint *indices = payload, *values = indices + n;
+    const GLchar *entry = (const GLchar *)(values + n);
+    if (GLEW_VERSION_4_6)
+      glSpecializeShader(NAME(MAP_PROGRAM, 0), entry, n, indices, values);
+    else
+      glSpecializeShaderARB(NAME(MAP_PROGRAM, 0), entry, n, indices, values);
+    break;
+  }
+  case LU_TRACE_glUniform1f: glUniform1f(I(0), F(1)); break;
+  case LU_TRACE_glUniform1i: glUniform1i(I(0), I(1)); break;
+  case LU_TRACE_glUniform2f: glUniform2f(I(0), F(1), F(2)); break;
+  case LU_TRACE_glUniform3f: glUniform3f(I(0), F(1), F(2), F(3)); break;
+  case LU_TRACE_glUniform4f: glUniform4f(I(0), F(1), F(2), F(3), F(4)); break;
+  case LU_TRACE_glUniformBlockBinding: glUniformBlockBinding(NAME(MAP_PROGRAM, 0), U(1), U(2)); break;
+  case LU_TRACE_glUniformMatrix4fv: glUniformMatrix4fv(I(0), S(1), (GLboolean)a[2], payload); break;
+  case LU_TRACE_glUnmapBuffer:
+    for (int i = 0; i < MAX_MAPPINGS; i++) {
+      if (mappings[i].base && mappings[i].target == E(0)) mappings[i].base = NULL;
+    }
+    glUnmapBuffer(E(0));
+    break;
+  case LU_TRACE_glUseProgram: glUseProgram(NAME(MAP_PROGRAM, 0)); break;
+  case LU_TRACE_glUseProgramStages: glUseProgramStages(NAME(MAP_PIPELINE, 0), (GLbitfield)a[1], NAME(MAP_PROGRAM, 2)); break;
+  case LU_TRACE_glValidateProgramPipeline: glValidateProgramPipeline(NAME(MAP_PIPELINE, 0)); break;
+  case LU_TRACE_glVertexAttribBinding: glVertexAttribBinding(U(0), U(1)); break;
+  case LU_TRACE_glVertexAttribFormat: glVertexAttribFormat(U(0), I(1), E(2), (GLboolean)a[3], U(4)); break;
+  case LU_TRACE_glVertexAttribIFormat: glVertexAttribIFormat(U(0), I(1), E(2), U(3)); break;
+  case LU_TRACE_glVertexAttribPointer: glVertexAttribPointer(U(0), I(1), E(2), (GLboolean)a[3], S(4), P(5)); break;
+  case LU_TRACE_glWaitSync: glWaitSync(sync_get(a[0]), (GLbitfield)a[1], a[2]); break;
+
+  case LU_TRACE_glBindTexture: glBindTexture(E(0), NAME(MAP_TEXTURE, 1)); break;
+  case LU_TRACE_glBlendFunc: glBlendFunc(E(0), E(1)); break;
+  case LU_TRACE_glClear: glClear((GLbitfield)a[0]); break;
+  case LU_TRACE_glClearColor: glClearColor(F(0), F(1), F(2), F(3)); break;
+  case LU_TRACE_glCullFace: glCullFace(E(0)); break;
+  case LU_TRACE_glDeleteTextures: replay_delete(delete_textures, MAP_TEXTURE, call); break;
+  case LU_TRACE_glDepthFunc: glDepthFunc(E(0)); break;
+  case LU_TRACE_glDepthMask: glDepthMask((GLboolean)a[0]); break;
+  case LU_TRACE_glDisable: glDisable(E(0)); break;
+  case LU_TRACE_glDrawArrays: glDrawArrays(E(0), I(1), S(2)); break;
+  case LU_TRACE_glDrawElements: glDrawElements(E(0), S(1), E(2), P(3)); break;
+  case LU_TRACE_glEnable: glEnable(E(0)); break;
+  case LU_TRACE_glFinish: glFinish(); break;
+  case LU_TRACE_glFlush: glFlush(); break;
+  case LU_TRACE_glGenTextures: replay_gen(gen_textures, MAP_TEXTURE, call); break;
+  case LU_TRACE_glGetIntegerv: glGetIntegerv(E(0), scratch_get(256)); break;
+  case LU_TRACE_glPixelStorei: glPixelStorei(E(0), I(1)); break;
+  case LU_TRACE_glReadPixels:
+    glReadPixels(I(0), I(1), S(2), S(3), E(4), E(5), a[7] ? (void *)(uintptr_t)a[6] : scratch_get((size_t)S(2) * S(3) * 16 + 16 * S(3)));
+    break;
+  case LU_TRACE_glScissor: glScissor(I(0), I(1), S(2), S(3)); break;
+  case LU_TRACE_glTexImage2D: glTexImage2D(E(0), I(1), I(2), S(3), S(4), I(5), E(6), E(7), payload_bytes ? payload : P(8)); break;
+  case LU_TRACE_glTexParameteri: glTexParameteri(E(0), E(1), I(2)); break;
+  case LU_TRACE_glTexParameteriv: glTexParameteriv(E(0), E(1), payload); break;
+  case LU_TRACE_glTexSubImage2D: glTexSubImage2D(E(0), I(1), I(2), I(3), S(4), S(5), E(6), E(7), payload_bytes ? payload : P(8)); break;
+  case LU_TRACE_glViewport: glViewport(I(0), I(1), S(2), S(3)); break;
+
+  case LU_TRACE_BUFFER_WRITE: replay_buffer_write(call); break;
+  case LU_TRACE_FRAME:
+  case LU_TRACE_CALL_COUNT: break;
+  }
+#undef I
+#undef U
+#undef E
+#undef S
+#undef F
+#undef P
+#undef NAME
+}
+
+// Calls with the same seq are all from one thread, and its records are further into the file the later they were made
+static int compare_seq(const void *a, const void *b) {
+  const lu_TraceRecord *x = ((const Call *)a)->record, *y = ((const Call *)b)->record;
+  if (x->seq != y->seq) return (x->seq > y->seq) - (x->seq < y->seq);
+  return (x > y) - (x < y);
+}
+
+static int compare_frame_times(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static CallStats stats[LU_TRACE_CALL_COUNT];
+
+static int compare_total(const void *a, const void *b) {
+  double x = stats[*(const int *)a].total_ns, y = stats[*(const int *)b].total_ns;
+  return (x < y) - (x > y);
+}
+
+// Reads a trace file and lists its records in the order they were made, returns how many there are (0 on failure)
+static size_t load_trace(const char *path, uint8_t **data_out, Call **calls_out, uint32_t *num_threads) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "Could not open %s.\n", path);
+    return 0;
+  }
+  fseek(f, 0, SEEK_END);
+  long len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *data = malloc(len > 0 ? len : 1);
+  // Version 1 traces gave every call a seq of its own, which sorts the same way
+  if (!data || len < 8 || fread(data, 1, len, f) != (size_t)len || (memcmp(data, LU_TRACE_MAGIC, 8) != 0 && memcmp(data, "luGLtrc1", 8) != 0)) {
+    fprintf(stderr, "%s isn't a luGL trace.\n", path);
+    fclose(f);
+    free(data);
+    return 0;
+  }
+  fclose(f);
+
+  size_t num_calls = 0, capacity = 1024;
+  Call *calls = malloc(capacity * sizeof(Call));
+  *num_threads = 0;
+  size_t at = 8;
+  while (calls && at + sizeof(lu_TraceChunk) <= (size_t)len) {
+    lu_TraceChunk chunk;
+    memcpy(&chunk, data + at, sizeof(chunk));
+    at += sizeof(chunk);
+    if (chunk.thread + 1 > *num_threads) *num_threads = chunk.thread + 1;
+    size_t end = at + chunk.bytes;
+    if (end > (size_t)len) {
+      fprintf(stderr, "Trace is cut short, replaying what's there.\n");
+      break;
+    }
+    while (at + sizeof(lu_TraceRecord) <= end) {
+      const lu_TraceRecord *record = (const lu_TraceRecord *)(data + at);
+      size_t bytes = sizeof(lu_TraceRecord) + record->num_args * sizeof(uint64_t) + ((record->payload_bytes + 7) & ~(size_t)7);
+      if (at + bytes > end) break;
+      if (num_calls == capacity) {
+        Call *bigger = realloc(calls, capacity * 2 * sizeof(Call));
+        if (!bigger) break;
+        calls = bigger;
+        capacity *= 2;
+      }
+      calls[num_calls].record = record;
+      calls[num_calls].args = (const uint64_t *)(record + 1);
+      calls[num_calls].payload = (const uint8_t *)(calls[num_calls].args + record->num_args);
+      calls[num_calls].thread = chunk.thread;
+      num_calls++;
+      at += bytes;
+    }
+    at = end;
+  }
+  // Each thread's records are in order already, this puts the threads together
+  qsort(calls, num_calls, sizeof(Call), compare_seq);
+  *data_out = data;
+  *calls_out = calls;
+  return num_calls;
+}
+
+static void save_framebuffer(const char *path, int width, int height) {
+  glBindFramebuffer(GL_FRAMEBUFFER, default_framebuffer);
+  lu_Image image = lu_read_pixels(0, 0, width, height);
+  if (!image.pixels) return;
+  FILE *f = fopen(path, "wb");
+  if (f) {
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+    const uint8_t *pixels = image.pixels;
+    for (size_t i = 0; i < (size_t)width * height; i++) fwrite(pixels + i * 4, 1, 3, f);
+    fclose(f);
+  } else {
+    fprintf(stderr, "Could not open %s for writing.\n", path);
+  }
+  lu_image_free(&image);
+}
+
+int main(int argc, char **argv) {
+  const char *path = NULL, *image_path = NULL;
+  bool finish_each = false, check_errors = false;
+  int width = 1280, height = 720, top = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-f")) {
+      finish_each = true;
+    } else if (!strcmp(argv[i], "-c")) {
+      check_errors = true;
+    } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+      if (sscanf(argv[++i], "%dx%d", &width, &height) != 2) width = 0;
+    } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      top = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      image_path = argv[++i];
+    } else if (!path && argv[i][0] != '-') {
+      path = argv[i];
+    } else {
+      path = NULL;
+      break;
+    }
+  }
+  if (!path || width <= 0 || height <= 0) {
+    fprintf(stderr, "Usage: %s trace [-f] [-c] [-s WIDTHxHEIGHT] [-n top] [-o image.ppm]\n", argv[0]);
+    return 2;
+  }
+
+  uint8_t *data;
+  Call *calls;
+  uint32_t num_threads;
+  size_t num_calls = load_trace(path, &data, &calls, &num_threads);
+  if (num_calls == 0) return 1;
+
+  // The thread that marked frames was rendering, its calls go on the context with the framebuffer standing in for the window's
+  uint32_t render_thread = calls[0].thread;
+  for (size_t i = 0; i < num_calls; i++) {
+    if (calls[i].record->call != LU_TRACE_FRAME) continue;
+    render_thread = calls[i].thread;
+    break;
+  }
+  lu_HeadlessContext **contexts = calloc(num_threads, sizeof(lu_HeadlessContext *));
+  if (!contexts) return 1;
+  lu_HeadlessContext *ctx = lu_create_headless_context(width, height);
+  if (!ctx) return 1;
+  contexts[render_thread] = ctx;
+  default_framebuffer = lu_headless_framebuffer(ctx);
+  uint32_t current = render_thread;
+
+  size_t num_frames = 0, errors = 0;
+  double *frame_ms = malloc(sizeof(double) * (num_calls + 1));
+  double start = now_ns(), frame_start = start;
+  for (size_t i = 0; i < num_calls; i++) {
+    const Call *call = &calls[i];
+    if (call->record->call >= LU_TRACE_CALL_COUNT) continue;
+    if (call->thread != current) {
+      // Switching flushes the context being left, so whatever it uploaded is there for the next one
+      if (!contexts[call->thread]) contexts[call->thread] = lu_create_shared_headless_context(ctx);
+      if (!contexts[call->thread] || !lu_headless_make_current(contexts[call->thread])) {
+        fprintf(stderr, "Could not make a context for thread %u.\n", call->thread);
+        break;
+      }
+      current = call->thread;
+    }
+    if (call->record->call == LU_TRACE_FRAME) {
+      // Finish each frame so they don't overlap, and frame times include the GPU's work
+      glFinish();
+      double now = now_ns();
+      if (frame_ms) frame_ms[num_frames] = (now - frame_start) / 1e6;
+      num_frames++;
+      frame_start = now;
+      continue;
+    }
+    double t = now_ns();
+    replay(call);
+    if (finish_each) glFinish();
+    double elapsed = now_ns() - t;
+    CallStats *s = &stats[call->record->call];
+    s->count++;
+    s->total_ns += elapsed;
+    if (elapsed > s->max_ns) s->max_ns = elapsed;
+    if (check_errors) {
+      GLenum error;
+      while ((error = glGetError()) != GL_NO_ERROR) {
+        if (errors++ < 10) fprintf(stderr, "Call %zu (%s) gave GL error 0x%x.\n", i, lu_trace_call_name(call->record->call), error);
+      }
+    }
+  }
+  if (current != render_thread) lu_headless_make_current(ctx);
+  glFinish();
+  double total_ms = (now_ns() - start) / 1e6;
+
+  printf("%s: %zu calls from %u thread%s, %zu frames, replayed in %.2f ms%s\n", path, num_calls, num_threads, num_threads == 1 ? "" : "s", num_frames,
+         total_ms, finish_each ? " (finishing after every call)" : "");
+  if (num_frames > 0 && frame_ms) {
+    qsort(frame_ms, num_frames, sizeof(double), compare_frame_times);
+    double sum = 0;
+    for (size_t i = 0; i < num_frames; i++) sum += frame_ms[i];
+    printf("frames: avg %.3f ms, median %.3f ms, min %.3f ms, max %.3f ms\n", sum / num_frames, frame_ms[num_frames / 2], frame_ms[0], frame_ms[num_frames - 1]);
+  }
+  if (check_errors) printf("GL errors: %zu\n", errors);
+
+  int order[LU_TRACE_CALL_COUNT];
+  int num_used = 0;
+  double calls_ns = 0;
+  for (int i = 0; i < LU_TRACE_CALL_COUNT; i++) {
+    if (stats[i].count == 0) continue;
+    order[num_used++] = i;
+    calls_ns += stats[i].total_ns;
+  }
+  qsort(order, num_used, sizeof(int), compare_total);
+  if (top > 0 && top < num_used) num_used = top;
+  printf("\n%-30s %10s %12s %10s %10s %7s\n", "call", "count", "total ms", "avg us", "max us", "time");
+  for (int i = 0; i < num_used; i++) {
+    const CallStats *s = &stats[order[i]];
+    printf("%-30s %10llu %12.3f %10.3f %10.3f %6.1f%%\n", lu_trace_call_name(order[i]), (unsigned long long)s->count, s->total_ns / 1e6, s->total_ns / 1e3 / s->count,
+           s->max_ns / 1e3, calls_ns > 0 ? s->total_ns / calls_ns * 100 : 0);
+  }
+
+  if (image_path) save_framebuffer(image_path, width, height);
+
+  for (uint32_t i = 0; i < num_threads; i++) {
+    if (contexts[i] != ctx) lu_headless_context_delete(contexts[i]);
+  }
+  free(contexts);
+  free(frame_ms);
+  free(calls);
+  free(data);
+  free(scratch);
+  lu_headless_context_delete(ctx);
+  return 0;
+}